@@ -0,0 +1,226 @@
+#include <errno.h>
+#include <string.h>
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+#endif
+#include "acceptor.h"
+#include "metrics.h"
+
+/// @file   acceptor.cpp
+/// @brief  监听socket, 批量接受新连接
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+#if defined(_WIN32)
+static const handle_t kInvalidHandle = INVALID_SOCKET;
+#else
+static const handle_t kInvalidHandle = -1;
+#endif
+
+/// 关闭socket
+static inline void CloseSocket(handle_t handle)
+{
+#if defined(_WIN32)
+    ::closesocket(handle);
+#else
+    ::close(handle);
+#endif
+}
+
+/// 创建非阻塞的监听socket
+/// @param  ip         监听的地址
+/// @param  port       监听的端口
+/// @param  backlog    已完成连接队列的长度
+/// @param  reuse_port 是否设置SO_REUSEPORT
+/// @param  handle     创建的监听socket
+/// @retval 0       成功
+/// @retval < 0     出错(-errno)
+int CreateListenSocket(const char * ip, unsigned short port, int backlog, bool reuse_port, handle_t * handle)
+{
+#if defined(__linux__)
+    handle_t listener = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+#else
+    handle_t listener = ::socket(AF_INET, SOCK_STREAM, 0);
+#endif
+    if (listener == kInvalidHandle)
+    {
+        return -errno;
+    }
+#if defined(_WIN32)
+    u_long nonblock = 1;
+    ::ioctlsocket(listener, FIONBIO, &nonblock);
+#endif
+
+    int on = 1;
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+#ifdef SO_REUSEPORT
+    if (reuse_port && ::setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, (const char *)&on, sizeof(on)) < 0)
+    {
+        int ret = -errno;
+        CloseSocket(listener);
+        return ret;
+    }
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip);
+    if (::bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || ::listen(listener, backlog) < 0)
+    {
+        int ret = -errno;
+        CloseSocket(listener);
+        return ret;
+    }
+    *handle = listener;
+    return 0;
+}
+
+/// 构造函数
+/// @param  reactor  监听socket所属的reactor
+/// @param  callback 新连接回调
+Acceptor::Acceptor(Reactor * reactor, const AcceptCallback & callback)
+    : EventHandler(), m_reactor(reactor), m_handle(kInvalidHandle), m_idle_fd(kInvalidHandle),
+      m_callback(callback), m_paused(false), m_timer(0)
+{
+#if defined(__linux__)
+    m_idle_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+/// 析构函数, 只能通过Close销毁
+Acceptor::~Acceptor()
+{
+#if defined(__linux__)
+    if (m_idle_fd >= 0)
+    {
+        ::close(m_idle_fd);
+    }
+#endif
+}
+
+/// 创建监听socket并注册到reactor
+/// @param  ip         监听的地址
+/// @param  port       监听的端口
+/// @param  backlog    已完成连接队列的长度
+/// @param  reuse_port 是否设置SO_REUSEPORT, 多个事件循环各自监听同一端口时使用
+/// @retval 0       成功
+/// @retval < 0     出错(-errno)
+int Acceptor::Listen(const char * ip, unsigned short port, int backlog, bool reuse_port)
+{
+    int ret = CreateListenSocket(ip, port, backlog, reuse_port, &m_handle);
+    if (ret != 0)
+    {
+        return ret;
+    }
+    return m_reactor->RegisterHandler(this, kReadEvent | kPersistEvent);
+}
+
+/// 关闭监听socket并释放创建者的引用
+/// 撤销注册和关闭都交给reactor延迟处理, 回调中关闭时本轮余下的事件被丢弃, 对象在引用都释放后销毁
+void Acceptor::Close()
+{
+    if (m_paused && m_reactor->CancelTimer(m_timer) == 0)
+    {
+        /// 定时器持有的引用
+        m_paused = false;
+        Release();
+    }
+    if (m_handle != kInvalidHandle)
+    {
+        /// 没有注册成功时CloseHandler也会关闭socket
+        m_reactor->CloseHandler(this);
+        m_handle = kInvalidHandle;
+    }
+    Release();
+}
+
+/// 获取该handler所对应的句柄
+handle_t Acceptor::GetHandle() const
+{
+    return m_handle;
+}
+
+/// 读事件: 接受已完成的连接, 最多kMaxAcceptsPerRead个
+void Acceptor::HandleRead()
+{
+    for (int accepted = 0; accepted < kMaxAcceptsPerRead; )
+    {
+#if defined(__linux__)
+        handle_t handle = ::accept4(m_handle, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        handle_t handle = ::accept(m_handle, NULL, NULL);
+#endif
+        if (handle != kInvalidHandle)
+        {
+#if defined(_WIN32)
+            u_long nonblock = 1;
+            ::ioctlsocket(handle, FIONBIO, &nonblock);
+#endif
+            m_reactor->GetMetrics()->AddAccepts(1);
+            ++accepted;
+            m_callback(handle);
+            continue;
+        }
+#if defined(__linux__)
+        int err = errno;
+        if (err == EINTR || err == ECONNABORTED || err == EPROTO)
+        {
+            /// 连接在accept之前已被对端重置, 继续接受下一个
+            continue;
+        }
+        if ((err == EMFILE || err == ENFILE) && m_idle_fd >= 0)
+        {
+            /// 腾出一个描述符, 接受并关闭一个连接, 让对端尽快得知被拒绝
+            ::close(m_idle_fd);
+            handle = ::accept(m_handle, NULL, NULL);
+            if (handle >= 0)
+            {
+                ::close(handle);
+            }
+            m_idle_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        }
+        if ((err == EMFILE || err == ENFILE) && m_idle_fd < 0)
+        {
+            /// 没有预留的描述符, 监听socket一直可读, 暂停一段时间以免空转
+            PauseAccepting();
+        }
+#endif
+        /// EAGAIN表示已接受完
+        break;
+    }
+}
+
+/// 暂停读事件, kRetryDelay毫秒后重新预留空闲描述符并恢复
+void Acceptor::PauseAccepting()
+{
+    if (m_paused || m_handle == kInvalidHandle)
+    {
+        return;
+    }
+    m_reactor->RegisterHandler(this, kPersistEvent);
+    m_paused = true;
+    /// 定时器持有一个引用, 到期或在Close中取消时释放
+    AddRef();
+    m_timer = m_reactor->ScheduleTimer(kRetryDelay, 0, [this]() {
+        m_paused = false;
+        if (m_handle != kInvalidHandle)
+        {
+#if defined(__linux__)
+            if (m_idle_fd < 0)
+            {
+                m_idle_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            }
+#endif
+            m_reactor->RegisterHandler(this, kReadEvent | kPersistEvent);
+        }
+        Release();
+    });
+}
+} // namespace reactor
@@ -0,0 +1,95 @@
+#ifndef _ACCEPTOR_H_
+#define _ACCEPTOR_H_
+
+#if defined(__linux__)
+    #include <sys/socket.h>
+#endif
+#include "reactor.h"
+
+/// @file   acceptor.h
+/// @brief  监听socket, 批量接受新连接
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 新连接回调, handle为非阻塞的已连接socket, 由回调接管
+typedef std::function<void(handle_t handle)> AcceptCallback;
+
+/// 创建非阻塞的监听socket
+/// @param  ip         监听的地址
+/// @param  port       监听的端口
+/// @param  backlog    已完成连接队列的长度
+/// @param  reuse_port 是否设置SO_REUSEPORT
+/// @param  handle     创建的监听socket
+/// @retval 0       成功
+/// @retval < 0     出错(-errno)
+int CreateListenSocket(const char * ip, unsigned short port, int backlog, bool reuse_port, handle_t * handle);
+
+/// 监听socket
+/// 每次读事件用accept4(SOCK_NONBLOCK|SOCK_CLOEXEC)接受到EAGAIN, 最多kMaxAcceptsPerRead个,
+/// 剩余的连接在下一轮接受(水平触发), 连接洪泛时不会饿死同一事件循环中的其他handler.
+/// 文件描述符耗尽(EMFILE)时关闭预留的空闲描述符, 接受并立即关闭一个连接, 再重新预留,
+/// 避免水平触发下监听socket一直可读而空转; 没能重新预留时暂停读事件, kRetryDelay毫秒后再恢复.
+/// 与其他handler一样由引用计数管理: 创建者持有一个引用, 用Close关闭监听socket并释放该引用,
+/// reactor的引用在本轮事件处理结束后释放, 因此可以在回调中关闭.
+class Acceptor : public EventHandler
+{
+public:
+
+    /// 构造函数
+    /// @param  reactor  监听socket所属的reactor
+    /// @param  callback 新连接回调
+    Acceptor(Reactor * reactor, const AcceptCallback & callback);
+
+    /// 创建监听socket并注册到reactor
+    /// @param  ip         监听的地址
+    /// @param  port       监听的端口
+    /// @param  backlog    已完成连接队列的长度
+    /// @param  reuse_port 是否设置SO_REUSEPORT, 多个事件循环各自监听同一端口时使用
+    /// @retval 0       成功
+    /// @retval < 0     出错(-errno)
+    int Listen(const char * ip, unsigned short port, int backlog = SOMAXCONN, bool reuse_port = false);
+
+    /// 关闭监听socket并释放创建者的引用, 之后不能再使用该对象
+    /// socket由reactor在本轮事件处理结束时关闭
+    void Close();
+
+    /// 获取该handler所对应的句柄
+    virtual handle_t GetHandle() const;
+
+    /// 读事件: 接受已完成的连接
+    virtual void HandleRead();
+
+    /// 每次读事件最多接受的连接数
+    static const int kMaxAcceptsPerRead = 64;
+
+    /// 描述符耗尽且没有预留描述符时, 暂停读事件的时间(毫秒)
+    static const int kRetryDelay = 100;
+
+protected:
+
+    /// 析构函数, 只能通过Close销毁
+    virtual ~Acceptor();
+
+private:
+
+    /// 暂停读事件, kRetryDelay毫秒后重新预留空闲描述符并恢复
+    void PauseAccepting();
+
+    /// 禁止拷贝构造和赋值操作
+    Acceptor(const Acceptor &);
+    Acceptor & operator=(const Acceptor &);
+
+private:
+
+    Reactor *       m_reactor;  ///< 所属的reactor
+    handle_t        m_handle;   ///< 监听socket
+    handle_t        m_idle_fd;  ///< 预留的空闲描述符, 用于EMFILE时拒绝连接
+    AcceptCallback  m_callback; ///< 新连接回调
+    bool            m_paused;   ///< 是否因描述符耗尽暂停了读事件
+    timer_id_t      m_timer;    ///< 恢复读事件的定时器, m_paused时有效
+};
+} // namespace reactor
+
+#endif // _ACCEPTOR_H_
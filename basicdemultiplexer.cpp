@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <string.h>
+#if defined(__linux__)
+    #include <sys/mman.h>
+    #include <sys/socket.h>
+    #include <sys/syscall.h>
+#endif
+#include "basicdemultiplexer.h"
+
+/// @file   basicdemultiplexer.cpp
+/// @brief  io_uring提交和完成队列的实现, 与handler类型无关
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+#if defined(__linux__) && !defined(REACTOR_NO_IO_URING)
+/// 构造函数, 创建失败时IsValid返回false
+/// @param  entries 提交队列长度
+IoUringRing::IoUringRing(unsigned entries)
+    : m_ring_fd(-1), m_sq_ring(MAP_FAILED), m_sq_ring_size(0),
+      m_cq_ring(MAP_FAILED), m_cq_ring_size(0), m_sqes(NULL), m_sqes_size(0), m_free_ops(NULL)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    /// 单线程使用, 完成事件在进入内核时处理即可, 不必打断用户态
+    params.flags = IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    m_ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (m_ring_fd < 0 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        m_ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if (m_ring_fd < 0)
+    {
+        return;
+    }
+    /// 需要单次映射和带超时的等待(5.11以上内核)
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+    {
+        ::close(m_ring_fd);
+        m_ring_fd = -1;
+        return;
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (m_cq_ring_size > m_sq_ring_size)
+    {
+        m_sq_ring_size = m_cq_ring_size;
+    }
+    m_sq_ring = ::mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void * sqes = ::mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (sqes != MAP_FAILED)
+        {
+            ::munmap(sqes, m_sqes_size);
+        }
+        if (m_sq_ring != MAP_FAILED)
+        {
+            ::munmap(m_sq_ring, m_sq_ring_size);
+            m_sq_ring = MAP_FAILED;
+        }
+        ::close(m_ring_fd);
+        m_ring_fd = -1;
+        return;
+    }
+    m_cq_ring = m_sq_ring;
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    char * sq = static_cast<char *>(m_sq_ring);
+    m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sq_entries = params.sq_entries;
+    m_sq_local = *m_sq_tail;
+    /// 提交队列项与下标一一对应
+    unsigned * array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned idx = 0; idx < m_sq_entries; ++idx)
+    {
+        array[idx] = idx;
+    }
+
+    char * cq = static_cast<char *>(m_cq_ring);
+    m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+/// 析构函数
+IoUringRing::~IoUringRing()
+{
+    if (m_ring_fd < 0)
+    {
+        return;
+    }
+    ::munmap(m_sqes, m_sqes_size);
+    ::munmap(m_sq_ring, m_sq_ring_size);
+    ::close(m_ring_fd);
+}
+
+/// io_uring是否创建成功(内核不支持时失败)
+bool IoUringRing::IsValid() const
+{
+    return m_ring_fd >= 0;
+}
+
+/// 提交异步接收, 完成时在WaitEvents中回调
+/// @retval = 0 提交成功
+/// @retval < 0 提交出错
+int IoUringRing::AsyncRead(handle_t handle, void * buf, size_t len, const CompletionCallback & callback)
+{
+    io_uring_sqe * sqe = GetSqe();
+    if (sqe == NULL)
+    {
+        return -EBUSY;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = handle;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->user_data = reinterpret_cast<uint64_t>(AllocOperation(callback));
+    return 0;
+}
+
+/// 提交异步发送, 完成时在WaitEvents中回调
+/// @retval = 0 提交成功
+/// @retval < 0 提交出错
+int IoUringRing::AsyncWrite(handle_t handle, const void * buf, size_t len, const CompletionCallback & callback)
+{
+    io_uring_sqe * sqe = GetSqe();
+    if (sqe == NULL)
+    {
+        return -EBUSY;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = handle;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uint64_t>(AllocOperation(callback));
+    return 0;
+}
+
+/// 提交异步accept, 新连接为非阻塞socket, 完成时在WaitEvents中回调
+/// @retval = 0 提交成功
+/// @retval < 0 提交出错
+int IoUringRing::AsyncAccept(handle_t handle, const CompletionCallback & callback)
+{
+    io_uring_sqe * sqe = GetSqe();
+    if (sqe == NULL)
+    {
+        return -EBUSY;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = handle;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = reinterpret_cast<uint64_t>(AllocOperation(callback));
+    return 0;
+}
+
+/// 取一个空闲的提交队列项, 队列满时先提交
+io_uring_sqe * IoUringRing::GetSqe()
+{
+    if (m_sq_local - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+    {
+        Enter(0, 0);
+        if (m_sq_local - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+        {
+            return NULL;
+        }
+    }
+    io_uring_sqe * sqe = &m_sqes[m_sq_local & m_sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ++m_sq_local;
+    return sqe;
+}
+
+/// 提交排队中的请求并等待至少min_complete个完成事件
+int IoUringRing::Enter(unsigned min_complete, int timeout)
+{
+    __atomic_store_n(m_sq_tail, m_sq_local, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sq_local - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && min_complete == 0)
+    {
+        return 0;
+    }
+    unsigned flags = 0;
+    io_uring_getevents_arg arg;
+    __kernel_timespec ts;
+    void * argp = NULL;
+    size_t argsz = 0;
+    if (min_complete > 0)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout > 0)
+        {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = static_cast<long long>(timeout % 1000) * 1000000;
+            memset(&arg, 0, sizeof(arg));
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            argp = &arg;
+            argsz = sizeof(arg);
+        }
+    }
+    if (to_submit > 0)
+    {
+        /// 只等待完成事件的调用相当于epoll_wait, 不计入
+        CountCtlCall();
+    }
+    int ret = static_cast<int>(::syscall(__NR_io_uring_enter, m_ring_fd, to_submit, min_complete,
+                                         flags, argp, argsz));
+    return ret < 0 ? -errno : ret;
+}
+
+/// 提交poll请求, 边缘触发用multishot poll, 其他方式为单次poll
+int IoUringRing::SubmitPoll(handle_t handle, event_t evt, uint64_t user_data)
+{
+    io_uring_sqe * sqe = GetSqe();
+    if (sqe == NULL)
+    {
+        return -EBUSY;
+    }
+    uint32_t events = 0;
+    if (evt & kReadEvent)
+    {
+        events |= POLLIN;
+    }
+    if (evt & kWriteEvent)
+    {
+        events |= POLLOUT;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = handle;
+    sqe->poll32_events = events;
+    if (evt & kEdgeTriggered)
+    {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    sqe->user_data = user_data;
+    return 0;
+}
+
+/// 撤销user_data对应的poll请求
+int IoUringRing::SubmitPollRemove(uint64_t user_data)
+{
+    io_uring_sqe * sqe = GetSqe();
+    if (sqe == NULL)
+    {
+        return -EBUSY;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = 0;
+    return 0;
+}
+
+/// 完成式操作结束, 回调并回收
+void IoUringRing::CompleteOperation(uint64_t user_data, int res)
+{
+    Operation * op = reinterpret_cast<Operation *>(user_data);
+    CompletionCallback callback;
+    callback.swap(op->callback);
+    op->next = m_free_ops;
+    m_free_ops = op;
+    callback(res);
+}
+
+/// 分配完成式操作
+IoUringRing::Operation * IoUringRing::AllocOperation(const CompletionCallback & callback)
+{
+    Operation * op = m_free_ops;
+    if (op != NULL)
+    {
+        m_free_ops = op->next;
+    }
+    else
+    {
+        m_operations.push_back(Operation());
+        op = &m_operations.back();
+    }
+    op->callback = callback;
+    op->next = NULL;
+    return op;
+}
+#endif // __linux__ && !REACTOR_NO_IO_URING
+} // namespace reactor
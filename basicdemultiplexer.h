@@ -0,0 +1,979 @@
+#ifndef _BASIC_DEMULTIPLEXER_H_
+#define _BASIC_DEMULTIPLEXER_H_
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "reactor.h"
+#include "handlertable.h"
+#include "handlerpolicy.h"
+#include "metrics.h"
+
+/// @file   basicdemultiplexer.h
+/// @brief  编译期确定handler类型的事件分离器(epoll, poll, io_uring)
+/// 分离器以HandlerPolicy为模板参数, 分发时直接调用策略的静态函数, 没有虚函数调用.
+/// EventDemultiplexer的各个子类用VirtualHandlerPolicy实例化它们, BasicReactor用任意策略实例化.
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+#if defined(__linux__)
+    #include <poll.h>
+    #include <unistd.h>
+    #include <sys/epoll.h>
+    #include <sys/ioctl.h>
+    #if !defined(REACTOR_NO_IO_URING)
+        #include <linux/io_uring.h>
+    #endif
+
+/// 较旧的头文件中没有epoll忙轮询参数的定义(linux 6.9)
+#if !defined(EPIOCSPARAMS)
+struct epoll_params
+{
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t  prefer_busy_poll;
+    uint8_t  pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+namespace reactor
+{
+/// 分离器的公共部分: 运行指标
+class DemultiplexerBase
+{
+public:
+
+    /// 构造函数
+    DemultiplexerBase() : m_metrics(NULL) {}
+
+    /// 设置记录等待、分发和系统调用的指标, 为NULL时不记录
+    void SetMetrics(ReactorMetrics * metrics)
+    {
+        m_metrics = metrics;
+    }
+
+    /// 分离器是否创建成功
+    bool IsValid() const
+    {
+        return true;
+    }
+
+    /// 设置等待事件时内核的忙轮询时间, 缺省不支持
+    int SetBusyPoll(int /*usec*/)
+    {
+        return -1;
+    }
+
+protected:
+
+    /// 记录一次设置关注的系统调用
+    void CountCtlCall()
+    {
+        if (m_metrics != NULL)
+        {
+            m_metrics->AddCtlCalls(1);
+        }
+    }
+
+    ReactorMetrics *  m_metrics; ///< 运行指标, 可为NULL
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// epoll IO多路复用 事件分离器
+/// epoll_event.data携带句柄和登记代数, 按下标直接取登记项, 代数不符的过期事件被丢弃, 分发过程无内存分配.
+/// 已在集合中的句柄改变关注时只记在按句柄索引的待设置表中, 下一次epoll_wait之前每个句柄合并成一次EPOLL_CTL_MOD,
+/// 一轮分发中来回切换(读→写→读)最终不变的关注不再进入内核; 新句柄直接ADD, 撤销立即DEL(句柄随后可能被关闭).
+template <typename HandlerPolicy>
+class BasicEpollDemultiplexer : public DemultiplexerBase
+{
+public:
+
+    typedef typename HandlerPolicy::handler_type handler_type;
+    typedef BasicHandlerTable<handler_type>      table_type;
+    typedef BasicHandlerSlot<handler_type>       slot_type;
+
+    /// 构造函数
+    BasicEpollDemultiplexer() : m_fd_num(0), m_events(kInitEventListSize)
+    {
+        m_epoll_fd = ::epoll_create(FD_SETSIZE);
+        assert(m_epoll_fd != -1);
+    }
+
+    /// 析构函数
+    ~BasicEpollDemultiplexer()
+    {
+        ::close(m_epoll_fd);
+    }
+
+    /// 设置待合并的关注, 再获取有事件发生的所有句柄并分发
+    /// @param  handlers 句柄登记表
+    /// @param  timeout  超时时间
+    /// @retval = 0   没有发生事件的句柄(超时)
+    /// @retval > 0   发生事件的句柄个数(包括设置关注失败而报告错误的句柄)
+    /// @retval < 0   发生错误
+    int WaitEvents(table_type * handlers, int timeout = 0)
+    {
+        if (!m_dirty.empty())
+        {
+            int failed = ApplyChanges(handlers);
+            if (failed > 0)
+            {
+                /// 错误回调中可能又改变了关注, 本轮不再等待
+                return failed;
+            }
+        }
+        DispatchTimer timer(m_metrics);
+        int num = ::epoll_wait(m_epoll_fd, &m_events[0], static_cast<int>(m_events.size()), timeout);
+        timer.Waited(num);
+        if (num < 0)
+        {
+            return -errno;
+        }
+        for (int idx = 0; idx < num; ++idx)
+        {
+            const epoll_event & ep_evt = m_events[idx];
+            handle_t handle = static_cast<handle_t>(ep_evt.data.u64 & 0xffffffffULL);
+            uint32_t generation = static_cast<uint32_t>(ep_evt.data.u64 >> 32);
+            CtlEntry & entry = m_entries[handle];
+            if (entry.applied & EPOLLONESHOT)
+            {
+                /// 一次性关注触发后内核不再关注, 之后以相同事件重新关注也要设置
+                entry.disarmed = true;
+            }
+            slot_type * slot = handlers->Find(handle);
+            if (slot == NULL || slot->generation != generation)
+            {
+                /// 本轮中已被移除, 或句柄已被新连接复用
+                continue;
+            }
+            uint32_t events = ep_evt.events;
+            if ((events & EPOLLERR) && (slot->interest & kErrQueueEvent))
+            {
+                /// 错误队列有数据(如MSG_ZEROCOPY的完成通知), 交给handler读取后照常处理读写
+                HandlerPolicy::HandleErrQueue(slot->handler);
+                events &= ~EPOLLERR;
+                slot = handlers->Find(handle);
+                if (slot == NULL || slot->generation != generation)
+                {
+                    timer.Dispatched();
+                    continue;
+                }
+            }
+            if (events & (EPOLLERR | EPOLLHUP))
+            {
+                HandlerPolicy::HandleError(slot->handler);
+            }
+            else
+            {
+                if (events & EPOLLIN)
+                {
+                    HandlerPolicy::HandleRead(slot->handler);
+                }
+                /// 读回调中可能移除了handler, 登记表也可能已扩容
+                if (events & EPOLLOUT)
+                {
+                    slot = handlers->Find(handle);
+                    if (slot != NULL && slot->generation == generation)
+                    {
+                        HandlerPolicy::HandleWrite(slot->handler);
+                    }
+                }
+            }
+            timer.Dispatched();
+        }
+        /// 数组被填满说明就绪事件可能更多, 倍增以便下一轮一次取回
+        if (num == static_cast<int>(m_events.size()) &&
+                m_events.size() < static_cast<size_t>(kMaxEventListSize))
+        {
+            m_events.resize(m_events.size() * 2);
+        }
+        return num;
+    }
+
+    /// 设置句柄handle关注evt事件
+    /// 新句柄立即加入epoll集合, 出错(如普通文件的-EPERM)同步返回; 已在集合中的句柄只记下新的关注,
+    /// 在下一次WaitEvents等待之前合并设置, 届时出错的句柄以HandleError报告
+    /// @retval = 0 设置成功
+    /// @retval < 0 设置出错
+    int RequestEvent(handle_t handle, event_t evt, const slot_type & slot)
+    {
+        if (handle < 0)
+        {
+            return -EBADF;
+        }
+        if (static_cast<size_t>(handle) >= m_entries.size())
+        {
+            CtlEntry empty = { 0, 0, 0, 0, false, false, false };
+            m_entries.resize(handle + 1, empty);
+        }
+        CtlEntry & entry = m_entries[handle];
+        entry.data = (static_cast<uint64_t>(slot.generation) << 32) | static_cast<uint32_t>(handle);
+        entry.events = 0;
+        if (evt & kReadEvent)
+        {
+            entry.events |= EPOLLIN;
+        }
+        if (evt & kWriteEvent)
+        {
+            entry.events |= EPOLLOUT;
+        }
+        if (evt & kEdgeTriggered)
+        {
+            entry.events |= EPOLLET;
+        }
+        else if (!(evt & kPersistEvent))
+        {
+            entry.events |= EPOLLONESHOT;
+        }
+
+        if (!entry.registered)
+        {
+            epoll_event ep_evt;
+            ep_evt.events = entry.events;
+            ep_evt.data.u64 = entry.data;
+            CountCtlCall();
+            if (::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, handle, &ep_evt) != 0)
+            {
+                return -errno;
+            }
+            entry.registered = true;
+            entry.applied = entry.events;
+            entry.applied_data = entry.data;
+            entry.disarmed = false;
+            ++m_fd_num;
+            return 0;
+        }
+        if (!entry.dirty)
+        {
+            entry.dirty = true;
+            m_dirty.push_back(handle);
+        }
+        return 0;
+    }
+
+    /// 撤销句柄handle对事件evt的关注
+    /// 立即移出epoll集合: 句柄随后可能被关闭, 若有dup出的副本, 关闭不会把它移出集合
+    /// @retval = 0 撤销成功
+    /// @retval < 0 撤销出错
+    int UnrequestEvent(handle_t handle)
+    {
+        if (handle < 0 || static_cast<size_t>(handle) >= m_entries.size() || !m_entries[handle].registered)
+        {
+            return -ENOENT;
+        }
+        /// 仍在待设置列表中的句柄在合并时跳过
+        m_entries[handle].registered = false;
+        --m_fd_num;
+        epoll_event ep_evt;
+        CountCtlCall();
+        if (::epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, handle, &ep_evt) != 0)
+        {
+            return -errno;
+        }
+        return 0;
+    }
+
+    /// 设置epoll_wait在没有就绪事件时内核的忙轮询时间
+    /// 内核在睡眠前先轮询socket所在网卡队列, 需要网卡队列的NAPI id(socket收到过数据后才有)
+    /// @param  usec    忙轮询的时间(微秒), 0关闭
+    /// @retval = 0 设置成功
+    /// @retval < 0 设置出错(-errno), 内核早于6.9时为-ENOTTY
+    int SetBusyPoll(int usec)
+    {
+        epoll_params params;
+        memset(&params, 0, sizeof(params));
+        params.busy_poll_usecs = static_cast<uint32_t>(usec);
+        params.busy_poll_budget = kBusyPollBudget;
+        if (::ioctl(m_epoll_fd, EPIOCSPARAMS, &params) != 0)
+        {
+            return -errno;
+        }
+        return 0;
+    }
+
+private:
+
+    /// 句柄在epoll集合中的登记, 记录期望的和已设置到内核的关注
+    struct CtlEntry
+    {
+        uint64_t  data;         ///< 期望的epoll_event.data: 登记代数和句柄
+        uint64_t  applied_data; ///< 已设置到内核的data
+        uint32_t  events;       ///< 期望关注的epoll事件
+        uint32_t  applied;      ///< 已设置到内核的epoll事件
+        bool      registered;   ///< 是否在epoll集合中
+        bool      disarmed;     ///< 一次性关注已触发, 内核不再关注
+        bool      dirty;        ///< 是否在待设置列表中
+    };
+
+    /// 把待设置列表中每个句柄的最终关注一次设置到内核, 与内核中一致的跳过
+    /// 边缘触发的句柄只要改变过关注就设置: EPOLL_CTL_MOD会重新检查就绪状态并报告, 调用者可能依赖这一次事件
+    /// @return 设置失败并以HandleError报告的句柄个数
+    int ApplyChanges(table_type * handlers)
+    {
+        m_applying.swap(m_dirty);
+        for (size_t idx = 0; idx < m_applying.size(); ++idx)
+        {
+            handle_t handle = m_applying[idx];
+            CtlEntry & entry = m_entries[handle];
+            entry.dirty = false;
+            if (!entry.registered)
+            {
+                continue;
+            }
+            if (entry.events == entry.applied && entry.data == entry.applied_data &&
+                    !entry.disarmed && !(entry.events & EPOLLET))
+            {
+                continue;
+            }
+            epoll_event ep_evt;
+            ep_evt.events = entry.events;
+            ep_evt.data.u64 = entry.data;
+            CountCtlCall();
+            int ret = ::epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, handle, &ep_evt);
+            if (ret != 0 && errno == ENOENT)
+            {
+                /// 句柄没有撤销就被关闭(内核自动移出了集合), 之后又被复用
+                CountCtlCall();
+                ret = ::epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, handle, &ep_evt);
+            }
+            if (ret != 0)
+            {
+                entry.registered = false;
+                --m_fd_num;
+                m_failed.push_back(entry.data);
+                continue;
+            }
+            entry.applied = entry.events;
+            entry.applied_data = entry.data;
+            entry.disarmed = false;
+        }
+        m_applying.clear();
+        if (m_failed.empty())
+        {
+            return 0;
+        }
+        /// 回调中可能再设置关注, 先取出全部失败的句柄
+        std::vector<uint64_t> failed;
+        failed.swap(m_failed);
+        for (size_t idx = 0; idx < failed.size(); ++idx)
+        {
+            handle_t handle = static_cast<handle_t>(failed[idx] & 0xffffffffULL);
+            slot_type * slot = handlers->Find(handle);
+            if (slot != NULL && slot->generation == static_cast<uint32_t>(failed[idx] >> 32))
+            {
+                HandlerPolicy::HandleError(slot->handler);
+            }
+        }
+        return static_cast<int>(failed.size());
+    }
+
+    /// 每次忙轮询最多处理的包数, 与内核缺省值(BUSY_POLL_BUDGET)相同
+    static const int kBusyPollBudget = 8;
+
+    /// 就绪事件数组的初始长度
+    static const int kInitEventListSize = 128;
+
+    /// 就绪事件数组的最大长度, 单次epoll_wait最多取回这么多事件
+    static const int kMaxEventListSize = 4096;
+
+    int                       m_epoll_fd; ///< epoll集合
+    int                       m_fd_num;   ///< socket描述符集合
+    std::vector<epoll_event>  m_events;   ///< 常驻的就绪事件数组, 填满时倍增直至上限
+    std::vector<CtlEntry>     m_entries;  ///< 以句柄为下标的epoll登记
+    std::vector<handle_t>     m_dirty;    ///< 关注改变、等待前要设置的句柄
+    std::vector<handle_t>     m_applying; ///< 设置中的句柄, 与m_dirty交换以保留容量
+    std::vector<uint64_t>     m_failed;   ///< 设置失败的句柄的data, 待报告错误
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// poll IO多路复用 事件分离器
+/// 没有select的FD_SETSIZE限制, 也不需要epoll那样的内核对象; 每次等待传入全部句柄, 适合句柄不多的场景.
+/// poll总是水平触发, 边缘触发按持续关注处理; 一次性关注在触发后把pollfd的句柄取反, poll会忽略它.
+template <typename HandlerPolicy>
+class BasicPollDemultiplexer : public DemultiplexerBase
+{
+public:
+
+    typedef typename HandlerPolicy::handler_type handler_type;
+    typedef BasicHandlerTable<handler_type>      table_type;
+    typedef BasicHandlerSlot<handler_type>       slot_type;
+
+    /// 获取有事件发生的所有句柄并分发
+    /// @param  handlers 句柄登记表
+    /// @param  timeout  超时时间
+    /// @retval = 0   没有发生事件的句柄(超时)
+    /// @retval > 0   发生事件的句柄个数
+    /// @retval < 0   发生错误
+    int WaitEvents(table_type * handlers, int timeout = 0)
+    {
+        DispatchTimer timer(m_metrics);
+        int num = ::poll(m_pollfds.empty() ? NULL : &m_pollfds[0], m_pollfds.size(), timeout);
+        timer.Waited(num);
+        if (num <= 0)
+        {
+            return num < 0 ? -errno : 0;
+        }
+        /// 回调中可能登记或撤销句柄而改变pollfd数组, 先取出所有就绪事件
+        m_ready.clear();
+        for (size_t idx = 0; idx < m_pollfds.size() && m_ready.size() < static_cast<size_t>(num); ++idx)
+        {
+            pollfd & pfd = m_pollfds[idx];
+            if (pfd.revents == 0)
+            {
+                continue;
+            }
+            Ready ready = { pfd.fd, m_generations[idx], pfd.revents };
+            m_ready.push_back(ready);
+            if (!(m_interests[idx] & (kPersistEvent | kEdgeTriggered)))
+            {
+                /// 一次性关注: 触发后停止等待, 等handler重新注册
+                pfd.fd = ~pfd.fd;
+            }
+        }
+        for (size_t idx = 0; idx < m_ready.size(); ++idx)
+        {
+            const Ready & ready = m_ready[idx];
+            slot_type * slot = handlers->Find(ready.handle);
+            if (slot == NULL || slot->generation != ready.generation)
+            {
+                /// 本轮中已被移除, 或句柄已被新连接复用
+                continue;
+            }
+            short revents = ready.revents;
+            if ((revents & POLLERR) && (slot->interest & kErrQueueEvent))
+            {
+                /// 错误队列有数据(如MSG_ZEROCOPY的完成通知), 交给handler读取后照常处理读写
+                HandlerPolicy::HandleErrQueue(slot->handler);
+                revents &= ~POLLERR;
+                slot = handlers->Find(ready.handle);
+                if (slot == NULL || slot->generation != ready.generation)
+                {
+                    timer.Dispatched();
+                    continue;
+                }
+            }
+            if (revents & (POLLERR | POLLHUP | POLLNVAL))
+            {
+                HandlerPolicy::HandleError(slot->handler);
+            }
+            else
+            {
+                if (revents & POLLIN)
+                {
+                    HandlerPolicy::HandleRead(slot->handler);
+                }
+                /// 读回调中可能移除了handler, 登记表也可能已扩容
+                if (revents & POLLOUT)
+                {
+                    slot = handlers->Find(ready.handle);
+                    if (slot != NULL && slot->generation == ready.generation)
+                    {
+                        HandlerPolicy::HandleWrite(slot->handler);
+                    }
+                }
+            }
+            timer.Dispatched();
+        }
+        return num;
+    }
+
+    /// 设置句柄handle关注evt事件
+    /// @retval = 0 设置成功
+    /// @retval < 0 设置出错
+    int RequestEvent(handle_t handle, event_t evt, const slot_type & slot)
+    {
+        if (handle < 0)
+        {
+            return -EBADF;
+        }
+        if (static_cast<size_t>(handle) >= m_index.size())
+        {
+            m_index.resize(handle + 1, -1);
+        }
+        int idx = m_index[handle];
+        if (idx < 0)
+        {
+            idx = static_cast<int>(m_pollfds.size());
+            m_index[handle] = idx;
+            pollfd pfd = { handle, 0, 0 };
+            m_pollfds.push_back(pfd);
+            m_generations.push_back(0);
+            m_interests.push_back(0);
+        }
+        pollfd & pfd = m_pollfds[idx];
+        pfd.fd = handle;
+        pfd.events = 0;
+        pfd.revents = 0;
+        if (evt & kReadEvent)
+        {
+            pfd.events |= POLLIN;
+        }
+        if (evt & kWriteEvent)
+        {
+            pfd.events |= POLLOUT;
+        }
+        m_generations[idx] = slot.generation;
+        m_interests[idx] = evt;
+        return 0;
+    }
+
+    /// 撤销句柄handle对事件evt的关注
+    /// @retval = 0 撤销成功
+    /// @retval < 0 撤销出错
+    int UnrequestEvent(handle_t handle)
+    {
+        if (handle < 0 || static_cast<size_t>(handle) >= m_index.size() || m_index[handle] < 0)
+        {
+            return -ENOENT;
+        }
+        /// 用最后一项填补空位
+        int idx = m_index[handle];
+        int last = static_cast<int>(m_pollfds.size()) - 1;
+        if (idx != last)
+        {
+            m_pollfds[idx] = m_pollfds[last];
+            m_generations[idx] = m_generations[last];
+            m_interests[idx] = m_interests[last];
+            handle_t moved = m_pollfds[idx].fd < 0 ? ~m_pollfds[idx].fd : m_pollfds[idx].fd;
+            m_index[moved] = idx;
+        }
+        m_pollfds.pop_back();
+        m_generations.pop_back();
+        m_interests.pop_back();
+        m_index[handle] = -1;
+        return 0;
+    }
+
+private:
+
+    /// 取出的就绪事件
+    struct Ready
+    {
+        handle_t  handle;     ///< 句柄
+        uint32_t  generation; ///< 登记代数
+        short     revents;    ///< 发生的事件
+    };
+
+    std::vector<pollfd>    m_pollfds;     ///< 传给poll的数组, 一次性关注触发后句柄取反
+    std::vector<uint32_t>  m_generations; ///< 与m_pollfds对应的登记代数
+    std::vector<event_t>   m_interests;   ///< 与m_pollfds对应的关注事件
+    std::vector<int>       m_index;       ///< 以句柄为下标, 在m_pollfds中的位置, -1表示未登记
+    std::vector<Ready>     m_ready;       ///< 常驻的就绪事件数组
+};
+
+#if !defined(REACTOR_NO_IO_URING)
+///////////////////////////////////////////////////////////////////////////////
+
+/// io_uring的提交和完成队列, 以及AsyncRead/AsyncWrite/AsyncAccept完成式操作
+/// 与handler类型无关的部分, 在basicdemultiplexer.cpp中实现
+class IoUringRing : public DemultiplexerBase
+{
+public:
+
+    /// 构造函数, 创建失败时IsValid返回false
+    /// @param  entries 提交队列长度
+    explicit IoUringRing(unsigned entries);
+
+    /// 析构函数
+    ~IoUringRing();
+
+    /// io_uring是否创建成功(内核不支持时失败)
+    bool IsValid() const;
+
+    /// 提交异步接收, 完成时在WaitEvents中回调
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错
+    int AsyncRead(handle_t handle, void * buf, size_t len, const CompletionCallback & callback);
+
+    /// 提交异步发送, 完成时在WaitEvents中回调
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错
+    int AsyncWrite(handle_t handle, const void * buf, size_t len, const CompletionCallback & callback);
+
+    /// 提交异步accept, 新连接为非阻塞socket, 完成时在WaitEvents中回调
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错
+    int AsyncAccept(handle_t handle, const CompletionCallback & callback);
+
+protected:
+
+    /// user_data最低位为1表示poll请求: 高32位为代数, 其余为句柄
+    /// user_data为0表示不关心结果的请求(如撤销poll), 否则为Operation指针
+    static const uint64_t kPollTag = 1;
+
+    /// 编码poll请求的user_data
+    static uint64_t PollUserData(handle_t handle, uint32_t generation)
+    {
+        return (static_cast<uint64_t>(generation) << 32) | (static_cast<uint64_t>(handle) << 1) | kPollTag;
+    }
+
+    /// 从poll请求的user_data取出句柄
+    static handle_t PollHandle(uint64_t user_data)
+    {
+        return static_cast<handle_t>((user_data & 0xffffffffULL) >> 1);
+    }
+
+    /// 从poll请求的user_data取出代数
+    static uint32_t PollGeneration(uint64_t user_data)
+    {
+        return static_cast<uint32_t>(user_data >> 32);
+    }
+
+    /// 提交排队中的请求并等待至少min_complete个完成事件
+    int Enter(unsigned min_complete, int timeout);
+
+    /// 提交poll请求, 边缘触发用multishot poll, 其他方式为单次poll
+    int SubmitPoll(handle_t handle, event_t evt, uint64_t user_data);
+
+    /// 撤销user_data对应的poll请求
+    int SubmitPollRemove(uint64_t user_data);
+
+    /// 完成队列头(本地消费位置)
+    unsigned CompletionHead() const
+    {
+        return *m_cq_head;
+    }
+
+    /// 完成队列尾(内核更新)
+    unsigned CompletionTail() const
+    {
+        return __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    /// 取完成队列项
+    const io_uring_cqe & Completion(unsigned idx) const
+    {
+        return m_cqes[idx & m_cq_mask];
+    }
+
+    /// 归还完成队列项直到head
+    void ConsumeCompletions(unsigned head)
+    {
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    /// 完成式操作结束, 回调并回收
+    void CompleteOperation(uint64_t user_data, int res);
+
+private:
+
+    /// 完成式操作
+    struct Operation
+    {
+        CompletionCallback  callback; ///< 完成回调
+        Operation *         next;     ///< 空闲链表
+    };
+
+    /// 取一个空闲的提交队列项, 队列满时先提交
+    io_uring_sqe * GetSqe();
+
+    /// 分配完成式操作
+    Operation * AllocOperation(const CompletionCallback & callback);
+
+    /// 禁止拷贝构造和赋值操作
+    IoUringRing(const IoUringRing &);
+    IoUringRing & operator=(const IoUringRing &);
+
+private:
+
+    int                       m_ring_fd;     ///< io_uring句柄
+    void *                    m_sq_ring;     ///< 提交队列映射
+    size_t                    m_sq_ring_size;///< 提交队列映射长度
+    void *                    m_cq_ring;     ///< 完成队列映射(可能与提交队列共用)
+    size_t                    m_cq_ring_size;///< 完成队列映射长度
+    io_uring_sqe *            m_sqes;        ///< 提交队列项数组
+    size_t                    m_sqes_size;   ///< 提交队列项数组长度
+    unsigned *                m_sq_head;     ///< 提交队列头(内核更新)
+    unsigned *                m_sq_tail;     ///< 提交队列尾
+    unsigned                  m_sq_mask;     ///< 提交队列掩码
+    unsigned                  m_sq_entries;  ///< 提交队列长度
+    unsigned                  m_sq_local;    ///< 本地提交队列尾, 提交时发布
+    unsigned *                m_cq_head;     ///< 完成队列头
+    unsigned *                m_cq_tail;     ///< 完成队列尾(内核更新)
+    unsigned                  m_cq_mask;     ///< 完成队列掩码
+    io_uring_cqe *            m_cqes;        ///< 完成队列项数组
+    std::deque<Operation>     m_operations;  ///< 完成式操作池
+    Operation *               m_free_ops;    ///< 空闲操作链表
+};
+
+/// io_uring IO多路复用 事件分离器
+/// 就绪事件通过IORING_OP_POLL_ADD实现: 一次性和持续关注用单次poll(持续关注在分发后自动重新提交),
+/// 边缘触发用multishot poll. 同时支持AsyncRead/AsyncWrite/AsyncAccept完成式操作.
+/// 所有提交先放在提交队列中, 在WaitEvents中与等待一起通过一次io_uring_enter提交.
+/// 关注的改变先记在poll表中, 提交前每个句柄合并成最终的关注, 与未完成的poll请求相同时不再撤销和重新提交.
+template <typename HandlerPolicy>
+class BasicIoUringDemultiplexer : public IoUringRing
+{
+public:
+
+    typedef typename HandlerPolicy::handler_type handler_type;
+    typedef BasicHandlerTable<handler_type>      table_type;
+    typedef BasicHandlerSlot<handler_type>       slot_type;
+
+    /// 构造函数, 创建失败时IsValid返回false
+    /// @param  entries 提交队列长度
+    explicit BasicIoUringDemultiplexer(unsigned entries = 1024) : IoUringRing(entries), m_fd_num(0) {}
+
+    /// 提交排队中的请求, 获取完成的事件并分发
+    /// @note   事件处理器由poll表按句柄记录, 通过代数识别过期的完成事件
+    /// @param  handlers 句柄登记表(未使用, poll表自己记录handler)
+    /// @param  timeout  超时时间
+    /// @retval = 0   没有发生事件的句柄(超时)
+    /// @retval > 0   分发的完成事件个数
+    /// @retval < 0   发生错误
+    int WaitEvents(table_type * /*handlers*/, int timeout = 0)
+    {
+        if (!m_dirty.empty())
+        {
+            ApplyChanges();
+        }
+        /// 已有完成事件或还有没能提交的关注时不再等待, 只提交
+        unsigned head = CompletionHead();
+        bool ready = head != CompletionTail() || !m_dirty.empty();
+        DispatchTimer timer(m_metrics);
+        int ret = Enter((ready || timeout == 0) ? 0 : 1, timeout);
+        if (ret < 0 && ret != -ETIME && ret != -EINTR)
+        {
+            return ret;
+        }
+        unsigned tail = CompletionTail();
+        timer.Waited(static_cast<int>(tail - head));
+
+        int num = 0;
+        while (head != tail)
+        {
+            const io_uring_cqe & cqe = Completion(head);
+            uint64_t user_data = cqe.user_data;
+            int res = cqe.res;
+            unsigned flags = cqe.flags;
+            /// 先归还完成队列项, 回调中可以继续提交请求
+            ConsumeCompletions(++head);
+            if (user_data & kPollTag)
+            {
+                DispatchPoll(user_data, res, flags);
+                ++num;
+            }
+            else if (user_data != 0)
+            {
+                CompleteOperation(user_data, res);
+                ++num;
+            }
+            timer.Dispatched();
+            if (head == tail)
+            {
+                tail = CompletionTail();
+            }
+        }
+        return num;
+    }
+
+    /// 设置句柄handle关注evt事件
+    /// 只记下新的关注, poll请求在下一次WaitEvents提交前按最终的关注提交
+    /// @retval = 0 设置成功
+    /// @retval < 0 设置出错
+    int RequestEvent(handle_t handle, event_t evt, const slot_type & slot)
+    {
+        if (handle < 0)
+        {
+            return -EBADF;
+        }
+        if (static_cast<size_t>(handle) >= m_polls.size())
+        {
+            PollEntry empty = { NULL, 0, 0, 0, false, false, false };
+            m_polls.resize(handle + 1, empty);
+        }
+        PollEntry & entry = m_polls[handle];
+        if (!entry.registered || entry.handler != slot.handler)
+        {
+            /// 新登记或换了handler: 撤销旧的poll请求, 代数变化后已在完成队列中的旧事件都会被忽略
+            if (entry.armed)
+            {
+                int ret = QueuePollRemove(handle);
+                if (ret != 0)
+                {
+                    return ret;
+                }
+            }
+            if (!entry.registered)
+            {
+                ++m_fd_num;
+            }
+            ++entry.generation;
+            entry.handler = slot.handler;
+            entry.registered = true;
+        }
+        entry.evt = evt;
+        if (!entry.dirty)
+        {
+            entry.dirty = true;
+            m_dirty.push_back(handle);
+        }
+        return 0;
+    }
+
+    /// 撤销句柄handle对事件evt的关注
+    /// @retval = 0 撤销成功
+    /// @retval < 0 撤销出错
+    int UnrequestEvent(handle_t handle)
+    {
+        if (handle < 0 || static_cast<size_t>(handle) >= m_polls.size() || !m_polls[handle].registered)
+        {
+            return -ENOENT;
+        }
+        PollEntry & entry = m_polls[handle];
+        int ret = entry.armed ? QueuePollRemove(handle) : 0;
+        /// 代数变化后, 已在完成队列中的旧事件都会被忽略
+        ++entry.generation;
+        entry.handler = NULL;
+        entry.registered = false;
+        --m_fd_num;
+        return ret;
+    }
+
+private:
+
+    /// 句柄的poll登记
+    struct PollEntry
+    {
+        handler_type *  handler;    ///< 事件处理器
+        event_t         evt;        ///< 关注的事件
+        event_t         armed_evt;  ///< 未完成的poll请求关注的事件
+        uint32_t        generation; ///< 登记的代数, 编进user_data以识别过期的完成事件
+        bool            registered; ///< 是否已登记
+        bool            armed;      ///< 是否有未完成的poll请求
+        bool            dirty;      ///< 是否在待提交列表中
+    };
+
+    /// 为待提交列表中的句柄按最终的关注提交poll请求
+    /// 未完成的poll请求与最终的关注相同时保留它; 提交队列满而失败的句柄留到下一轮
+    void ApplyChanges()
+    {
+        m_applying.swap(m_dirty);
+        for (size_t idx = 0; idx < m_applying.size(); ++idx)
+        {
+            handle_t handle = m_applying[idx];
+            PollEntry & entry = m_polls[handle];
+            entry.dirty = false;
+            if (!entry.registered || (entry.armed && entry.armed_evt == entry.evt))
+            {
+                continue;
+            }
+            if (entry.armed)
+            {
+                if (QueuePollRemove(handle) != 0)
+                {
+                    entry.dirty = true;
+                    m_dirty.push_back(handle);
+                    continue;
+                }
+                ++entry.generation;
+            }
+            if (QueuePoll(handle) != 0)
+            {
+                entry.dirty = true;
+                m_dirty.push_back(handle);
+            }
+        }
+        m_applying.clear();
+    }
+
+    /// 为句柄提交poll请求
+    int QueuePoll(handle_t handle)
+    {
+        PollEntry & entry = m_polls[handle];
+        int ret = SubmitPoll(handle, entry.evt, PollUserData(handle, entry.generation));
+        if (ret == 0)
+        {
+            entry.armed = true;
+            entry.armed_evt = entry.evt;
+        }
+        return ret;
+    }
+
+    /// 撤销句柄未完成的poll请求
+    int QueuePollRemove(handle_t handle)
+    {
+        PollEntry & entry = m_polls[handle];
+        int ret = SubmitPollRemove(PollUserData(handle, entry.generation));
+        if (ret == 0)
+        {
+            entry.armed = false;
+        }
+        return ret;
+    }
+
+    /// 分发一个poll完成事件
+    void DispatchPoll(uint64_t user_data, int res, unsigned flags)
+    {
+        handle_t handle = PollHandle(user_data);
+        uint32_t generation = PollGeneration(user_data);
+        if (static_cast<size_t>(handle) >= m_polls.size())
+        {
+            return;
+        }
+        PollEntry * entry = &m_polls[handle];
+        if (!entry->registered || entry->generation != generation)
+        {
+            /// 已撤销或重新登记过的旧事件
+            return;
+        }
+        if (!(flags & IORING_CQE_F_MORE))
+        {
+            entry->armed = false;
+        }
+        handler_type * handler = entry->handler;
+        if (res > 0 && (res & POLLERR) && (entry->evt & kErrQueueEvent))
+        {
+            /// 错误队列有数据(如MSG_ZEROCOPY的完成通知), 交给handler读取后照常处理读写
+            HandlerPolicy::HandleErrQueue(handler);
+            res &= ~POLLERR;
+            entry = &m_polls[handle];
+            if (!entry->registered || entry->generation != generation)
+            {
+                return;
+            }
+        }
+        if (res < 0 || (res & (POLLERR | POLLHUP)))
+        {
+            HandlerPolicy::HandleError(handler);
+        }
+        else
+        {
+            if (res & POLLIN)
+            {
+                HandlerPolicy::HandleRead(handler);
+            }
+            /// 回调中handler可能已撤销或重新登记
+            entry = &m_polls[handle];
+            if ((res & POLLOUT) && entry->registered && entry->generation == generation)
+            {
+                HandlerPolicy::HandleWrite(handler);
+            }
+        }
+        /// 持续关注的句柄在poll结束后重新提交, 仍有数据时会立即再次触发(水平触发)
+        /// 回调中改变过关注的句柄由ApplyChanges提交
+        entry = &m_polls[handle];
+        if (entry->registered && entry->generation == generation && !entry->armed && !entry->dirty &&
+                (entry->evt & (kPersistEvent | kEdgeTriggered)))
+        {
+            QueuePoll(handle);
+        }
+    }
+
+private:
+
+    int                       m_fd_num;      ///< 登记的句柄个数
+    std::vector<PollEntry>    m_polls;       ///< 按句柄索引的poll登记表
+    std::vector<handle_t>     m_dirty;       ///< 关注改变、提交前要处理的句柄
+    std::vector<handle_t>     m_applying;    ///< 处理中的句柄, 与m_dirty交换以保留容量
+};
+#endif // REACTOR_NO_IO_URING
+} // namespace reactor
+#endif // __linux__
+
+#endif // _BASIC_DEMULTIPLEXER_H_
@@ -0,0 +1,158 @@
+#ifndef _BASIC_REACTOR_H_
+#define _BASIC_REACTOR_H_
+
+#include <atomic>
+#include "reactor.h"
+#include "handlertable.h"
+#include "handlerpolicy.h"
+#include "basicdemultiplexer.h"
+#include "metrics.h"
+
+/// @file   basicreactor.h
+/// @brief  编译期确定分离器和handler类型的reactor
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+#if defined(__linux__)
+namespace reactor
+{
+/// 编译期确定分离器和handler类型的reactor(只有头文件)
+/// Reactor通过pimpl和EventDemultiplexer的虚函数等待事件, 每个事件再经过EventHandler的虚函数分发;
+/// BasicReactor直接持有分离器对象, 分发时调用HandlerPolicy的静态函数, 编译器可以内联整个分发路径.
+/// 需要运行时选择分离器、定时器、跨线程任务或handler引用计数时使用Reactor.
+///
+/// 用法:
+///   class Connection : public BasicEventHandler<Connection> { ... };
+///   BasicReactor<BasicEpollDemultiplexer, StaticHandlerPolicy<Connection> > reactor;
+///
+/// @param  Demux          分离器模板: BasicEpollDemultiplexer, BasicPollDemultiplexer或BasicIoUringDemultiplexer
+/// @param  HandlerPolicy  handler策略: StaticHandlerPolicy<具体类型>, 或VirtualHandlerPolicy(仍用虚函数分发)
+template <template <typename> class Demux, typename HandlerPolicy = VirtualHandlerPolicy>
+class BasicReactor
+{
+public:
+
+    typedef typename HandlerPolicy::handler_type handler_type;
+    typedef Demux<HandlerPolicy>                 demultiplexer_type;
+
+    /// 构造函数
+    BasicReactor() : m_quit(false)
+    {
+        m_demultiplexer.SetMetrics(&m_metrics);
+    }
+
+    /// 分离器是否创建成功(io_uring在内核不支持时失败)
+    bool IsValid() const
+    {
+        return m_demultiplexer.IsValid();
+    }
+
+    /// 向reactor中注册关注事件evt的handler(可重入)
+    /// 持续关注的handler以相同的evt重复注册时不会再次设置分离器
+    /// @param  handler 要注册的事件处理器, reactor不持有引用, 移除前须保持有效
+    /// @param  evt     要关注的事件, 可与kPersistEvent或kEdgeTriggered按位或
+    /// @retval 0       注册成功
+    /// @retval < 0     注册出错
+    int RegisterHandler(handler_type * handler, event_t evt)
+    {
+        handle_t handle = HandlerPolicy::GetHandle(handler);
+        slot_type & slot = m_handlers.Get(handle);
+        bool added = slot.handler != handler;
+        if (!added && (evt & (kPersistEvent | kEdgeTriggered)) && slot.interest == evt)
+        {
+            /// 持续关注且关注事件未变, 无需再设置分离器
+            return 0;
+        }
+        if (added && slot.handler != NULL)
+        {
+            /// 句柄换了handler, 旧handler的就绪事件作废
+            ++slot.generation;
+        }
+        slot.handler = handler;
+        int ret = m_demultiplexer.RequestEvent(handle, evt, slot);
+        if (ret == 0)
+        {
+            slot.interest = evt;
+        }
+        else if (added)
+        {
+            m_handlers.Clear(handle);
+        }
+        return ret;
+    }
+
+    /// 从reactor中移除handler
+    /// 登记项立即清除, 本轮中该句柄余下的就绪事件都会被丢弃, 移除后handler即可销毁(包括在它自己的回调中)
+    /// @param  handler 要移除的事件处理器
+    /// @retval 0       移除成功
+    /// @retval < 0     移除出错
+    int RemoveHandler(handler_type * handler)
+    {
+        handle_t handle = HandlerPolicy::GetHandle(handler);
+        slot_type * slot = m_handlers.Find(handle);
+        if (slot == NULL || slot->handler != handler)
+        {
+            return -1;
+        }
+        m_handlers.Clear(handle);
+        return m_demultiplexer.UnrequestEvent(handle);
+    }
+
+    /// 处理事件,回调注册的handler中相应的事件处理函数
+    /// @param  timeout 超时时间(毫秒), 0不阻塞, -1一直阻塞到有事件发生
+    /// @retval >= 0    分发的事件个数
+    /// @retval < 0     等待出错(-errno)
+    int HandleEvents(int timeout = 0)
+    {
+        return m_demultiplexer.WaitEvents(&m_handlers, timeout);
+    }
+
+    /// 运行事件循环, 阻塞等待并处理事件, 直到Stop被调用
+    /// BasicReactor没有唤醒句柄: 在其他线程调用Stop时, 循环在下一次有事件或timeout到期后退出
+    /// @param  timeout 每次等待的超时时间(毫秒), -1一直阻塞到有事件发生
+    void Run(int timeout = -1)
+    {
+        while (!m_quit.load(std::memory_order_acquire))
+        {
+            HandleEvents(timeout);
+        }
+        m_quit.store(false, std::memory_order_relaxed);
+    }
+
+    /// 停止事件循环(线程安全)
+    void Stop()
+    {
+        m_quit.store(true, std::memory_order_release);
+    }
+
+    /// 获取分离器, 如io_uring的AsyncRead/AsyncWrite/AsyncAccept
+    demultiplexer_type * GetDemultiplexer()
+    {
+        return &m_demultiplexer;
+    }
+
+    /// 获取reactor的运行指标, 由事件循环线程更新, 其Snapshot可在任意线程调用
+    ReactorMetrics * GetMetrics()
+    {
+        return &m_metrics;
+    }
+
+private:
+
+    typedef BasicHandlerSlot<handler_type> slot_type;
+
+    /// 禁止拷贝构造和赋值操作
+    BasicReactor(const BasicReactor &);
+    BasicReactor & operator=(const BasicReactor &);
+
+private:
+
+    ReactorMetrics                   m_metrics;       ///< 运行指标
+    demultiplexer_type               m_demultiplexer; ///< 事件分离器
+    BasicHandlerTable<handler_type>  m_handlers;      ///< 句柄与事件处理器登记表
+    std::atomic<bool>                m_quit;          ///< 是否停止事件循环
+};
+} // namespace reactor
+#endif // __linux__
+
+#endif // _BASIC_REACTOR_H_
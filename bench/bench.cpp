@@ -0,0 +1,1041 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "reactor.h"
+#include "acceptor.h"
+#include "metrics.h"
+#include "tcpconnection.h"
+#include "threadpool.h"
+
+/// @file   bench.cpp
+/// @brief  reactor压测: 回显ping-pong延迟, 批量吞吐, 连接建立与关闭
+/// 同一进程内, 一个线程运行被测的回显服务器(指定分离器和注册方式), 主线程运行负载生成器(epoll),
+/// 通过回环地址通信, 结束时输出请求速率、延迟分位数和服务器的指标.
+/// 指定工作线程时, 服务器把回显交给线程池, 线程池饱和时暂停读, 有空位后恢复(反压).
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace
+{
+using namespace reactor;
+
+/// 压测参数
+struct Options
+{
+    std::string     workload;  ///< pingpong, throughput 或 churn
+    std::string     backend;   ///< epoll, poll, select 或 uring
+    std::string     mode;      ///< persist, oneshot 或 edge
+    demultiplexer_t type;      ///< 服务器使用的分离器
+    event_t         reg_mode;  ///< 服务器连接的注册方式
+    int             conns;     ///< 并发连接数
+    size_t          size;      ///< 消息字节数(throughput为每次发送的块大小)
+    size_t          window;    ///< throughput每个连接在途的最大字节数
+    int             duration;  ///< 压测时长(秒)
+    unsigned short  port;      ///< 服务器端口, 0为任选空闲端口
+    int             spin;      ///< 服务器阻塞等待前自旋的微秒数, 0不自旋
+    int             busy_poll; ///< 服务器socket和epoll的内核忙轮询微秒数, 0不设置
+    int             cpu;       ///< 服务器事件循环绑定的cpu, -1不绑定
+    int             workers;   ///< 服务器处理回显的工作线程数, 0在事件循环中直接回显
+    size_t          queue;     ///< 线程池排队任务数上限
+};
+
+/// 关闭Nagle, 小消息的ping-pong不被延迟
+static void SetNoDelay(handle_t handle)
+{
+    int on = 1;
+    ::setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// 回显连接, 按指定的注册方式使用分离器
+/// 水平触发和一次性关注每次读事件读一次; 边缘触发读到EAGAIN; 一次性关注每次事件后重新注册
+class EchoConnection : public EventHandler
+{
+public:
+
+    /// 构造函数
+    EchoConnection(Reactor * reactor, handle_t handle, event_t mode)
+        : EventHandler(), m_reactor(reactor), m_handle(handle), m_mode(mode), m_interest(0), m_closed(false)
+    {
+    }
+
+    /// 获取该handler所对应的句柄
+    virtual handle_t GetHandle() const
+    {
+        return m_handle;
+    }
+
+    /// 开始关注读事件, 失败时关闭
+    void Start()
+    {
+        Rearm(true);
+    }
+
+    /// 读事件: 收到的数据原样发回
+    virtual void HandleRead()
+    {
+        char buf[kReadSize];
+        while (true)
+        {
+            ssize_t n = ::recv(m_handle, buf, sizeof(buf), 0);
+            if (n > 0)
+            {
+                Echo(buf, static_cast<size_t>(n));
+                if (m_closed)
+                {
+                    return;
+                }
+                if (!(m_mode & kEdgeTriggered))
+                {
+                    break;
+                }
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                break;
+            }
+            Close();
+            return;
+        }
+        Rearm(false);
+    }
+
+    /// 写事件: 继续发送积压的数据
+    virtual void HandleWrite()
+    {
+        if (m_closed)
+        {
+            return;
+        }
+        if (!Flush())
+        {
+            Close();
+            return;
+        }
+        Rearm(false);
+    }
+
+    /// 出错事件: 关闭连接
+    virtual void HandleError()
+    {
+        Close();
+    }
+
+private:
+
+    static const size_t kReadSize = 64 * 1024;
+
+    /// 发回数据, 发不完的积压起来等写事件
+    void Echo(const char * data, size_t len)
+    {
+        if (m_pending.empty())
+        {
+            ssize_t n = ::send(m_handle, data, len, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    Close();
+                    return;
+                }
+                n = 0;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        m_pending.append(data, len);
+    }
+
+    /// 发送积压的数据
+    /// @retval false   连接出错
+    bool Flush()
+    {
+        while (!m_pending.empty())
+        {
+            ssize_t n = ::send(m_handle, m_pending.data(), m_pending.size(), MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            m_pending.erase(0, static_cast<size_t>(n));
+        }
+        return true;
+    }
+
+    /// 按是否有积压更新关注的事件, 一次性关注总是重新注册
+    void Rearm(bool force)
+    {
+        if (m_closed)
+        {
+            return;
+        }
+        event_t evt = kReadEvent | (m_pending.empty() ? 0 : kWriteEvent) | m_mode;
+        if (force || !(m_mode & (kPersistEvent | kEdgeTriggered)) || evt != m_interest)
+        {
+            m_interest = evt;
+            if (m_reactor->RegisterHandler(this, evt) != 0)
+            {
+                Close();
+            }
+        }
+    }
+
+    /// 关闭连接, 释放创建时的引用
+    void Close()
+    {
+        if (m_closed)
+        {
+            return;
+        }
+        m_closed = true;
+        m_reactor->CloseHandler(this);
+        Release();
+    }
+
+private:
+
+    Reactor *    m_reactor;  ///< 所属的reactor
+    handle_t     m_handle;   ///< socket句柄
+    event_t      m_mode;     ///< 注册方式
+    event_t      m_interest; ///< 当前注册的事件
+    std::string  m_pending;  ///< 积压的待发送数据
+    bool         m_closed;   ///< 是否已关闭
+};
+
+/// 线程池的反压统计, 只在服务器的事件循环线程中修改
+struct PoolStats
+{
+    int      conns;   ///< 未关闭的连接数
+    uint64_t tasks;   ///< 提交成功的任务数
+    uint64_t pauses;  ///< 提交失败而暂停读的次数
+    uint64_t resumes; ///< 线程池有空位后恢复读的次数
+};
+
+/// 经线程池回显的连接
+/// 每个连接同时只有一个任务在线程池中, 保证回显的顺序; 任务执行期间收到的数据留在输入缓冲区,
+/// 超过输入高水位时暂停读. 提交失败(线程池饱和)时暂停读并等待线程池的空位, 恢复后继续处理缓冲区中的数据.
+class PooledEchoConnection : public TcpConnection
+{
+public:
+
+    /// 输入缓冲区的高低水位
+    static const size_t kInputHighWaterMark = 1024 * 1024;
+    static const size_t kInputLowWaterMark = 256 * 1024;
+
+    /// 构造函数
+    PooledEchoConnection(Reactor * reactor, handle_t handle, ThreadPool * pool, PoolStats * stats)
+        : TcpConnection(reactor, handle), m_pool(pool), m_stats(stats), m_state(kIdle)
+    {
+        SetInputWaterMarks(kInputHighWaterMark, kInputLowWaterMark);
+        ++m_stats->conns;
+    }
+
+protected:
+
+    /// 收到数据: 没有任务在途时把缓冲区中的全部数据交给线程池
+    virtual void OnMessage(Buffer * input)
+    {
+        if (m_state != kIdle)
+        {
+            return;
+        }
+        std::shared_ptr<std::string> request(new std::string(input->Peek(), input->ReadableBytes()));
+        std::shared_ptr<std::string> reply(new std::string());
+        /// 任务和恢复回调各持有一个引用, 连接在它们执行前关闭也不会被销毁
+        AddRef();
+        if (m_pool->Submit(GetReactor(),
+                           [request, reply]() { reply->swap(*request); },
+                           [this, reply]() { OnReply(reply); }))
+        {
+            input->RetrieveAll();
+            m_state = kWorking;
+            ++m_stats->tasks;
+            return;
+        }
+        /// 线程池饱和: 数据留在缓冲区, 暂停读, 有空位后恢复
+        m_state = kWaiting;
+        ++m_stats->pauses;
+        PauseReading();
+        m_pool->NotifyWhenReady(GetReactor(), [this]() { OnReady(); });
+    }
+
+    /// 连接关闭
+    virtual void OnClose()
+    {
+        --m_stats->conns;
+        Release();
+    }
+
+private:
+
+    /// 任务完成(事件循环线程): 发回应答, 继续处理任务期间收到的数据
+    void OnReply(const std::shared_ptr<std::string> & reply)
+    {
+        m_state = kIdle;
+        if (!IsClosed())
+        {
+            Send(reply->data(), reply->size());
+            ProcessInput();
+        }
+        Release();
+    }
+
+    /// 线程池有空位(事件循环线程): 恢复读并重新提交缓冲区中的数据
+    void OnReady()
+    {
+        m_state = kIdle;
+        if (!IsClosed())
+        {
+            ++m_stats->resumes;
+            ResumeReading();
+            ProcessInput();
+        }
+        Release();
+    }
+
+private:
+
+    /// 任务状态
+    enum State
+    {
+        kIdle,    ///< 没有任务在途
+        kWorking, ///< 任务在线程池中
+        kWaiting  ///< 提交失败, 等待线程池的空位
+    };
+
+    ThreadPool * m_pool;  ///< 线程池
+    PoolStats *  m_stats; ///< 反压统计
+    State        m_state; ///< 任务状态
+};
+
+/// 回显服务器
+class EchoServer
+{
+public:
+
+    /// 构造函数
+    /// @param  reactor 所属的reactor
+    /// @param  mode    连接的注册方式
+    /// @param  pool    处理回显的线程池, NULL时在事件循环中直接回显
+    EchoServer(Reactor * reactor, event_t mode, ThreadPool * pool)
+        : m_reactor(reactor), m_mode(mode), m_pool(pool),
+          m_acceptor(new Acceptor(reactor, std::bind(&EchoServer::OnConnection, this, std::placeholders::_1)))
+    {
+        memset(&m_stats, 0, sizeof(m_stats));
+    }
+
+    /// 析构函数, 关闭监听socket
+    ~EchoServer()
+    {
+        m_acceptor->Close();
+    }
+
+    /// 开始监听
+    int Start(unsigned short port)
+    {
+        return m_acceptor->Listen("127.0.0.1", port);
+    }
+
+    /// 实际监听的端口
+    /// 缺省任选空闲端口: io_uring的事件循环线程退出后, 内核异步回收其请求,
+    /// 进程退出时监听socket可能还未释放, 紧接着的下一次压测绑定固定端口会失败
+    unsigned short Port() const
+    {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        if (::getsockname(m_acceptor->GetHandle(), (struct sockaddr *)&addr, &len) < 0)
+        {
+            return 0;
+        }
+        return ntohs(addr.sin_port);
+    }
+
+    /// 线程池的反压统计, 事件循环停止后读取
+    const PoolStats & GetPoolStats() const
+    {
+        return m_stats;
+    }
+
+private:
+
+    /// 新连接
+    void OnConnection(handle_t handle)
+    {
+        SetNoDelay(handle);
+        if (m_pool != NULL)
+        {
+            PooledEchoConnection * conn = new PooledEchoConnection(m_reactor, handle, m_pool, &m_stats);
+            if (conn->Start() != 0)
+            {
+                conn->Close();
+            }
+            return;
+        }
+        EchoConnection * conn = new EchoConnection(m_reactor, handle, m_mode);
+        conn->Start();
+    }
+
+private:
+
+    Reactor *    m_reactor;  ///< 所属的reactor
+    event_t      m_mode;     ///< 连接的注册方式
+    ThreadPool * m_pool;     ///< 处理回显的线程池, 可为NULL
+    PoolStats    m_stats;    ///< 线程池的反压统计
+    Acceptor *   m_acceptor; ///< 监听socket
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+class LoadGenerator;
+
+/// 负载连接
+/// pingpong: 发一个消息, 收齐回显后记录延迟并发下一个;
+/// throughput: 在途字节数不超过窗口地持续发送;
+/// churn: 连接、发一个消息、收齐回显后记录从发起连接开始的延迟, 断开(RST)并重新连接.
+class LoadConnection : public EventHandler
+{
+public:
+
+    /// 构造函数
+    explicit LoadConnection(LoadGenerator * generator);
+
+    /// 获取该handler所对应的句柄
+    virtual handle_t GetHandle() const
+    {
+        return m_handle;
+    }
+
+    /// 发起非阻塞连接
+    /// @retval 0   成功
+    /// @retval < 0 出错(-errno)
+    int Connect();
+
+    /// 关闭连接
+    void Close();
+
+    /// 读事件: 收回显
+    virtual void HandleRead();
+
+    /// 写事件: 连接完成或继续发送
+    virtual void HandleWrite();
+
+    /// 出错事件
+    virtual void HandleError();
+
+private:
+
+    /// 连接已建立
+    void OnConnected();
+
+    /// 开始一个请求
+    void StartRequest();
+
+    /// 尽量发出待发送的数据, 返回false表示连接出错
+    bool Pump();
+
+    /// 按是否还有数据要发更新关注的事件
+    void UpdateInterest();
+
+    /// 连接出错, 计数后关闭(churn时重新连接)
+    void Fail();
+
+private:
+
+    LoadGenerator *  m_generator; ///< 所属的负载生成器
+    handle_t         m_handle;    ///< socket句柄
+    bool             m_connecting;///< 是否正在连接
+    bool             m_writing;   ///< 是否关注了写事件
+    size_t           m_send_left; ///< 当前请求待发送的字节数
+    size_t           m_recv_left; ///< 当前请求待收回的字节数
+    size_t           m_inflight;  ///< throughput在途的字节数
+    uint64_t         m_start;     ///< 当前请求的开始时刻
+};
+
+/// 负载生成器
+class LoadGenerator
+{
+public:
+
+    /// 构造函数
+    LoadGenerator(Reactor * reactor, const Options & opts)
+        : m_reactor(reactor), m_opts(opts), m_payload(opts.size > opts.window ? opts.size : opts.window, 'x'),
+          m_running(false), m_requests(0), m_bytes(0), m_errors(0), m_start(0), m_elapsed(0)
+    {
+    }
+
+    /// 建立所有连接并开始计时
+    void Start()
+    {
+        m_running = true;
+        m_start = MonotonicNanos();
+        for (int idx = 0; idx < m_opts.conns; ++idx)
+        {
+            LoadConnection * conn = new LoadConnection(this);
+            if (conn->Connect() != 0)
+            {
+                ++m_errors;
+                conn->Release();
+                continue;
+            }
+            m_conns.push_back(conn);
+        }
+        m_reactor->ScheduleTimer(m_opts.duration * 1000, 0, [this]() { Finish(); });
+    }
+
+    /// 关闭所有连接
+    void Close()
+    {
+        for (size_t idx = 0; idx < m_conns.size(); ++idx)
+        {
+            m_conns[idx]->Close();
+            m_conns[idx]->Release();
+        }
+        m_conns.clear();
+    }
+
+    /// 输出结果
+    void Report(const MetricsSnapshot & server) const
+    {
+        double seconds = static_cast<double>(m_elapsed) / 1e9;
+        printf("%-10s backend=%-6s mode=%-7s conns=%d size=%zu duration=%.1fs\n",
+               m_opts.workload.c_str(), m_opts.backend.c_str(), m_opts.mode.c_str(),
+               m_opts.conns, m_opts.size, seconds);
+        if (m_opts.workload == "throughput")
+        {
+            printf("  bytes %llu  rate %.1f MB/s  errors %llu\n",
+                   static_cast<unsigned long long>(m_bytes), m_bytes / seconds / (1024 * 1024),
+                   static_cast<unsigned long long>(m_errors));
+        }
+        else
+        {
+            HistogramSnapshot latency;
+            m_latency.Snapshot(&latency);
+            printf("  requests %llu  rate %.1f req/s  errors %llu\n",
+                   static_cast<unsigned long long>(m_requests), m_requests / seconds,
+                   static_cast<unsigned long long>(m_errors));
+            printf("  latency us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+                   latency.Percentile(0.5) / 1e3, latency.Percentile(0.99) / 1e3,
+                   latency.Percentile(0.999) / 1e3, latency.max / 1e3);
+        }
+        printf("  server: events/wait %.2f  ctl_calls %llu  handler p99 %.1f us\n",
+               server.waits > 0 ? static_cast<double>(server.events) / server.waits : 0.0,
+               static_cast<unsigned long long>(server.ctl_calls),
+               server.handler_time.Percentile(0.99) / 1e3);
+        if (server.spin_hits + server.spin_misses > 0)
+        {
+            printf("  server: spin hits %llu  misses %llu  hit rate %.1f%%\n",
+                   static_cast<unsigned long long>(server.spin_hits),
+                   static_cast<unsigned long long>(server.spin_misses),
+                   100.0 * server.spin_hits / (server.spin_hits + server.spin_misses));
+        }
+    }
+
+    /// 是否仍在压测
+    bool Running() const
+    {
+        return m_running;
+    }
+
+    /// 记录一个完成的请求
+    void Record(uint64_t nanos)
+    {
+        m_latency.Record(nanos);
+        ++m_requests;
+    }
+
+    /// 记录收回的字节数
+    void AddBytes(size_t len)
+    {
+        m_bytes += len;
+    }
+
+    /// 记录一次出错
+    void AddError()
+    {
+        ++m_errors;
+    }
+
+    Reactor * GetReactor() const
+    {
+        return m_reactor;
+    }
+
+    const Options & GetOptions() const
+    {
+        return m_opts;
+    }
+
+    const char * Payload() const
+    {
+        return m_payload.data();
+    }
+
+private:
+
+    /// 压测时间到
+    void Finish()
+    {
+        m_running = false;
+        m_elapsed = MonotonicNanos() - m_start;
+        m_reactor->Stop();
+    }
+
+private:
+
+    Reactor *                       m_reactor;  ///< 负载所在的reactor
+    Options                         m_opts;     ///< 压测参数
+    std::string                     m_payload;  ///< 发送的数据
+    std::vector<LoadConnection *>   m_conns;    ///< 所有连接
+    bool                            m_running;  ///< 是否仍在压测
+    uint64_t                        m_requests; ///< 完成的请求数
+    uint64_t                        m_bytes;    ///< 收回的字节数
+    uint64_t                        m_errors;   ///< 出错次数
+    uint64_t                        m_start;    ///< 开始时刻
+    uint64_t                        m_elapsed;  ///< 压测时长(纳秒)
+    LatencyHistogram                m_latency;  ///< 请求延迟
+};
+
+/// 构造函数
+LoadConnection::LoadConnection(LoadGenerator * generator)
+    : EventHandler(), m_generator(generator), m_handle(-1), m_connecting(false), m_writing(false),
+      m_send_left(0), m_recv_left(0), m_inflight(0), m_start(0)
+{
+}
+
+/// 发起非阻塞连接
+int LoadConnection::Connect()
+{
+    const Options & opts = m_generator->GetOptions();
+    m_start = MonotonicNanos();
+    m_handle = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_handle < 0)
+    {
+        return -errno;
+    }
+    SetNoDelay(m_handle);
+    if (opts.workload == "churn")
+    {
+        /// 关闭时直接RST, 回环上大量短连接不会耗尽TIME_WAIT端口
+        linger lin = { 1, 0 };
+        ::setsockopt(m_handle, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opts.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(m_handle, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 && errno != EINPROGRESS)
+    {
+        int err = -errno;
+        ::close(m_handle);
+        m_handle = -1;
+        return err;
+    }
+    m_connecting = true;
+    m_writing = true;
+    return m_generator->GetReactor()->RegisterHandler(this, kReadEvent | kWriteEvent | kPersistEvent);
+}
+
+/// 关闭连接
+void LoadConnection::Close()
+{
+    if (m_handle >= 0)
+    {
+        m_generator->GetReactor()->CloseHandler(this);
+        m_handle = -1;
+    }
+}
+
+/// 读事件: 收回显
+void LoadConnection::HandleRead()
+{
+    if (m_connecting)
+    {
+        return;
+    }
+    char buf[64 * 1024];
+    ssize_t n = ::recv(m_handle, buf, sizeof(buf), 0);
+    if (n <= 0)
+    {
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            return;
+        }
+        Fail();
+        return;
+    }
+    const Options & opts = m_generator->GetOptions();
+    size_t len = static_cast<size_t>(n);
+    if (opts.workload == "throughput")
+    {
+        m_generator->AddBytes(len);
+        m_inflight -= len < m_inflight ? len : m_inflight;
+        if (!Pump())
+        {
+            Fail();
+        }
+        return;
+    }
+    m_recv_left -= len < m_recv_left ? len : m_recv_left;
+    if (m_recv_left > 0)
+    {
+        return;
+    }
+    m_generator->Record(MonotonicNanos() - m_start);
+    if (!m_generator->Running())
+    {
+        return;
+    }
+    if (opts.workload == "churn")
+    {
+        Close();
+        if (Connect() != 0)
+        {
+            m_generator->AddError();
+        }
+        return;
+    }
+    m_start = MonotonicNanos();
+    StartRequest();
+}
+
+/// 写事件: 连接完成或继续发送
+void LoadConnection::HandleWrite()
+{
+    if (m_connecting)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ::getsockopt(m_handle, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0)
+        {
+            Fail();
+            return;
+        }
+        m_connecting = false;
+        OnConnected();
+        return;
+    }
+    if (!Pump())
+    {
+        Fail();
+    }
+}
+
+/// 出错事件
+void LoadConnection::HandleError()
+{
+    Fail();
+}
+
+/// 连接已建立
+void LoadConnection::OnConnected()
+{
+    if (m_generator->GetOptions().workload == "throughput")
+    {
+        if (!Pump())
+        {
+            Fail();
+        }
+        return;
+    }
+    StartRequest();
+}
+
+/// 开始一个请求
+void LoadConnection::StartRequest()
+{
+    m_send_left = m_generator->GetOptions().size;
+    m_recv_left = m_send_left;
+    if (!Pump())
+    {
+        Fail();
+    }
+}
+
+/// 尽量发出待发送的数据
+bool LoadConnection::Pump()
+{
+    const Options & opts = m_generator->GetOptions();
+    bool throughput = opts.workload == "throughput";
+    while (true)
+    {
+        size_t len = m_send_left;
+        if (throughput)
+        {
+            if (!m_generator->Running() || m_inflight >= opts.window)
+            {
+                break;
+            }
+            len = opts.window - m_inflight;
+            len = len < opts.size ? len : opts.size;
+        }
+        if (len == 0)
+        {
+            break;
+        }
+        ssize_t n = ::send(m_handle, m_generator->Payload(), len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+            break;
+        }
+        if (throughput)
+        {
+            m_inflight += static_cast<size_t>(n);
+        }
+        else
+        {
+            m_send_left -= static_cast<size_t>(n);
+        }
+    }
+    UpdateInterest();
+    return true;
+}
+
+/// 按是否还有数据要发更新关注的事件
+void LoadConnection::UpdateInterest()
+{
+    const Options & opts = m_generator->GetOptions();
+    bool writing = opts.workload == "throughput" ? m_inflight < opts.window && m_generator->Running()
+                                                 : m_send_left > 0;
+    if (writing != m_writing)
+    {
+        m_writing = writing;
+        m_generator->GetReactor()->RegisterHandler(this, kReadEvent | kPersistEvent | (writing ? kWriteEvent : 0));
+    }
+}
+
+/// 连接出错, 计数后关闭(churn时重新连接)
+void LoadConnection::Fail()
+{
+    m_generator->AddError();
+    Close();
+    if (m_generator->Running() && m_generator->GetOptions().workload == "churn")
+    {
+        if (Connect() != 0)
+        {
+            m_generator->AddError();
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// 分离器的名字, 与-b参数一致
+static const char * BackendName(demultiplexer_t type)
+{
+    switch (type)
+    {
+    case kEpollDemultiplexer: return "epoll";
+    case kPollDemultiplexer: return "poll";
+    case kSelectDemultiplexer: return "select";
+    case kIoUringDemultiplexer: return "uring";
+    default: return "unknown";
+    }
+}
+
+/// 输出用法
+static void Usage(const char * prog)
+{
+    fprintf(stderr,
+            "usage: %s <pingpong|throughput|churn> [options]\n"
+            "  -b backend   epoll|poll|select|uring (default epoll)\n"
+            "  -m mode      persist|oneshot|edge (default persist)\n"
+            "  -c conns     concurrent connections (default 64)\n"
+            "  -s size      message size, block size for throughput (default 64, 16384 for throughput)\n"
+            "  -w window    in-flight bytes per connection for throughput (default 262144)\n"
+            "  -d seconds   duration (default 5)\n"
+            "  -p port      server port (default 0: any free port)\n"
+            "  -S usec      server spin budget before blocking (default 0: no spin)\n"
+            "  -B usec      server SO_BUSY_POLL and epoll busy-poll time (default 0: off)\n"
+            "  -C cpu       pin the server loop to cpu (default -1: no pinning)\n"
+            "  -W workers   echo on a worker pool with read backpressure, persist mode only (default 0: in the loop)\n"
+            "  -Q tasks     worker pool queue limit (default 64)\n", prog);
+}
+
+/// 解析参数
+static bool ParseOptions(int argc, char * argv[], Options * opts)
+{
+    if (argc < 2)
+    {
+        return false;
+    }
+    opts->workload = argv[1];
+    opts->backend = "epoll";
+    opts->mode = "persist";
+    opts->conns = 64;
+    opts->size = 0;
+    opts->window = 256 * 1024;
+    opts->duration = 5;
+    opts->port = 0;
+    opts->spin = 0;
+    opts->busy_poll = 0;
+    opts->cpu = -1;
+    opts->workers = 0;
+    opts->queue = 64;
+    optind = 2;
+    int opt;
+    while ((opt = ::getopt(argc, argv, "b:m:c:s:w:d:p:S:B:C:W:Q:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b': opts->backend = optarg; break;
+        case 'm': opts->mode = optarg; break;
+        case 'c': opts->conns = atoi(optarg); break;
+        case 's': opts->size = static_cast<size_t>(atol(optarg)); break;
+        case 'w': opts->window = static_cast<size_t>(atol(optarg)); break;
+        case 'd': opts->duration = atoi(optarg); break;
+        case 'p': opts->port = static_cast<unsigned short>(atoi(optarg)); break;
+        case 'S': opts->spin = atoi(optarg); break;
+        case 'B': opts->busy_poll = atoi(optarg); break;
+        case 'C': opts->cpu = atoi(optarg); break;
+        case 'W': opts->workers = atoi(optarg); break;
+        case 'Q': opts->queue = static_cast<size_t>(atol(optarg)); break;
+        default: return false;
+        }
+    }
+    if (opts->workload != "pingpong" && opts->workload != "throughput" && opts->workload != "churn")
+    {
+        return false;
+    }
+    if (opts->size == 0)
+    {
+        opts->size = opts->workload == "throughput" ? 16384 : 64;
+    }
+    if (opts->backend == "epoll")
+    {
+        opts->type = kEpollDemultiplexer;
+    }
+    else if (opts->backend == "poll")
+    {
+        opts->type = kPollDemultiplexer;
+    }
+    else if (opts->backend == "select")
+    {
+        opts->type = kSelectDemultiplexer;
+    }
+    else if (opts->backend == "uring")
+    {
+        opts->type = kIoUringDemultiplexer;
+    }
+    else
+    {
+        return false;
+    }
+    if (opts->mode == "persist")
+    {
+        opts->reg_mode = kPersistEvent;
+    }
+    else if (opts->mode == "oneshot")
+    {
+        opts->reg_mode = 0;
+    }
+    else if (opts->mode == "edge")
+    {
+        opts->reg_mode = kEdgeTriggered;
+    }
+    else
+    {
+        return false;
+    }
+    /// 线程池模式的连接是TcpConnection, 只用持续关注
+    if (opts->workers > 0 && opts->reg_mode != kPersistEvent)
+    {
+        return false;
+    }
+    return opts->conns > 0 && opts->duration > 0 && opts->window > 0 && opts->workers >= 0 && opts->queue > 0;
+}
+} // namespace
+
+int main(int argc, char * argv[])
+{
+    Options opts;
+    if (!ParseOptions(argc, argv, &opts))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    reactor::Reactor server_reactor(opts.type);
+    /// 请求的分离器不可用时reactor退回epoll, 跳过这次压测而不是把epoll的结果当作它的结果
+    if (server_reactor.GetDemultiplexerType() != opts.type)
+    {
+        fprintf(stderr, "backend %s is not available (falls back to %s), skipped\n",
+                opts.backend.c_str(), BackendName(server_reactor.GetDemultiplexerType()));
+        return 0;
+    }
+    opts.backend = BackendName(server_reactor.GetDemultiplexerType());
+    server_reactor.SetBusyPoll(opts.spin, opts.busy_poll);
+    if (opts.cpu >= 0 && server_reactor.SetCpuAffinity(opts.cpu) != 0)
+    {
+        fprintf(stderr, "cpu %d is not available\n", opts.cpu);
+        return 1;
+    }
+    ThreadPool pool(opts.workers, opts.queue);
+    if (opts.workers > 0)
+    {
+        pool.Start();
+    }
+    EchoServer server(&server_reactor, opts.reg_mode, opts.workers > 0 ? &pool : NULL);
+    int ret = server.Start(opts.port);
+    if (ret != 0)
+    {
+        fprintf(stderr, "listen on port %d failed: %s\n", opts.port, strerror(-ret));
+        return 1;
+    }
+    opts.port = server.Port();
+    std::thread server_thread([&server_reactor]() { server_reactor.Run(); });
+
+    reactor::Reactor client_reactor(reactor::kEpollDemultiplexer);
+    LoadGenerator generator(&client_reactor, opts);
+    generator.Start();
+    client_reactor.Run();
+    generator.Close();
+
+    server_reactor.Stop();
+    server_thread.join();
+    /// 线程池仍在运行, 在本线程继续处理客户端的断开, 直到连接都已关闭;
+    /// 再等线程池执行完排队的任务, 执行投递回来的回调, 释放它们持有的连接引用
+    for (int round = 0; round < 100 && server.GetPoolStats().conns > 0; ++round)
+    {
+        server_reactor.HandleEvents(10);
+    }
+    pool.Stop();
+    server_reactor.HandleEvents(0);
+    reactor::MetricsSnapshot metrics;
+    server_reactor.GetMetrics()->Snapshot(&metrics);
+    generator.Report(metrics);
+    if (opts.workers > 0)
+    {
+        const PoolStats & stats = server.GetPoolStats();
+        printf("  server: workers %d  queue %zu  tasks %llu  paused %llu  resumed %llu\n",
+               opts.workers, opts.queue, static_cast<unsigned long long>(stats.tasks),
+               static_cast<unsigned long long>(stats.pauses), static_cast<unsigned long long>(stats.resumes));
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+# 对比所有分离器和注册方式: run_all.sh [bench程序] [bench的其他参数, 如 -d 3 -c 128]
+# 依次运行 pingpong, throughput, churn 三种负载, 每种负载覆盖 epoll/poll/select/uring 与 persist/oneshot/edge
+
+BENCH=${1:-./bench}
+[ $# -gt 0 ] && shift
+
+for workload in pingpong throughput churn; do
+    for backend in epoll poll select uring; do
+        for mode in persist oneshot edge; do
+            "$BENCH" "$workload" -b "$backend" -m "$mode" "$@" || exit 1
+        done
+    done
+done
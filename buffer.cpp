@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#if defined(__linux__)
+    #include <sys/uio.h>
+#endif
+#include "buffer.h"
+#include "bufferpool.h"
+
+/// @file   buffer.cpp
+/// @brief  连接的读写缓冲区
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 类内初始化的静态常量在std::max等按引用传参处被ODR使用, 需要定义
+const size_t Buffer::kCheapPrepend;
+const size_t Buffer::kInitialSize;
+
+/// 构造函数
+/// @param  pool    内存池, 为NULL时直接向系统申请
+Buffer::Buffer(BufferPool * pool)
+    : m_pool(pool), m_data(NULL), m_capacity(0), m_reader(kCheapPrepend), m_writer(kCheapPrepend)
+{
+}
+
+/// 析构函数
+Buffer::~Buffer()
+{
+    ReleaseStorage();
+}
+
+/// 取走len字节
+void Buffer::Retrieve(size_t len)
+{
+    assert(len <= ReadableBytes());
+    if (len < ReadableBytes())
+    {
+        m_reader += len;
+    }
+    else
+    {
+        RetrieveAll();
+    }
+}
+
+/// 取走所有数据, 内存归还内存池
+void Buffer::RetrieveAll()
+{
+    ReleaseStorage();
+    m_reader = kCheapPrepend;
+    m_writer = kCheapPrepend;
+}
+
+/// 取走len字节并以字符串返回
+std::string Buffer::RetrieveAsString(size_t len)
+{
+    std::string result(Peek(), len);
+    Retrieve(len);
+    return result;
+}
+
+/// 在尾部追加数据
+void Buffer::Append(const void * data, size_t len)
+{
+    EnsureWritable(len);
+    memcpy(BeginWrite(), data, len);
+    HasWritten(len);
+}
+
+/// 在头部追加数据, len不能超过PrependableBytes
+void Buffer::Prepend(const void * data, size_t len)
+{
+    assert(len <= PrependableBytes());
+    if (m_data == NULL)
+    {
+        MakeSpace(0);
+    }
+    m_reader -= len;
+    memcpy(m_data + m_reader, data, len);
+}
+
+/// 确保至少有len字节的可写空间
+void Buffer::EnsureWritable(size_t len)
+{
+    if (m_data == NULL || WritableBytes() < len)
+    {
+        MakeSpace(len);
+    }
+}
+
+/// 从句柄读数据
+/// 同时读入缓冲区的剩余空间和栈上64K的额外缓冲区, 一次系统调用即可读完大块数据
+/// @param  handle      socket句柄
+/// @param  saved_errno 出错时的errno
+/// @retval > 0 读到的字节数
+/// @retval = 0 对端关闭
+/// @retval < 0 出错
+int Buffer::ReadFd(handle_t handle, int * saved_errno)
+{
+    EnsureWritable(kInitialSize - kCheapPrepend);
+    char extra[65536];
+    const size_t writable = WritableBytes();
+#if defined(__linux__)
+    iovec vec[2];
+    vec[0].iov_base = BeginWrite();
+    vec[0].iov_len = writable;
+    vec[1].iov_base = extra;
+    vec[1].iov_len = sizeof(extra);
+    /// 缓冲区剩余空间已经足够大时不再使用额外缓冲区
+    const int iovcnt = (writable < sizeof(extra)) ? 2 : 1;
+    const ssize_t n = ::readv(handle, vec, iovcnt);
+#else
+    const int n = ::recv(handle, BeginWrite(), static_cast<int>(writable), 0);
+#endif
+    if (n < 0)
+    {
+        *saved_errno = errno;
+        if (ReadableBytes() == 0)
+        {
+            RetrieveAll();
+        }
+    }
+    else if (static_cast<size_t>(n) <= writable)
+    {
+        m_writer += n;
+        if (n == 0 && ReadableBytes() == 0)
+        {
+            RetrieveAll();
+        }
+    }
+    else
+    {
+        m_writer = m_capacity;
+        Append(extra, n - writable);
+    }
+    return static_cast<int>(n);
+}
+
+/// 交换两个缓冲区的内容
+void Buffer::Swap(Buffer & other)
+{
+    std::swap(m_pool, other.m_pool);
+    std::swap(m_data, other.m_data);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_reader, other.m_reader);
+    std::swap(m_writer, other.m_writer);
+}
+
+/// 放弃内存块而不归还, 缓冲区变为空
+void Buffer::Abandon()
+{
+    m_data = NULL;
+    m_capacity = 0;
+    m_reader = kCheapPrepend;
+    m_writer = kCheapPrepend;
+}
+
+/// 腾出len字节的可写空间, 先挪动数据, 不够再扩容
+void Buffer::MakeSpace(size_t len)
+{
+    size_t readable = ReadableBytes();
+    if (m_data != NULL && WritableBytes() + PrependableBytes() >= len + kCheapPrepend)
+    {
+        memmove(m_data + kCheapPrepend, m_data + m_reader, readable);
+    }
+    else
+    {
+        size_t want = std::max(kCheapPrepend + readable + len, kInitialSize);
+        size_t capacity = 0;
+        char * data = m_pool != NULL ? m_pool->Allocate(want, &capacity)
+                                     : static_cast<char *>(malloc(want));
+        if (m_pool == NULL)
+        {
+            capacity = want;
+        }
+        if (m_data != NULL)
+        {
+            memcpy(data + kCheapPrepend, m_data + m_reader, readable);
+            ReleaseStorage();
+        }
+        m_data = data;
+        m_capacity = capacity;
+    }
+    m_reader = kCheapPrepend;
+    m_writer = kCheapPrepend + readable;
+}
+
+/// 归还内存
+void Buffer::ReleaseStorage()
+{
+    if (m_data == NULL)
+    {
+        return;
+    }
+    if (m_pool != NULL)
+    {
+        m_pool->Release(m_data, m_capacity);
+    }
+    else
+    {
+        free(m_data);
+    }
+    m_data = NULL;
+    m_capacity = 0;
+}
+} // namespace reactor
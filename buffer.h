@@ -0,0 +1,132 @@
+#ifndef _BUFFER_H_
+#define _BUFFER_H_
+
+#include <string>
+#include "reactor.h"
+
+/// @file   buffer.h
+/// @brief  连接的读写缓冲区
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+class BufferPool;
+
+/// 连接的读写缓冲区
+/// +-------------------+------------------+------------------+
+/// | prependable bytes |  readable bytes  |  writable bytes  |
+/// +-------------------+------------------+------------------+
+/// 0      <=       reader      <=      writer     <=     capacity
+/// 内存从reactor的BufferPool按需取得, 数据被取空时归还, 空闲的连接不占用缓冲区内存.
+class Buffer
+{
+public:
+
+    /// 头部预留的字节数, 便于在数据前追加长度等信息
+    static const size_t kCheapPrepend = 8;
+
+    /// 首次分配的大小
+    static const size_t kInitialSize = 1024;
+
+    /// 构造函数
+    /// @param  pool    内存池, 为NULL时直接向系统申请
+    explicit Buffer(BufferPool * pool = NULL);
+
+    /// 析构函数
+    ~Buffer();
+
+    /// 可读的字节数
+    size_t ReadableBytes() const
+    {
+        return m_writer - m_reader;
+    }
+
+    /// 可写的字节数
+    size_t WritableBytes() const
+    {
+        return m_capacity - m_writer;
+    }
+
+    /// 头部可追加的字节数
+    size_t PrependableBytes() const
+    {
+        return m_reader;
+    }
+
+    /// 可读数据的起始位置
+    const char * Peek() const
+    {
+        return m_data + m_reader;
+    }
+
+    /// 可写空间的起始位置
+    char * BeginWrite()
+    {
+        return m_data + m_writer;
+    }
+
+    /// 向可写空间写入len字节后调用
+    void HasWritten(size_t len)
+    {
+        m_writer += len;
+    }
+
+    /// 取走len字节
+    void Retrieve(size_t len);
+
+    /// 取走所有数据, 内存归还内存池
+    void RetrieveAll();
+
+    /// 取走len字节并以字符串返回
+    std::string RetrieveAsString(size_t len);
+
+    /// 在尾部追加数据
+    void Append(const void * data, size_t len);
+
+    /// 在头部追加数据, len不能超过PrependableBytes
+    void Prepend(const void * data, size_t len);
+
+    /// 确保至少有len字节的可写空间
+    void EnsureWritable(size_t len);
+
+    /// 从句柄读数据
+    /// 同时读入缓冲区的剩余空间和栈上64K的额外缓冲区, 一次系统调用即可读完大块数据
+    /// @param  handle      socket句柄
+    /// @param  saved_errno 出错时的errno
+    /// @retval > 0 读到的字节数
+    /// @retval = 0 对端关闭
+    /// @retval < 0 出错
+    int ReadFd(handle_t handle, int * saved_errno);
+
+    /// 交换两个缓冲区的内容
+    void Swap(Buffer & other);
+
+    /// 放弃内存块而不归还, 缓冲区变为空
+    /// 用于内核可能仍在引用的内存(如没有等到完成通知的零拷贝发送): 池中的块不再被复用,
+    /// 在内存池析构时随slab释放; 直接向系统申请的内存不再释放
+    void Abandon();
+
+private:
+
+    /// 腾出len字节的可写空间, 先挪动数据, 不够再扩容
+    void MakeSpace(size_t len);
+
+    /// 归还内存
+    void ReleaseStorage();
+
+    /// 禁止拷贝构造和赋值操作
+    Buffer(const Buffer &);
+    Buffer & operator=(const Buffer &);
+
+private:
+
+    BufferPool *  m_pool;     ///< 内存池
+    char *        m_data;     ///< 内存块, 没有数据时为NULL
+    size_t        m_capacity; ///< 内存块大小
+    size_t        m_reader;   ///< 读位置
+    size_t        m_writer;   ///< 写位置
+};
+} // namespace reactor
+
+#endif // _BUFFER_H_
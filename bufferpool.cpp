@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include "bufferpool.h"
+
+/// @file   bufferpool.cpp
+/// @brief  按规格分级的slab内存池, 为连接缓冲区提供内存
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 构造函数
+BufferPool::BufferPool()
+    : m_bytes_in_use(0)
+{
+    for (int idx = 0; idx < kNumClasses; ++idx)
+    {
+        m_free[idx] = NULL;
+    }
+}
+
+/// 析构函数, 归还所有slab
+BufferPool::~BufferPool()
+{
+    for (size_t idx = 0; idx < m_slabs.size(); ++idx)
+    {
+        free(m_slabs[idx]);
+    }
+}
+
+/// 分配至少size字节的内存块
+/// @param  size     需要的字节数
+/// @param  capacity 返回内存块的实际大小, 释放时原样传回
+/// @retval 内存块
+char * BufferPool::Allocate(size_t size, size_t * capacity)
+{
+    int size_class = SizeClass(size);
+    if (size_class < 0)
+    {
+        *capacity = size;
+        m_bytes_in_use += size;
+        return static_cast<char *>(malloc(size));
+    }
+    if (m_free[size_class] == NULL)
+    {
+        Refill(size_class);
+    }
+    FreeBlock * block = m_free[size_class];
+    m_free[size_class] = block->next;
+    *capacity = ClassSize(size_class);
+    m_bytes_in_use += *capacity;
+    return reinterpret_cast<char *>(block);
+}
+
+/// 释放内存块
+/// @param  block    Allocate返回的内存块
+/// @param  capacity Allocate返回的实际大小
+void BufferPool::Release(char * block, size_t capacity)
+{
+    m_bytes_in_use -= capacity;
+    int size_class = SizeClass(capacity);
+    if (size_class < 0)
+    {
+        free(block);
+        return;
+    }
+    FreeBlock * node = reinterpret_cast<FreeBlock *>(block);
+    node->next = m_free[size_class];
+    m_free[size_class] = node;
+}
+
+/// 容纳size字节的最小规格, 超过最大规格时返回-1
+int BufferPool::SizeClass(size_t size)
+{
+    for (int idx = 0; idx < kNumClasses; ++idx)
+    {
+        if (size <= ClassSize(idx))
+        {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+/// 规格的块大小
+size_t BufferPool::ClassSize(int size_class)
+{
+    return static_cast<size_t>(1) << (kMinClassShift + size_class * kClassShiftStep);
+}
+
+/// 为规格新切一个slab
+void BufferPool::Refill(int size_class)
+{
+    char * slab = static_cast<char *>(malloc(kSlabSize));
+    m_slabs.push_back(slab);
+    size_t block_size = ClassSize(size_class);
+    for (size_t offset = 0; offset + block_size <= kSlabSize; offset += block_size)
+    {
+        FreeBlock * node = reinterpret_cast<FreeBlock *>(slab + offset);
+        node->next = m_free[size_class];
+        m_free[size_class] = node;
+    }
+}
+} // namespace reactor
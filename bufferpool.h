@@ -0,0 +1,79 @@
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+#include <stddef.h>
+#include <vector>
+
+/// @file   bufferpool.h
+/// @brief  按规格分级的slab内存池, 为连接缓冲区提供内存
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 按规格分级的slab内存池
+/// 规格为256B/1K/4K/16K/64K, 每级从256K的slab中切分, 释放的内存块挂在该级的空闲链表上复用.
+/// 超过最大规格的请求直接向系统申请. 每个reactor一个, 只在事件循环线程中使用, 不加锁.
+class BufferPool
+{
+public:
+
+    /// 构造函数
+    BufferPool();
+
+    /// 析构函数, 归还所有slab
+    ~BufferPool();
+
+    /// 分配至少size字节的内存块
+    /// @param  size     需要的字节数
+    /// @param  capacity 返回内存块的实际大小, 释放时原样传回
+    /// @retval 内存块
+    char * Allocate(size_t size, size_t * capacity);
+
+    /// 释放内存块
+    /// @param  block    Allocate返回的内存块
+    /// @param  capacity Allocate返回的实际大小
+    void Release(char * block, size_t capacity);
+
+    /// 已分出、尚未释放的内存字节数(按内存块的实际大小计)
+    size_t BytesInUse() const
+    {
+        return m_bytes_in_use;
+    }
+
+private:
+
+    /// 空闲内存块, 复用块本身的空间串成链表
+    struct FreeBlock
+    {
+        FreeBlock * next; ///< 下一个空闲块
+    };
+
+    /// 最小规格为256字节, 每级是上一级的4倍
+    static const int    kMinClassShift = 8;
+    static const int    kClassShiftStep = 2;
+    static const int    kNumClasses = 5;
+    static const size_t kSlabSize = 256 * 1024;
+
+    /// 容纳size字节的最小规格, 超过最大规格时返回-1
+    static int SizeClass(size_t size);
+
+    /// 规格的块大小
+    static size_t ClassSize(int size_class);
+
+    /// 为规格新切一个slab
+    void Refill(int size_class);
+
+    /// 禁止拷贝构造和赋值操作
+    BufferPool(const BufferPool &);
+    BufferPool & operator=(const BufferPool &);
+
+private:
+
+    FreeBlock *          m_free[kNumClasses]; ///< 各规格的空闲链表
+    std::vector<char *>  m_slabs;             ///< 已申请的slab
+    size_t               m_bytes_in_use;      ///< 已分出的字节数
+};
+} // namespace reactor
+
+#endif // _BUFFER_POOL_H_
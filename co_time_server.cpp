@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <vector>
+#include "common.h"
+#include "reactorgroup.h"
+#include "codec.h"
+#include "coroutine.h"
+
+/// @file   co_time_server.cpp
+/// @brief  用协程实现的time_server, 请求和应答格式相同
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+/// 全局事件循环组, 每个事件循环持有一个监听socket
+reactor::ReactorGroup * g_reactor_group = NULL;
+
+/// 应答积累到该长度时先发出, 缓冲区按需扩容, 不让它无限增长
+static const size_t kFlushSize = 64 * 1024;
+
+/// 一个连接的会话: 按行读请求, 逐行应答, 流水线的请求一次读入后依次处理, 应答合并发送
+reactor::CoTask Session(reactor::Reactor * reactor, reactor::handle_t handle)
+{
+    reactor::CoConnection conn(reactor, handle);
+    reactor::LineCodec codec(256);
+    reactor::Buffer input(reactor->GetBufferPool());
+    reactor::Buffer output(reactor->GetBufferPool());
+    while (co_await conn.Read(&input) > 0)
+    {
+        const char * line = NULL;
+        size_t len = 0;
+        int used = 0;
+        bool quit = false;
+        while (!quit && (used = codec.Decode(input.Peek(), input.ReadableBytes(), &line, &len)) > 0)
+        {
+            if (len == 4 && strncasecmp("time", line, 4) == 0)
+            {
+                char response[64];
+                int n = sprintf(response, "current time: %d", (int)time(NULL));
+                codec.Encode(response, n, &output);
+                if (output.ReadableBytes() >= kFlushSize && co_await conn.Write(&output) < 0)
+                {
+                    quit = true;
+                }
+            }
+            else
+            {
+                if (len != 4 || strncasecmp("exit", line, 4) != 0)
+                {
+                    fprintf(stderr, "Invalid request: %.*s\n", (int)len, line);
+                }
+                quit = true;
+            }
+            input.Retrieve(used);
+        }
+        if (output.ReadableBytes() > 0 && co_await conn.Write(&output) < 0)
+        {
+            break;
+        }
+        if (quit || used < 0)
+        {
+            break;
+        }
+    }
+    fprintf(stderr, "client %d closed\n", (int)conn.GetHandle());
+}
+
+/// 接受连接, 每个连接启动一个会话协程
+/// 出错(如描述符耗尽)时稍后重试, 不在持续的错误上空转; 监听socket已关闭时退出
+reactor::CoTask Serve(reactor::Reactor * reactor, reactor::CoAcceptor * acceptor)
+{
+    while (true)
+    {
+        int handle = co_await acceptor->Accept();
+        if (handle >= 0)
+        {
+            Session(reactor, handle);
+        }
+        else if (handle == -EPIPE)
+        {
+            co_return;
+        }
+        else
+        {
+            co_await reactor::Sleep(reactor, 100);
+        }
+    }
+}
+
+/// 收到退出信号时停止事件循环
+void HandleSignal(int /*sig*/)
+{
+    g_reactor_group->Stop();
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s ip port [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /// 线程数缺省为CPU核数
+    reactor::ReactorGroup group(argc > 3 ? atoi(argv[3]) : 0);
+    g_reactor_group = &group;
+
+    /// 每个事件循环各自监听同一端口, 由内核在监听socket间分配连接
+    std::vector<reactor::CoAcceptor *> acceptors;
+    for (int idx = 0; idx < group.Size(); ++idx)
+    {
+        reactor::Reactor * reactor = group.GetReactor(idx);
+        reactor::CoAcceptor * acceptor = new reactor::CoAcceptor(reactor);
+        acceptors.push_back(acceptor);
+        int ret = acceptor->Listen(argv[1], atoi(argv[2]), SOMAXCONN, true);
+        if (ret != 0)
+        {
+            errno = -ret;
+            ReportSocketError("listen");
+            return EXIT_FAILURE;
+        }
+        reactor->RunInLoop([reactor, acceptor]() { Serve(reactor, acceptor); });
+    }
+    fprintf(stderr, "server started with %d threads!\n", group.Size());
+
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+
+    group.Run();
+    fprintf(stderr, "server stopped!\n");
+    /// 挂起在Accept上的协程不再恢复, 其协程帧随进程退出
+    for (size_t idx = 0; idx < acceptors.size(); ++idx)
+    {
+        delete acceptors[idx];
+    }
+    return EXIT_SUCCESS;
+}
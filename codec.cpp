@@ -0,0 +1,255 @@
+#include <string.h>
+#include "codec.h"
+
+/// @file   codec.cpp
+/// @brief  连接缓冲区与应用之间的分帧: 按行、定长头部的长度前缀、varint长度前缀
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 构造函数
+/// @param  max_line    行长度(含行尾)的上限, 超过时解析出错
+LineCodec::LineCodec(size_t max_line)
+    : m_max_line(max_line), m_scanned(0)
+{
+}
+
+/// 从data开头解析一行
+/// @retval > 0     该行(含行尾)占用的字节数
+/// @retval = 0     还没有读到行尾
+/// @retval < 0     行超过长度上限
+int LineCodec::Decode(const char * data, size_t len, const char ** frame, size_t * frame_len)
+{
+    if (m_scanned > len)
+    {
+        /// 调用者没有从同一行的开头传入, 重新扫描
+        m_scanned = 0;
+    }
+    const char * eol = static_cast<const char *>(memchr(data + m_scanned, '\n', len - m_scanned));
+    if (eol == NULL)
+    {
+        m_scanned = len;
+        return len >= m_max_line ? -1 : 0;
+    }
+    m_scanned = 0;
+    size_t used = eol - data + 1;
+    if (used > m_max_line)
+    {
+        return -1;
+    }
+    size_t line_len = used - 1;
+    if (line_len > 0 && data[line_len - 1] == '\r')
+    {
+        --line_len;
+    }
+    *frame = data;
+    *frame_len = line_len;
+    return static_cast<int>(used);
+}
+
+/// 追加负载和\r\n
+void LineCodec::Encode(const void * data, size_t len, Buffer * output)
+{
+    output->EnsureWritable(len + 2);
+    output->Append(data, len);
+    output->Append("\r\n", 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// 构造函数
+/// @param  header_len  头部字节数: 1, 2或4
+/// @param  max_frame   负载长度的上限, 超过时解析出错
+LengthPrefixedCodec::LengthPrefixedCodec(int header_len, size_t max_frame)
+    : m_header_len(header_len), m_max_frame(max_frame)
+{
+    if (m_header_len != 1 && m_header_len != 2)
+    {
+        m_header_len = 4;
+    }
+    size_t limit = m_header_len == 4 ? 0x7fffffffU - 4 : (1U << (8 * m_header_len)) - 1;
+    if (m_max_frame > limit)
+    {
+        m_max_frame = limit;
+    }
+}
+
+/// 从data开头解析一帧
+/// @retval > 0     头部和负载的字节数
+/// @retval = 0     头部或负载不完整
+/// @retval < 0     负载长度超过上限
+int LengthPrefixedCodec::Decode(const char * data, size_t len, const char ** frame, size_t * frame_len)
+{
+    size_t header_len = static_cast<size_t>(m_header_len);
+    if (len < header_len)
+    {
+        return 0;
+    }
+    const unsigned char * header = reinterpret_cast<const unsigned char *>(data);
+    size_t payload_len = 0;
+    for (size_t idx = 0; idx < header_len; ++idx)
+    {
+        payload_len = (payload_len << 8) | header[idx];
+    }
+    if (payload_len > m_max_frame)
+    {
+        return -1;
+    }
+    if (len - header_len < payload_len)
+    {
+        return 0;
+    }
+    *frame = data + header_len;
+    *frame_len = payload_len;
+    return static_cast<int>(header_len + payload_len);
+}
+
+/// 追加头部和负载
+void LengthPrefixedCodec::Encode(const void * data, size_t len, Buffer * output)
+{
+    unsigned char header[4];
+    size_t value = len;
+    for (int idx = m_header_len - 1; idx >= 0; --idx)
+    {
+        header[idx] = static_cast<unsigned char>(value & 0xff);
+        value >>= 8;
+    }
+    output->EnsureWritable(m_header_len + len);
+    output->Append(header, m_header_len);
+    output->Append(data, len);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// 构造函数
+/// @param  max_frame   负载长度的上限, 超过时解析出错
+VarintCodec::VarintCodec(size_t max_frame)
+    : m_max_frame(max_frame)
+{
+    if (m_max_frame > 0x7fffffffU - kMaxVarintBytes)
+    {
+        m_max_frame = 0x7fffffffU - kMaxVarintBytes;
+    }
+}
+
+/// 从data开头解析一帧
+/// @retval > 0     头部和负载的字节数
+/// @retval = 0     头部或负载不完整
+/// @retval < 0     头部超过5字节或负载长度超过上限
+int VarintCodec::Decode(const char * data, size_t len, const char ** frame, size_t * frame_len)
+{
+    const unsigned char * header = reinterpret_cast<const unsigned char *>(data);
+    uint64_t payload_len = 0;
+    size_t header_len = 0;
+    for (;;)
+    {
+        if (header_len == len)
+        {
+            return 0;
+        }
+        if (header_len == static_cast<size_t>(kMaxVarintBytes))
+        {
+            return -1;
+        }
+        unsigned char byte = header[header_len];
+        payload_len |= static_cast<uint64_t>(byte & 0x7f) << (7 * header_len);
+        ++header_len;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+    }
+    if (payload_len > m_max_frame)
+    {
+        return -1;
+    }
+    if (len - header_len < payload_len)
+    {
+        return 0;
+    }
+    *frame = data + header_len;
+    *frame_len = static_cast<size_t>(payload_len);
+    return static_cast<int>(header_len + payload_len);
+}
+
+/// 追加varint头部和负载
+void VarintCodec::Encode(const void * data, size_t len, Buffer * output)
+{
+    unsigned char header[kMaxVarintBytes];
+    int header_len = 0;
+    uint32_t value = static_cast<uint32_t>(len);
+    while (value >= 0x80)
+    {
+        header[header_len++] = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+    header[header_len++] = static_cast<unsigned char>(value);
+    output->EnsureWritable(header_len + len);
+    output->Append(header, header_len);
+    output->Append(data, len);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+/// 构造函数
+/// @param  reactor 连接所属的reactor
+/// @param  handle  已连接的socket
+/// @param  codec   编解码器, 由连接持有并在析构时删除
+CodecConnection::CodecConnection(Reactor * reactor, handle_t handle, FrameCodec * codec)
+    : TcpConnection(reactor, handle), m_codec(codec), m_encoded(reactor->GetBufferPool())
+{
+}
+
+/// 析构函数
+CodecConnection::~CodecConnection()
+{
+    delete m_codec;
+}
+
+/// 把负载编码成一帧发送
+/// 小帧复制进输出链尾部的缓冲区, 与同一次回调中的其他应答合并; 大帧的缓冲区直接挂到输出链上, 不再复制
+void CodecConnection::SendFrame(const void * data, size_t len)
+{
+    if (IsClosed())
+    {
+        return;
+    }
+    m_codec->Encode(data, len, &m_encoded);
+    size_t encoded = m_encoded.ReadableBytes();
+    if (encoded <= kCopyFrameSize)
+    {
+        Send(m_encoded.Peek(), encoded);
+        m_encoded.RetrieveAll();
+    }
+    else
+    {
+        Send(&m_encoded);
+    }
+}
+
+/// 收到数据: 解出所有完整的帧交给OnFrame
+/// 帧直接指向输入缓冲区, 全部处理完后一次取走已解出的字节
+void CodecConnection::OnMessage(Buffer * input)
+{
+    size_t offset = 0;
+    while (!IsClosed())
+    {
+        const char * frame = NULL;
+        size_t frame_len = 0;
+        int used = m_codec->Decode(input->Peek() + offset, input->ReadableBytes() - offset, &frame, &frame_len);
+        if (used == 0)
+        {
+            break;
+        }
+        if (used < 0)
+        {
+            Close();
+            break;
+        }
+        offset += static_cast<size_t>(used);
+        OnFrame(frame, frame_len);
+    }
+    input->Retrieve(offset);
+}
+} // namespace reactor
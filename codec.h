@@ -0,0 +1,153 @@
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include "reactor.h"
+#include "buffer.h"
+#include "tcpconnection.h"
+
+/// @file   codec.h
+/// @brief  连接缓冲区与应用之间的分帧: 按行、定长头部的长度前缀、varint长度前缀
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 分帧编解码器
+/// Decode在输入缓冲区上原地解析, 帧的负载直接指向缓冲区, 不复制; 数据不完整时返回0, 下次读到更多数据后
+/// 从同一帧的开头再次传入, 编解码器可记住已扫描的位置, 跨多次读增量解析.
+class FrameCodec
+{
+public:
+
+    /// 析构函数
+    virtual ~FrameCodec() {}
+
+    /// 从data开头解析一帧
+    /// @param  data    待解析的数据, 从上一帧之后开始
+    /// @param  len     数据长度
+    /// @param  frame   解出的负载, 指向data内部
+    /// @param  frame_len 负载长度
+    /// @retval > 0     该帧(含头部、分隔符)占用的字节数
+    /// @retval = 0     数据不完整, 等待更多数据
+    /// @retval < 0     帧格式错误或超过长度上限
+    virtual int Decode(const char * data, size_t len, const char ** frame, size_t * frame_len) = 0;
+
+    /// 把负载编码成一帧追加到output
+    virtual void Encode(const void * data, size_t len, Buffer * output) = 0;
+};
+
+/// 按行分帧, 行以\r\n或\n结束, 负载不含行尾
+/// 用memchr查找\n(libc的实现是向量化的), 数据不完整时记住已扫描的长度, 下次从那里继续, 不重复扫描.
+class LineCodec : public FrameCodec
+{
+public:
+
+    /// 行长度的缺省上限
+    static const size_t kDefaultMaxLine = 64 * 1024;
+
+    /// 构造函数
+    /// @param  max_line    行长度(含行尾)的上限, 超过时解析出错
+    explicit LineCodec(size_t max_line = kDefaultMaxLine);
+
+    /// 从data开头解析一行
+    virtual int Decode(const char * data, size_t len, const char ** frame, size_t * frame_len);
+
+    /// 追加负载和\r\n
+    virtual void Encode(const void * data, size_t len, Buffer * output);
+
+private:
+
+    size_t  m_max_line; ///< 行长度的上限
+    size_t  m_scanned;  ///< 当前行已扫描过、不含\n的字节数
+};
+
+/// 定长头部的长度前缀分帧, 头部为1、2或4字节的网络字节序负载长度(不含头部)
+class LengthPrefixedCodec : public FrameCodec
+{
+public:
+
+    /// 帧长度的缺省上限
+    static const size_t kDefaultMaxFrame = 16 * 1024 * 1024;
+
+    /// 构造函数
+    /// @param  header_len  头部字节数: 1, 2或4
+    /// @param  max_frame   负载长度的上限, 超过时解析出错
+    explicit LengthPrefixedCodec(int header_len = 4, size_t max_frame = kDefaultMaxFrame);
+
+    /// 从data开头解析一帧
+    virtual int Decode(const char * data, size_t len, const char ** frame, size_t * frame_len);
+
+    /// 追加头部和负载, len不能超过头部能表示的长度
+    virtual void Encode(const void * data, size_t len, Buffer * output);
+
+private:
+
+    int     m_header_len; ///< 头部字节数
+    size_t  m_max_frame;  ///< 负载长度的上限
+};
+
+/// varint长度前缀分帧, 头部为LEB128编码的负载长度(同protobuf), 每字节低7位有效, 最高位表示后面还有字节
+class VarintCodec : public FrameCodec
+{
+public:
+
+    /// 帧长度的缺省上限
+    static const size_t kDefaultMaxFrame = 16 * 1024 * 1024;
+
+    /// 构造函数
+    /// @param  max_frame   负载长度的上限, 超过时解析出错
+    explicit VarintCodec(size_t max_frame = kDefaultMaxFrame);
+
+    /// 从data开头解析一帧
+    virtual int Decode(const char * data, size_t len, const char ** frame, size_t * frame_len);
+
+    /// 追加varint头部和负载
+    virtual void Encode(const void * data, size_t len, Buffer * output);
+
+private:
+
+    /// varint头部的最大字节数, 32位长度
+    static const int kMaxVarintBytes = 5;
+
+    size_t  m_max_frame; ///< 负载长度的上限
+};
+
+/// 按帧收发的TCP连接
+/// 每次读到数据后用编解码器解出所有完整的帧, 依次交给OnFrame, 帧直接指向输入缓冲区; 一次读到的多个
+/// 流水线请求在同一次回调中处理完, 不完整的帧留在缓冲区中等待后续数据. 帧格式错误时关闭连接.
+/// SendFrame编码的应答进入TcpConnection的输出链, 同一次回调中的应答仍合并成一次writev发出.
+class CodecConnection : public TcpConnection
+{
+public:
+
+    /// 构造函数
+    /// @param  reactor 连接所属的reactor
+    /// @param  handle  已连接的socket
+    /// @param  codec   编解码器, 由连接持有并在析构时删除
+    CodecConnection(Reactor * reactor, handle_t handle, FrameCodec * codec);
+
+    /// 把负载编码成一帧发送
+    void SendFrame(const void * data, size_t len);
+
+protected:
+
+    /// 析构函数, 只能通过Close销毁
+    virtual ~CodecConnection();
+
+    /// 收到一帧的回调, frame只在回调中有效
+    virtual void OnFrame(const char * frame, size_t len) = 0;
+
+    /// 收到数据: 解出所有完整的帧交给OnFrame
+    virtual void OnMessage(Buffer * input);
+
+private:
+
+    /// 编码后不超过该长度的帧复制进输出链与其他应答合并, 更长的帧整块挂到输出链上
+    static const size_t kCopyFrameSize = 4096;
+
+    FrameCodec *  m_codec;    ///< 编解码器
+    Buffer        m_encoded;  ///< 编码帧的缓冲区
+};
+} // namespace reactor
+
+#endif // _CODEC_H_
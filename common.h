@@ -2,6 +2,9 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 #include "reactor.h"
 
 #ifdef _WIN32
@@ -11,7 +14,7 @@
 #endif
 
 /// 检查句柄是否有效
-extern bool IsValidHandle(reactor::handle_t handle)
+inline bool IsValidHandle(reactor::handle_t handle)
 {
 #if defined(_WIN32)
     return handle != INVALID_SOCKET;
@@ -23,7 +26,7 @@ extern bool IsValidHandle(reactor::handle_t handle)
 }
 
 /// 反馈socket error
-extern void ReportSocketError(const char * msg)
+inline void ReportSocketError(const char * msg)
 {
 #if defined(_WIN32)
     fprintf(stderr, "%s error: %d\n", msg, WSAGetLastError());
@@ -0,0 +1,725 @@
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+#include <errno.h>
+#include <stdlib.h>
+#include <coroutine>
+#include <exception>
+#include <new>
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+#endif
+#include "reactor.h"
+#include "buffer.h"
+#include "acceptor.h"
+#include "metrics.h"
+
+/// @file   coroutine.h
+/// @brief  基于reactor的C++20协程接口
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+#if !defined(__cpp_impl_coroutine)
+#error "coroutine.h requires C++20 coroutines (-std=c++20)"
+#endif
+
+#if defined(__linux__)
+namespace reactor
+{
+/// 协程帧的内存池(只有头文件, 每线程一个)
+/// 帧按kGranularity字节分档, 每档一个空闲链表, 协程结束时帧留在本线程供下一个协程复用,
+/// 每个连接一个协程时, 连接建立和关闭不再经过malloc. 超过kMaxPooledFrame的帧直接向系统申请.
+class FramePool
+{
+public:
+
+    /// 分配size字节的协程帧
+    static void * Allocate(size_t size)
+    {
+        size_t index = (size + kGranularity - 1) / kGranularity;
+        if (index >= kClasses)
+        {
+            return ::operator new(size);
+        }
+        FreeLists & lists = Local();
+        FreeFrame * frame = lists.heads[index];
+        if (frame == NULL)
+        {
+            return ::operator new(index * kGranularity);
+        }
+        lists.heads[index] = frame->next;
+        --lists.counts[index];
+        return frame;
+    }
+
+    /// 归还size字节的协程帧
+    static void Deallocate(void * ptr, size_t size)
+    {
+        size_t index = (size + kGranularity - 1) / kGranularity;
+        if (index >= kClasses)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        FreeLists & lists = Local();
+        if (lists.counts[index] >= kMaxCached)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        FreeFrame * frame = static_cast<FreeFrame *>(ptr);
+        frame->next = lists.heads[index];
+        lists.heads[index] = frame;
+        ++lists.counts[index];
+    }
+
+private:
+
+    /// 分档的粒度
+    static const size_t kGranularity = 64;
+
+    /// 进入内存池的最大帧
+    static const size_t kMaxPooledFrame = 4096;
+
+    /// 档数, 下标为帧大小除以粒度(向上取整)
+    static const size_t kClasses = kMaxPooledFrame / kGranularity + 1;
+
+    /// 每档缓存的最大帧数, 超过的帧还给系统
+    static const size_t kMaxCached = 1024;
+
+    /// 空闲帧, 链表指针放在帧的内存中
+    struct FreeFrame
+    {
+        FreeFrame * next;
+    };
+
+    /// 一个线程的空闲链表, 线程退出时释放缓存的帧
+    struct FreeLists
+    {
+        FreeLists()
+        {
+            for (size_t idx = 0; idx < kClasses; ++idx)
+            {
+                heads[idx] = NULL;
+                counts[idx] = 0;
+            }
+        }
+
+        ~FreeLists()
+        {
+            for (size_t idx = 0; idx < kClasses; ++idx)
+            {
+                while (heads[idx] != NULL)
+                {
+                    FreeFrame * frame = heads[idx];
+                    heads[idx] = frame->next;
+                    ::operator delete(frame);
+                }
+            }
+        }
+
+        FreeFrame * heads[kClasses];  ///< 每档的空闲链表
+        size_t      counts[kClasses]; ///< 每档缓存的帧数
+    };
+
+    /// 本线程的空闲链表
+    static FreeLists & Local()
+    {
+        static thread_local FreeLists lists;
+        return lists;
+    }
+};
+
+/// 协程的返回类型: 调用即开始执行, 结束后自动销毁, 调用者不等待其结果
+/// 协程帧从FramePool分配; 协程中不能抛出异常(抛出时终止进程).
+///
+/// 用法:
+///   CoTask Session(Reactor * reactor, handle_t handle)
+///   {
+///       CoConnection conn(reactor, handle);
+///       Buffer buf(reactor->GetBufferPool());
+///       while (co_await conn.Read(&buf) > 0)
+///       {
+///           if (co_await conn.Write(&buf) < 0) break;
+///       }
+///   }
+class CoTask
+{
+public:
+
+    struct promise_type
+    {
+        CoTask get_return_object() noexcept
+        {
+            return CoTask();
+        }
+
+        std::suspend_never initial_suspend() noexcept
+        {
+            return std::suspend_never();
+        }
+
+        std::suspend_never final_suspend() noexcept
+        {
+            return std::suspend_never();
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+
+        static void * operator new(size_t size)
+        {
+            return FramePool::Allocate(size);
+        }
+
+        static void operator delete(void * ptr, size_t size)
+        {
+            FramePool::Deallocate(ptr, size);
+        }
+    };
+};
+
+/// 协程挂起等待的一次读写操作, 存放在等待者的协程帧中
+struct CoOperation
+{
+    /// 操作类型
+    enum Kind
+    {
+        kRecv,        ///< 读到data
+        kRecvBuffer,  ///< 读到buffer
+        kAccept,      ///< 接受新连接
+        kSend,        ///< 发送data的全部数据
+        kSendBuffer   ///< 发送buffer的全部数据
+    };
+
+    Kind                    kind;   ///< 操作类型
+    char *                  data;   ///< kRecv/kSend的数据
+    size_t                  len;    ///< kRecv/kSend的数据长度
+    Buffer *                buffer; ///< kRecvBuffer/kSendBuffer的缓冲区
+    size_t                  done;   ///< 已发送的字节数
+    ssize_t                 result; ///< 操作结果: 字节数或新连接的句柄, 出错时为-errno
+    std::coroutine_handle<> waiter; ///< 等待操作完成的协程
+};
+
+/// 协程使用的socket handler
+/// 操作先直接做一次系统调用, 返回EAGAIN时才挂起协程并一次性关注(oneshot)相应事件, 事件到达时
+/// 在分离器的分发循环中重做系统调用, 完成后直接恢复协程; 读和写可以各有一个协程同时等待.
+/// 由CoConnection和CoAcceptor创建和关闭, 应用不直接使用.
+class CoSocket : public EventHandler
+{
+public:
+
+    /// 构造函数
+    /// @param  reactor socket所属的reactor
+    /// @param  handle  非阻塞的socket
+    CoSocket(Reactor * reactor, handle_t handle)
+        : EventHandler(), m_reactor(reactor), m_handle(handle), m_registered(false), m_closed(false),
+          m_reader(NULL), m_writer(NULL) {}
+
+    /// 获取该handler所对应的句柄
+    virtual handle_t GetHandle() const
+    {
+        return m_handle;
+    }
+
+    /// 获取socket所属的reactor
+    Reactor * GetReactor() const
+    {
+        return m_reactor;
+    }
+
+    /// 做一次操作
+    /// @retval true    操作已完成, 结果在op->result中
+    /// @retval false   需要等待事件(EAGAIN)
+    bool Attempt(CoOperation * op)
+    {
+        if (m_closed)
+        {
+            op->result = -EPIPE;
+            return true;
+        }
+        switch (op->kind)
+        {
+        case CoOperation::kRecv:
+            return Complete(op, ::recv(m_handle, op->data, op->len, 0));
+        case CoOperation::kRecvBuffer:
+        {
+            int saved_errno = 0;
+            int n = op->buffer->ReadFd(m_handle, &saved_errno);
+            errno = saved_errno;
+            return Complete(op, n);
+        }
+        case CoOperation::kAccept:
+            return AttemptAccept(op);
+        case CoOperation::kSend:
+        case CoOperation::kSendBuffer:
+            return AttemptSend(op);
+        }
+        return true;
+    }
+
+    /// 挂起waiter, 关注op所需的事件
+    /// @retval true    已挂起
+    /// @retval false   注册出错, op->result为-EIO, 不挂起
+    bool Suspend(CoOperation * op, std::coroutine_handle<> waiter)
+    {
+        op->waiter = waiter;
+        if (op->kind == CoOperation::kSend || op->kind == CoOperation::kSendBuffer)
+        {
+            m_writer = op;
+        }
+        else
+        {
+            m_reader = op;
+        }
+        if (Arm() != 0)
+        {
+            if (m_writer == op)
+            {
+                m_writer = NULL;
+            }
+            else
+            {
+                m_reader = NULL;
+            }
+            op->result = -EIO;
+            return false;
+        }
+        return true;
+    }
+
+    /// 关闭socket, 注册过时交给reactor在本轮事件处理结束后关闭
+    /// 挂起在该socket上的协程不再被恢复, 应由使用它的协程在操作完成后关闭
+    void Close()
+    {
+        if (m_closed)
+        {
+            return;
+        }
+        m_closed = true;
+        m_reader = NULL;
+        m_writer = NULL;
+        if (m_registered)
+        {
+            m_reactor->CloseHandler(this);
+        }
+        else
+        {
+            ::close(m_handle);
+        }
+    }
+
+    /// 读事件: 重做读操作, 完成后恢复等待的协程
+    virtual void HandleRead()
+    {
+        Resume(&m_reader);
+    }
+
+    /// 写事件: 继续发送, 发完后恢复等待的协程
+    virtual void HandleWrite()
+    {
+        Resume(&m_writer);
+    }
+
+    /// 出错事件: 以错误结果恢复所有等待的协程
+    virtual void HandleError()
+    {
+        CoOperation * reader = m_reader;
+        CoOperation * writer = m_writer;
+        m_reader = NULL;
+        m_writer = NULL;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (::getsockopt(m_handle, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err == 0)
+        {
+            err = EPIPE;
+        }
+        if (reader != NULL)
+        {
+            if (!Attempt(reader))
+            {
+                reader->result = -err;
+            }
+            reader->waiter.resume();
+        }
+        if (writer != NULL)
+        {
+            if (!Attempt(writer))
+            {
+                writer->result = -err;
+            }
+            writer->waiter.resume();
+        }
+    }
+
+protected:
+
+    /// 析构函数, 只能通过Release销毁
+    virtual ~CoSocket() {}
+
+private:
+
+    /// 按系统调用的返回值设置操作结果
+    /// @retval true    操作已完成
+    /// @retval false   EAGAIN
+    bool Complete(CoOperation * op, ssize_t n)
+    {
+        if (n >= 0)
+        {
+            op->result = n;
+            return true;
+        }
+        if (errno == EINTR)
+        {
+            return Attempt(op);
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return false;
+        }
+        op->result = -errno;
+        return true;
+    }
+
+    /// 接受一个新连接, 跳过accept之前已被对端重置的连接
+    bool AttemptAccept(CoOperation * op)
+    {
+        while (true)
+        {
+            handle_t handle = ::accept4(m_handle, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (handle >= 0)
+            {
+                m_reactor->GetMetrics()->AddAccepts(1);
+                op->result = handle;
+                return true;
+            }
+            if (errno != EINTR && errno != ECONNABORTED && errno != EPROTO)
+            {
+                return Complete(op, -1);
+            }
+        }
+    }
+
+    /// 发送剩余的数据, 发完或出错时完成
+    bool AttemptSend(CoOperation * op)
+    {
+        while (true)
+        {
+            const char * data = NULL;
+            size_t left = 0;
+            if (op->kind == CoOperation::kSend)
+            {
+                data = op->data + op->done;
+                left = op->len - op->done;
+            }
+            else
+            {
+                data = op->buffer->Peek();
+                left = op->buffer->ReadableBytes();
+            }
+            if (left == 0)
+            {
+                op->result = static_cast<ssize_t>(op->done);
+                return true;
+            }
+            ssize_t n = ::send(m_handle, data, left, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    return false;
+                }
+                op->result = -errno;
+                return true;
+            }
+            op->done += static_cast<size_t>(n);
+            if (op->kind == CoOperation::kSendBuffer)
+            {
+                op->buffer->Retrieve(static_cast<size_t>(n));
+            }
+        }
+    }
+
+    /// 按等待中的操作一次性关注读写事件, 没有等待的操作时不关注
+    int Arm()
+    {
+        event_t evt = (m_reader != NULL ? kReadEvent : 0) | (m_writer != NULL ? kWriteEvent : 0);
+        if (evt == 0)
+        {
+            return 0;
+        }
+        if (m_reactor->RegisterHandler(this, evt) != 0)
+        {
+            return -1;
+        }
+        m_registered = true;
+        return 0;
+    }
+
+    /// 重做slot中等待的操作, 完成后清空slot, 重新关注另一方向的事件, 再恢复等待的协程
+    /// 协程在本函数返回前运行到下一个挂起点或结束, 之后不再访问成员
+    void Resume(CoOperation ** slot)
+    {
+        CoOperation * op = *slot;
+        if (op == NULL || !Attempt(op))
+        {
+            /// 没有等待者或仍未就绪, 一次性关注已失效, 重新关注
+            Arm();
+            return;
+        }
+        *slot = NULL;
+        Arm();
+        op->waiter.resume();
+    }
+
+    /// 禁止拷贝构造和赋值操作
+    CoSocket(const CoSocket &);
+    CoSocket & operator=(const CoSocket &);
+
+private:
+
+    Reactor *      m_reactor;    ///< 所属的reactor
+    handle_t       m_handle;     ///< socket句柄
+    bool           m_registered; ///< 是否注册过, 注册过的句柄由reactor关闭
+    bool           m_closed;     ///< 是否已关闭
+    CoOperation *  m_reader;     ///< 等待读(或accept)的操作
+    CoOperation *  m_writer;     ///< 等待写的操作
+};
+
+/// 协程读写操作的awaiter
+/// 操作能立即完成时不挂起; co_await的结果为字节数(读到0表示对端关闭)、新连接的句柄, 出错时为-errno.
+class CoIoAwaiter
+{
+public:
+
+    /// 构造函数
+    CoIoAwaiter(CoSocket * socket, CoOperation::Kind kind, char * data, size_t len, Buffer * buffer)
+        : m_socket(socket)
+    {
+        m_op.kind = kind;
+        m_op.data = data;
+        m_op.len = len;
+        m_op.buffer = buffer;
+        m_op.done = 0;
+        m_op.result = 0;
+    }
+
+    bool await_ready()
+    {
+        return m_socket->Attempt(&m_op);
+    }
+
+    bool await_suspend(std::coroutine_handle<> waiter)
+    {
+        return m_socket->Suspend(&m_op, waiter);
+    }
+
+    ssize_t await_resume() const
+    {
+        return m_op.result;
+    }
+
+private:
+
+    CoSocket *   m_socket; ///< 操作的socket
+    CoOperation  m_op;     ///< 操作, 挂起期间由m_socket引用
+};
+
+/// 协程使用的TCP连接, 析构时关闭socket
+/// 同一时刻至多一个协程读、一个协程写.
+class CoConnection
+{
+public:
+
+    /// 构造函数, 连接接管handle并把它设为非阻塞
+    /// @param  reactor 连接所属的reactor
+    /// @param  handle  已连接的socket
+    CoConnection(Reactor * reactor, handle_t handle)
+        : m_socket(new CoSocket(reactor, handle))
+    {
+        int flags = ::fcntl(handle, F_GETFL, 0);
+        if (flags >= 0 && !(flags & O_NONBLOCK))
+        {
+            ::fcntl(handle, F_SETFL, flags | O_NONBLOCK);
+        }
+    }
+
+    /// 移动构造
+    CoConnection(CoConnection && other) noexcept
+        : m_socket(other.m_socket)
+    {
+        other.m_socket = NULL;
+    }
+
+    /// 析构函数, 关闭连接
+    ~CoConnection()
+    {
+        if (m_socket != NULL)
+        {
+            m_socket->Close();
+            m_socket->Release();
+        }
+    }
+
+    /// 获取连接的句柄
+    handle_t GetHandle() const
+    {
+        return m_socket->GetHandle();
+    }
+
+    /// 读至多len字节到buf
+    /// co_await的结果: > 0 读到的字节数, = 0 对端关闭, < 0 出错(-errno)
+    CoIoAwaiter Read(void * buf, size_t len)
+    {
+        return CoIoAwaiter(m_socket, CoOperation::kRecv, static_cast<char *>(buf), len, NULL);
+    }
+
+    /// 读到缓冲区的尾部, 一次读完内核中已有的数据
+    /// co_await的结果: > 0 读到的字节数, = 0 对端关闭, < 0 出错(-errno)
+    CoIoAwaiter Read(Buffer * buf)
+    {
+        return CoIoAwaiter(m_socket, CoOperation::kRecvBuffer, NULL, 0, buf);
+    }
+
+    /// 发送buf的全部len字节, 发送缓冲区满时挂起到发完
+    /// co_await的结果: len, 出错时为-errno
+    CoIoAwaiter Write(const void * buf, size_t len)
+    {
+        return CoIoAwaiter(m_socket, CoOperation::kSend, static_cast<char *>(const_cast<void *>(buf)), len, NULL);
+    }
+
+    /// 发送缓冲区中的全部数据, 发出的数据从缓冲区中取走
+    /// co_await的结果: 发送的字节数, 出错时为-errno
+    CoIoAwaiter Write(Buffer * buf)
+    {
+        return CoIoAwaiter(m_socket, CoOperation::kSendBuffer, NULL, 0, buf);
+    }
+
+    /// 关闭连接, 之后的操作返回-EPIPE
+    void Close()
+    {
+        m_socket->Close();
+    }
+
+private:
+
+    /// 禁止拷贝构造和赋值操作
+    CoConnection(const CoConnection &);
+    CoConnection & operator=(const CoConnection &);
+
+private:
+
+    CoSocket * m_socket; ///< socket handler, 持有创建者的引用
+};
+
+/// 协程使用的监听socket, 析构时关闭
+class CoAcceptor
+{
+public:
+
+    /// 构造函数
+    /// @param  reactor  监听socket所属的reactor
+    explicit CoAcceptor(Reactor * reactor)
+        : m_reactor(reactor), m_socket(NULL) {}
+
+    /// 析构函数, 关闭监听socket
+    ~CoAcceptor()
+    {
+        if (m_socket != NULL)
+        {
+            m_socket->Close();
+            m_socket->Release();
+        }
+    }
+
+    /// 创建监听socket
+    /// @param  ip         监听的地址
+    /// @param  port       监听的端口
+    /// @param  backlog    已完成连接队列的长度
+    /// @param  reuse_port 是否设置SO_REUSEPORT, 多个事件循环各自监听同一端口时使用
+    /// @retval 0       成功
+    /// @retval < 0     出错(-errno)
+    int Listen(const char * ip, unsigned short port, int backlog = SOMAXCONN, bool reuse_port = false)
+    {
+        handle_t handle;
+        int ret = CreateListenSocket(ip, port, backlog, reuse_port, &handle);
+        if (ret == 0)
+        {
+            m_socket = new CoSocket(m_reactor, handle);
+        }
+        return ret;
+    }
+
+    /// 接受一个新连接, 没有已完成的连接时挂起, 只能在Listen成功后调用
+    /// co_await的结果: 新连接的句柄(非阻塞), 出错时为-errno(如描述符耗尽时为-EMFILE)
+    CoIoAwaiter Accept()
+    {
+        return CoIoAwaiter(m_socket, CoOperation::kAccept, NULL, 0, NULL);
+    }
+
+private:
+
+    /// 禁止拷贝构造和赋值操作
+    CoAcceptor(const CoAcceptor &);
+    CoAcceptor & operator=(const CoAcceptor &);
+
+private:
+
+    Reactor *   m_reactor; ///< 所属的reactor
+    CoSocket *  m_socket;  ///< 监听socket的handler
+};
+
+/// 协程睡眠的awaiter
+class CoSleepAwaiter
+{
+public:
+
+    /// 构造函数
+    CoSleepAwaiter(Reactor * reactor, int delay)
+        : m_reactor(reactor), m_delay(delay) {}
+
+    bool await_ready() const
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> waiter)
+    {
+        if (m_delay <= 0)
+        {
+            m_reactor->QueueInLoop([waiter]() { waiter.resume(); });
+        }
+        else
+        {
+            m_reactor->ScheduleTimer(m_delay, 0, [waiter]() { waiter.resume(); });
+        }
+    }
+
+    void await_resume() const {}
+
+private:
+
+    Reactor *  m_reactor; ///< 定时器所在的reactor
+    int        m_delay;   ///< 睡眠时间(毫秒)
+};
+
+/// 挂起协程delay毫秒, 由reactor的定时器恢复; delay不大于0时让出到本轮事件处理之后
+/// 只能在reactor的事件循环线程中使用
+inline CoSleepAwaiter Sleep(Reactor * reactor, int delay)
+{
+    return CoSleepAwaiter(reactor, delay);
+}
+} // namespace reactor
+#endif // __linux__
+
+#endif // _COROUTINE_H_
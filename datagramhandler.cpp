@@ -0,0 +1,497 @@
+#include <errno.h>
+#include <string.h>
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <netinet/in.h>
+    #include <netinet/udp.h>
+    #include <arpa/inet.h>
+#endif
+#include "datagramhandler.h"
+
+/// @file   datagramhandler.cpp
+/// @brief  UDP socket, 用recvmmsg/sendmmsg批量收发数据报, 可选UDP_GRO/UDP_SEGMENT
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+#if defined(__linux__)
+/// 较旧的glibc头文件中没有UDP分段卸载的定义(linux 4.18, 5.0)
+#if !defined(SOL_UDP)
+    #define SOL_UDP 17
+#endif
+#if !defined(UDP_SEGMENT)
+    #define UDP_SEGMENT 103
+#endif
+#if !defined(UDP_GRO)
+    #define UDP_GRO 104
+#endif
+
+namespace reactor
+{
+/// 创建非阻塞的UDP socket并绑定地址
+/// @param  ip         绑定的地址
+/// @param  port       绑定的端口
+/// @param  reuse_port 是否设置SO_REUSEPORT
+/// @param  handle     创建的socket
+/// @retval 0       成功
+/// @retval < 0     出错(-errno)
+int CreateDatagramSocket(const char * ip, unsigned short port, bool reuse_port, handle_t * handle)
+{
+    handle_t sock = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return -errno;
+    }
+    int on = 1;
+    ::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuse_port && ::setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+    {
+        int ret = -errno;
+        ::close(sock);
+        return ret;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip);
+    if (::bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        int ret = -errno;
+        ::close(sock);
+        return ret;
+    }
+    *handle = sock;
+    return 0;
+}
+
+/// 构造函数
+/// @param  reactor     所属的reactor
+/// @param  handle      UDP socket, 可以已connect
+/// @param  batch       每次recvmmsg/sendmmsg最多的消息数
+/// @param  slot_size   每个接收槽的长度, 即可接收的最大数据报
+DatagramHandler::DatagramHandler(Reactor * reactor, handle_t handle, int batch, size_t slot_size)
+    : EventHandler(), m_reactor(reactor), m_handle(handle), m_state(kOpen), m_in_callback(false),
+      m_writing(false), m_gro(false), m_gso_segment(0), m_batch(batch > 0 ? batch : 1), m_slot_size(0),
+      m_send_head(0)
+{
+    m_recv_addrs.resize(m_batch);
+    m_recv_control.resize(m_batch);
+    m_recv_iovs.resize(m_batch);
+    m_recv_hdrs.resize(m_batch);
+    m_send_control.resize(m_batch);
+    m_send_iovs.resize(m_batch);
+    m_send_hdrs.resize(m_batch);
+    AllocateSlots(slot_size > 0 ? slot_size : kDefaultSlotSize);
+}
+
+/// 析构函数, 只能通过Close销毁
+DatagramHandler::~DatagramHandler()
+{
+}
+
+/// 获取该handler所对应的句柄
+handle_t DatagramHandler::GetHandle() const
+{
+    return m_handle;
+}
+
+/// 获取所属的reactor
+Reactor * DatagramHandler::GetReactor() const
+{
+    return m_reactor;
+}
+
+/// 把socket设为非阻塞并开始关注读事件
+/// @retval 0       成功
+/// @retval < 0     注册出错
+int DatagramHandler::Start()
+{
+    int flags = ::fcntl(m_handle, F_GETFL, 0);
+    ::fcntl(m_handle, F_SETFL, flags | O_NONBLOCK);
+    return m_reactor->RegisterHandler(this, kReadEvent | kPersistEvent);
+}
+
+/// 开启UDP_GRO, 接收槽扩大到合并后报文的上限
+/// @retval 0       成功
+/// @retval < 0     出错(-errno), 在回调中调用时为-EBUSY
+int DatagramHandler::EnableGro()
+{
+    /// 回调中的data指向接收槽, 重新分配会使之失效
+    if (m_in_callback)
+    {
+        return -EBUSY;
+    }
+    int on = 1;
+    if (::setsockopt(m_handle, SOL_UDP, UDP_GRO, &on, sizeof(on)) != 0)
+    {
+        return -errno;
+    }
+    m_gro = true;
+    if (m_slot_size < kGroSlotSize)
+    {
+        AllocateSlots(kGroSlotSize);
+    }
+    return 0;
+}
+
+/// 开启UDP_SEGMENT
+/// 分段长度随每条消息的控制消息传入, 这里设0只是检查内核是否支持
+/// @param  segment_size    可合并的应答长度上限
+/// @retval 0       成功
+/// @retval < 0     出错(-errno)
+int DatagramHandler::EnableGso(size_t segment_size)
+{
+    int off = 0;
+    if (::setsockopt(m_handle, SOL_UDP, UDP_SEGMENT, &off, sizeof(off)) != 0)
+    {
+        return -errno;
+    }
+    m_gso_segment = segment_size;
+    return 0;
+}
+
+/// 向addr发送一个数据报, 数据被复制进发送队列; 回调中的发送在回调结束后合并发出
+/// @retval 0       成功放入发送队列
+/// @retval < 0     出错: 已关闭时为-EPIPE, 发送队列超过上限时为-ENOBUFS, 地址过长为-EINVAL
+int DatagramHandler::SendTo(const void * data, size_t len, const sockaddr * addr, socklen_t addrlen)
+{
+    if (m_state != kOpen)
+    {
+        return -EPIPE;
+    }
+    if (addr == NULL)
+    {
+        addrlen = 0;
+    }
+    if (addrlen > sizeof(sockaddr_storage))
+    {
+        return -EINVAL;
+    }
+    if (QueuedBytes() + len > kMaxQueuedBytes)
+    {
+        return -ENOBUFS;
+    }
+    size_t offset = m_send_data.size();
+    m_send_data.insert(m_send_data.end(), static_cast<const char *>(data), static_cast<const char *>(data) + len);
+    if (CanCoalesce(len, addr, addrlen))
+    {
+        /// 同一对端的等长应答接在上一条消息后面, 作为它的一个GSO分段
+        OutgoingMessage & last = m_outgoing.back();
+        if (last.segment == 0)
+        {
+            last.segment = last.len;
+        }
+        last.len += len;
+    }
+    else
+    {
+        m_outgoing.push_back(OutgoingMessage());
+        OutgoingMessage & message = m_outgoing.back();
+        message.offset = offset;
+        message.len = len;
+        message.segment = 0;
+        message.addrlen = addrlen;
+        if (addrlen > 0)
+        {
+            memcpy(&message.addr, addr, addrlen);
+        }
+    }
+    /// 回调中的发送留到回调结束时合并发出
+    if (!m_in_callback && !m_writing)
+    {
+        Flush();
+    }
+    return 0;
+}
+
+/// 在已connect的socket上发送一个数据报
+int DatagramHandler::Send(const void * data, size_t len)
+{
+    return SendTo(data, len, NULL, 0);
+}
+
+/// 关闭socket, 先尽量发出发送队列; 在回调中调用时在回调结束后关闭
+void DatagramHandler::Close()
+{
+    if (m_state != kOpen)
+    {
+        return;
+    }
+    m_state = kClosing;
+    if (!m_in_callback)
+    {
+        Destroy();
+    }
+}
+
+/// 发送队列中的字节数
+size_t DatagramHandler::QueuedBytes() const
+{
+    if (m_send_head == m_outgoing.size())
+    {
+        return 0;
+    }
+    return m_send_data.size() - m_outgoing[m_send_head].offset;
+}
+
+/// 是否已关闭
+bool DatagramHandler::IsClosed() const
+{
+    return m_state != kOpen;
+}
+
+/// 关闭后的回调, 缺省释放创建者的引用
+void DatagramHandler::OnClose()
+{
+    Release();
+}
+
+/// socket出错的回调, 缺省什么也不做
+void DatagramHandler::OnError(int /*error*/)
+{
+}
+
+/// 读事件: 批量接收并交给OnDatagram
+/// 一批没有收满说明已经读空, 否则继续收, 最多kMaxReadRounds批
+void DatagramHandler::HandleRead()
+{
+    m_in_callback = true;
+    for (int round = 0; round < kMaxReadRounds && m_state == kOpen; ++round)
+    {
+        /// 内核会改写地址和控制消息的长度, 每次接收前重新设置
+        for (int idx = 0; idx < m_batch; ++idx)
+        {
+            msghdr & hdr = m_recv_hdrs[idx].msg_hdr;
+            hdr.msg_namelen = sizeof(sockaddr_storage);
+            hdr.msg_controllen = m_gro ? sizeof(ControlBuffer) : 0;
+            hdr.msg_flags = 0;
+        }
+        int num = ::recvmmsg(m_handle, &m_recv_hdrs[0], m_batch, MSG_DONTWAIT, NULL);
+        if (num < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                /// 已connect的socket会在这里取到ICMP错误, socket仍可继续使用
+                OnError(errno);
+            }
+            break;
+        }
+        for (int idx = 0; idx < num && m_state == kOpen; ++idx)
+        {
+            DeliverSlot(idx);
+        }
+        if (num < m_batch)
+        {
+            break;
+        }
+    }
+    m_in_callback = false;
+    if (m_state == kClosing)
+    {
+        Destroy();
+        return;
+    }
+    if (m_send_head < m_outgoing.size() && !m_writing)
+    {
+        Flush();
+    }
+}
+
+/// 写事件: 继续发送发送队列
+void DatagramHandler::HandleWrite()
+{
+    Flush();
+}
+
+/// 出错事件: 取出socket错误交给OnError, UDP socket出错后仍可继续使用
+/// 不取出错误的话, 水平触发下会一直报告出错
+void DatagramHandler::HandleError()
+{
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (::getsockopt(m_handle, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error != 0)
+    {
+        m_in_callback = true;
+        OnError(error);
+        m_in_callback = false;
+        if (m_state == kClosing)
+        {
+            Destroy();
+        }
+    }
+}
+
+/// 按槽的长度分配接收槽环, 并设置各槽的iovec和msghdr
+void DatagramHandler::AllocateSlots(size_t slot_size)
+{
+    m_slot_size = slot_size;
+    std::vector<char>(m_batch * m_slot_size).swap(m_slots);
+    for (int idx = 0; idx < m_batch; ++idx)
+    {
+        m_recv_iovs[idx].iov_base = &m_slots[idx * m_slot_size];
+        m_recv_iovs[idx].iov_len = m_slot_size;
+        msghdr & hdr = m_recv_hdrs[idx].msg_hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &m_recv_addrs[idx];
+        hdr.msg_namelen = sizeof(sockaddr_storage);
+        hdr.msg_iov = &m_recv_iovs[idx];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = m_recv_control[idx].buf;
+    }
+}
+
+/// 把第idx个接收槽中的数据交给OnDatagram, GRO合并的报文按分段拆开
+void DatagramHandler::DeliverSlot(int idx)
+{
+    msghdr & hdr = m_recv_hdrs[idx].msg_hdr;
+    if (hdr.msg_flags & MSG_TRUNC)
+    {
+        /// 数据报超过接收槽的长度, 只收到了前一部分, 丢弃
+        return;
+    }
+    const char * data = &m_slots[idx * m_slot_size];
+    size_t len = m_recv_hdrs[idx].msg_len;
+    const sockaddr * addr = static_cast<const sockaddr *>(hdr.msg_name);
+    size_t segment = len;
+    if (m_gro)
+    {
+        for (cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+                int gso_size = 0;
+                memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+                if (gso_size > 0)
+                {
+                    segment = static_cast<size_t>(gso_size);
+                }
+            }
+        }
+    }
+    /// 空数据报也要交付一次
+    size_t offset = 0;
+    do
+    {
+        size_t part = len - offset < segment ? len - offset : segment;
+        OnDatagram(data + offset, part, addr, hdr.msg_namelen);
+        offset += part;
+    } while (offset < len && m_state == kOpen);
+}
+
+/// 能否把len字节发往addr的应答合并进发送队列的最后一条消息
+/// GSO要求除最后一段外各段等长, 最后一段可以较短, 之后不能再接
+bool DatagramHandler::CanCoalesce(size_t len, const sockaddr * addr, socklen_t addrlen) const
+{
+    if (m_gso_segment == 0 || len == 0 || m_send_head == m_outgoing.size())
+    {
+        return false;
+    }
+    const OutgoingMessage & last = m_outgoing.back();
+    size_t segment = last.segment != 0 ? last.segment : last.len;
+    if (segment == 0 || segment > m_gso_segment || len > segment || last.len % segment != 0 ||
+            last.len / segment >= kMaxGsoSegments || last.len + len > kMaxGsoBytes)
+    {
+        return false;
+    }
+    return last.addrlen == addrlen && (addrlen == 0 || memcmp(&last.addr, addr, addrlen) == 0);
+}
+
+/// 用sendmmsg发送发送队列, 并按是否发完更新写事件的关注
+/// 单条消息出错(如超过MTU、已connect的socket收到ICMP错误)时丢弃它, 继续发送后面的消息
+void DatagramHandler::Flush()
+{
+    while (m_send_head < m_outgoing.size())
+    {
+        int num = 0;
+        for (size_t idx = m_send_head; idx < m_outgoing.size() && num < m_batch; ++idx, ++num)
+        {
+            OutgoingMessage & message = m_outgoing[idx];
+            m_send_iovs[num].iov_base = m_send_data.data() + message.offset;
+            m_send_iovs[num].iov_len = message.len;
+            msghdr & hdr = m_send_hdrs[num].msg_hdr;
+            memset(&hdr, 0, sizeof(hdr));
+            hdr.msg_name = message.addrlen > 0 ? &message.addr : NULL;
+            hdr.msg_namelen = message.addrlen;
+            hdr.msg_iov = &m_send_iovs[num];
+            hdr.msg_iovlen = 1;
+            if (message.segment != 0 && message.len > message.segment)
+            {
+                hdr.msg_control = m_send_control[num].buf;
+                hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment = static_cast<uint16_t>(message.segment);
+                memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+            }
+        }
+        int sent = ::sendmmsg(m_handle, &m_send_hdrs[0], num, MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            if (errno != EINTR)
+            {
+                ++m_send_head;
+            }
+            continue;
+        }
+        m_send_head += sent;
+    }
+    if (m_send_head == m_outgoing.size())
+    {
+        /// 发完后清空队列, 保留容量
+        m_outgoing.clear();
+        m_send_data.clear();
+        m_send_head = 0;
+    }
+    else if (m_send_head > 0)
+    {
+        /// 发送缓冲区满, 去掉已发出的部分, 队列不会因为一直发不完而增长
+        size_t sent_bytes = m_outgoing[m_send_head].offset;
+        m_send_data.erase(m_send_data.begin(), m_send_data.begin() + sent_bytes);
+        m_outgoing.erase(m_outgoing.begin(), m_outgoing.begin() + m_send_head);
+        for (size_t idx = 0; idx < m_outgoing.size(); ++idx)
+        {
+            m_outgoing[idx].offset -= sent_bytes;
+        }
+        m_send_head = 0;
+    }
+    bool writing = m_send_head < m_outgoing.size();
+    if (writing != m_writing && m_state != kClosed)
+    {
+        m_writing = writing;
+        UpdateInterest();
+    }
+}
+
+/// 按是否有待发送数据更新关注的事件
+void DatagramHandler::UpdateInterest()
+{
+    m_reactor->RegisterHandler(this, kReadEvent | kPersistEvent | (m_writing ? kWriteEvent : 0));
+}
+
+/// 撤销注册, 交给reactor延迟关闭socket并回调OnClose
+void DatagramHandler::Destroy()
+{
+    if (m_state == kClosed)
+    {
+        return;
+    }
+    if (m_send_head < m_outgoing.size())
+    {
+        /// 尽量发出剩余的数据报, 发不完的丢弃
+        Flush();
+    }
+    m_state = kClosed;
+    /// socket在本轮事件处理结束时关闭, reactor持有的引用保证本轮中handler不被销毁
+    m_reactor->CloseHandler(this);
+    OnClose();
+}
+} // namespace reactor
+#endif // __linux__
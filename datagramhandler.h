@@ -0,0 +1,220 @@
+#ifndef _DATAGRAM_HANDLER_H_
+#define _DATAGRAM_HANDLER_H_
+
+#include <vector>
+#if defined(__linux__)
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+#endif
+#include "reactor.h"
+
+/// @file   datagramhandler.h
+/// @brief  UDP socket, 用recvmmsg/sendmmsg批量收发数据报, 可选UDP_GRO/UDP_SEGMENT
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+#if defined(__linux__)
+namespace reactor
+{
+/// 创建非阻塞的UDP socket并绑定地址
+/// @param  ip         绑定的地址
+/// @param  port       绑定的端口
+/// @param  reuse_port 是否设置SO_REUSEPORT, 多个事件循环各自绑定同一端口时使用
+/// @param  handle     创建的socket
+/// @retval 0       成功
+/// @retval < 0     出错(-errno)
+int CreateDatagramSocket(const char * ip, unsigned short port, bool reuse_port, handle_t * handle);
+
+/// UDP数据报处理器
+/// 读事件持续关注, 每次用recvmmsg把一批数据报收进预先分配的接收槽环中, 逐个交给OnDatagram, 一次读事件最多
+/// 收kMaxReadRounds批. SendTo只把应答复制进发送队列, 在本次回调结束时用sendmmsg一次发出; 发送缓冲区满时
+/// 等写事件再发, 队列超过上限时丢弃新的应答(UDP本身不保证送达).
+/// EnableGro后内核把同一对端连续的数据报合并成一个大报文交付, 按分段长度拆开后仍逐个交给OnDatagram;
+/// EnableGso后发往同一对端的等长应答合并成一条带UDP_SEGMENT的消息, 由内核(或网卡)分段.
+/// 子类实现OnDatagram, 缺省在关闭后释放自身的引用.
+class DatagramHandler : public EventHandler
+{
+public:
+
+    /// 每次recvmmsg/sendmmsg的缺省消息数
+    static const int kDefaultBatchSize = 64;
+
+    /// 接收槽的缺省长度, 超过的数据报被截断而丢弃
+    static const size_t kDefaultSlotSize = 2048;
+
+    /// GSO分段长度的缺省上限: 1500字节的MTU减去IPv6和UDP头部
+    static const size_t kDefaultGsoSegmentSize = 1452;
+
+    /// 发送队列的字节数上限, 超过时丢弃新的应答
+    static const size_t kMaxQueuedBytes = 4 * 1024 * 1024;
+
+    /// 构造函数
+    /// @param  reactor     所属的reactor
+    /// @param  handle      UDP socket, 可以已connect
+    /// @param  batch       每次recvmmsg/sendmmsg最多的消息数
+    /// @param  slot_size   每个接收槽的长度, 即可接收的最大数据报
+    DatagramHandler(Reactor * reactor, handle_t handle, int batch = kDefaultBatchSize,
+                    size_t slot_size = kDefaultSlotSize);
+
+    /// 获取该handler所对应的句柄
+    virtual handle_t GetHandle() const;
+
+    /// 获取所属的reactor
+    Reactor * GetReactor() const;
+
+    /// 把socket设为非阻塞并开始关注读事件
+    /// @retval 0       成功
+    /// @retval < 0     注册出错
+    int Start();
+
+    /// 开启UDP_GRO: 内核把同一对端连续的数据报合并交付, 一次recvmmsg取回更多数据报
+    /// 合并后的报文最长64K, 接收槽随之扩大到64K(内存为批量数 * 64K).
+    /// 重新分配接收槽会使正在处理的数据报失效, 不能在回调(如OnDatagram)中调用, 应在Start前开启
+    /// @retval 0       成功
+    /// @retval < 0     出错(-errno), 内核早于5.0时为-ENOPROTOOPT, 在回调中调用时为-EBUSY
+    int EnableGro();
+
+    /// 开启UDP_SEGMENT: 发往同一对端、不超过segment_size的连续等长应答合并成一条消息
+    /// 最后一段可以较短; 分段长度加上头部不能超过路径MTU, 否则整条消息被丢弃
+    /// @param  segment_size    可合并的应答长度上限
+    /// @retval 0       成功
+    /// @retval < 0     出错(-errno), 内核早于4.18时为-ENOPROTOOPT
+    int EnableGso(size_t segment_size = kDefaultGsoSegmentSize);
+
+    /// 向addr发送一个数据报, 数据被复制进发送队列; 回调中的发送在回调结束后合并发出
+    /// @param  data    数据
+    /// @param  len     数据长度
+    /// @param  addr    对端地址, 已connect的socket可为NULL
+    /// @param  addrlen 对端地址长度
+    /// @retval 0       成功放入发送队列
+    /// @retval < 0     出错: 已关闭时为-EPIPE, 发送队列超过上限时为-ENOBUFS, 地址过长为-EINVAL
+    int SendTo(const void * data, size_t len, const sockaddr * addr, socklen_t addrlen);
+
+    /// 在已connect的socket上发送一个数据报
+    int Send(const void * data, size_t len);
+
+    /// 关闭socket, 先尽量发出发送队列; 在回调中调用时在回调结束后关闭
+    void Close();
+
+    /// 发送队列中的字节数
+    size_t QueuedBytes() const;
+
+    /// 是否已关闭
+    bool IsClosed() const;
+
+protected:
+
+    /// 析构函数, 只能通过Close销毁
+    virtual ~DatagramHandler();
+
+    /// 收到一个数据报的回调, data和addr只在回调中有效
+    /// @param  data    数据报
+    /// @param  len     数据报长度
+    /// @param  addr    对端地址
+    /// @param  addrlen 对端地址长度
+    virtual void OnDatagram(const char * data, size_t len, const sockaddr * addr, socklen_t addrlen) = 0;
+
+    /// 关闭后的回调, 缺省释放创建者的引用(reactor的引用释放后销毁)
+    virtual void OnClose();
+
+    /// socket出错的回调(如已connect的socket收到ICMP端口不可达), 错误已被取出; 缺省什么也不做
+    /// @param  error   错误码(errno)
+    virtual void OnError(int error);
+
+    /// 读事件: 批量接收并交给OnDatagram
+    virtual void HandleRead();
+
+    /// 写事件: 继续发送发送队列
+    virtual void HandleWrite();
+
+    /// 出错事件: 取出socket错误交给OnError, UDP socket出错后仍可继续使用
+    virtual void HandleError();
+
+private:
+
+    /// 一次读事件最多recvmmsg的批数, 之后让出给其他句柄, 剩余的数据报下一轮再收
+    static const int kMaxReadRounds = 16;
+
+    /// UDP_GRO合并后的报文长度上限, 也是开启GRO后接收槽的长度
+    static const size_t kGroSlotSize = 65536;
+
+    /// 一条GSO消息最多的分段数(内核的UDP_MAX_SEGMENTS)
+    static const size_t kMaxGsoSegments = 64;
+
+    /// 一条GSO消息的字节数上限: IPv4报文长度上限减去IP和UDP头部
+    static const size_t kMaxGsoBytes = 65507;
+
+    /// 控制消息缓冲区, 容纳一个UDP_GRO(int)或UDP_SEGMENT(uint16_t)
+    union ControlBuffer
+    {
+        char     buf[CMSG_SPACE(sizeof(int))];
+        cmsghdr  align;
+    };
+
+    /// 发送队列中的一条消息
+    struct OutgoingMessage
+    {
+        size_t            offset;   ///< 数据在m_send_data中的偏移
+        size_t            len;      ///< 数据长度, GSO合并时为各段之和
+        size_t            segment;  ///< GSO分段长度, 0表示单个数据报
+        socklen_t         addrlen;  ///< 对端地址长度, 0表示已connect的socket
+        sockaddr_storage  addr;     ///< 对端地址
+    };
+
+    /// 按槽的长度分配接收槽环, 并设置各槽的iovec和msghdr
+    void AllocateSlots(size_t slot_size);
+
+    /// 把第idx个接收槽中的数据交给OnDatagram, GRO合并的报文按分段拆开
+    void DeliverSlot(int idx);
+
+    /// 能否把len字节发往addr的应答合并进发送队列的最后一条消息
+    bool CanCoalesce(size_t len, const sockaddr * addr, socklen_t addrlen) const;
+
+    /// 用sendmmsg发送发送队列, 并按是否发完更新写事件的关注
+    void Flush();
+
+    /// 按是否有待发送数据更新关注的事件
+    void UpdateInterest();
+
+    /// 撤销注册, 交给reactor延迟关闭socket并回调OnClose
+    void Destroy();
+
+    /// 禁止拷贝构造和赋值操作
+    DatagramHandler(const DatagramHandler &);
+    DatagramHandler & operator=(const DatagramHandler &);
+
+private:
+
+    /// 状态
+    enum State
+    {
+        kOpen,      ///< 正常收发
+        kClosing,   ///< 回调中请求了关闭, 回调结束后关闭
+        kClosed     ///< 已关闭
+    };
+
+    Reactor *                      m_reactor;      ///< 所属的reactor
+    handle_t                       m_handle;       ///< UDP socket
+    State                          m_state;        ///< 状态
+    bool                           m_in_callback;  ///< 是否正在事件回调中
+    bool                           m_writing;      ///< 是否关注了写事件
+    bool                           m_gro;          ///< 是否开启了UDP_GRO
+    size_t                         m_gso_segment;  ///< 可合并的应答长度上限, 0表示不用GSO
+    int                            m_batch;        ///< 每次recvmmsg/sendmmsg最多的消息数
+    size_t                         m_slot_size;    ///< 接收槽的长度
+    std::vector<char>              m_slots;        ///< 接收槽环, m_batch个槽连续存放
+    std::vector<sockaddr_storage>  m_recv_addrs;   ///< 各接收槽的对端地址
+    std::vector<ControlBuffer>     m_recv_control; ///< 各接收槽的控制消息(GRO分段长度)
+    std::vector<iovec>             m_recv_iovs;    ///< 各接收槽的iovec
+    std::vector<mmsghdr>           m_recv_hdrs;    ///< recvmmsg的消息数组
+    std::vector<char>              m_send_data;    ///< 发送队列的数据, 各消息依次存放
+    std::vector<OutgoingMessage>   m_outgoing;     ///< 发送队列
+    size_t                         m_send_head;    ///< 发送队列中第一条未发出的消息
+    std::vector<ControlBuffer>     m_send_control; ///< sendmmsg各消息的控制消息(GSO分段长度)
+    std::vector<iovec>             m_send_iovs;    ///< sendmmsg各消息的iovec
+    std::vector<mmsghdr>           m_send_hdrs;    ///< sendmmsg的消息数组
+};
+} // namespace reactor
+#endif // __linux__
+
+#endif // _DATAGRAM_HANDLER_H_
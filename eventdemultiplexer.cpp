@@ -1,7 +1,7 @@
 
 #include <errno.h>
 #include <assert.h>
-#include <vector>
+#include <string.h>
 #include "eventdemultiplexer.h"
 
 /// @file   event_demultiplexer.cpp
@@ -13,8 +13,9 @@ namespace reactor
 {
 #if defined(_WIN32)
 //#pragma comment(lib, "Ws2_32.lib")
+#endif
 /// 构造函数
-SelectDemultiplexer::SelectDemultiplexer()
+SelectDemultiplexer::SelectDemultiplexer() : m_max_fd(-1)
 {
     this->Clear();
 }
@@ -25,42 +26,76 @@ SelectDemultiplexer::SelectDemultiplexer()
 /// @retval = 0   没有发生事件的句柄(超时)
 /// @retval > 0   发生事件的句柄个数
 /// @retval < 0   发生错误
-int SelectDemultiplexer::WaitEvents(std::map<handle_t, EventHandler *> * handlers, int timeout)
+int SelectDemultiplexer::WaitEvents(HandlerTable * handlers, int timeout)
 {
-    /// 设置超时时间
-    m_timeout.tv_sec = timeout / 1000;
-    m_timeout.tv_usec = timeout % 1000 * 1000;
-    int max_fd = handlers->rbegin()->first;
-    int ret = select(max_fd + 1, &m_read_set, &m_write_set, &m_except_set, &m_timeout);
+    /// select会改写传入的集合, 每次从登记的集合复制一份
+    fd_set read_set = m_read_set;
+    fd_set write_set = m_write_set;
+    fd_set except_set = m_except_set;
+    timeval tv;
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = timeout % 1000 * 1000;
+    DispatchTimer timer(m_metrics);
+    int ret = select(m_max_fd + 1, &read_set, &write_set, &except_set, timeout < 0 ? NULL : &tv);
+    timer.Waited(ret);
     if (ret <= 0)
     {
+#if defined(__linux__)
+        return ret < 0 ? -errno : 0;
+#else
         return ret;
+#endif
+    }
+    /// 遍历登记的句柄, 查看是否有事件发生
+    size_t end = static_cast<size_t>(m_max_fd + 1);
+    if (end > handlers->Size())
+    {
+        end = handlers->Size();
     }
-    /// 遍历注册的事件表, 查看是否有事件发生
-    std::map<handle_t, EventHandler *>::iterator it = handlers->begin();
-    while (it != handlers->end())
+    for (size_t idx = 0; idx < end; ++idx)
     {
-        if (FD_ISSET(it->first, &m_except_set))
+        handle_t handle = static_cast<handle_t>(idx);
+        bool readable = FD_ISSET(handle, &read_set) != 0;
+        bool writable = FD_ISSET(handle, &write_set) != 0;
+        bool error = FD_ISSET(handle, &except_set) != 0;
+        if (!readable && !writable && !error)
+        {
+            continue;
+        }
+        HandlerSlot * slot = handlers->Find(handle);
+        if (slot == NULL)
         {
-            it->second->HandleError();
-            FD_CLR(it->first, &m_read_set);
-            FD_CLR(it->first, &m_write_set);
+            /// 本轮中已被移除
+            continue;
+        }
+        uint32_t generation = slot->generation;
+        if (!(slot->interest & (kPersistEvent | kEdgeTriggered)))
+        {
+            /// 一次性关注: 触发后撤销, 等handler重新注册
+            FD_CLR(handle, &m_read_set);
+            FD_CLR(handle, &m_write_set);
+        }
+        if (error)
+        {
+            slot->handler->HandleError();
         }
         else
         {
-            if (FD_ISSET(it->first, &m_read_set))
+            if (readable)
             {
-                it->second->HandleRead();
-                FD_CLR(it->first, &m_read_set);
+                slot->handler->HandleRead();
             }
-            if (FD_ISSET(it->first, &m_write_set))
+            /// 读回调中可能移除了handler, 登记表也可能已扩容
+            if (writable)
             {
-                it->second->HandleWrite();
-                FD_CLR(it->first, &m_write_set);
+                slot = handlers->Find(handle);
+                if (slot != NULL && slot->generation == generation)
+                {
+                    slot->handler->HandleWrite();
+                }
             }
         }
-        FD_CLR(it->first, &m_except_set);
-        ++it;
+        timer.Dispatched();
     }
     return ret;
 }
@@ -68,8 +103,17 @@ int SelectDemultiplexer::WaitEvents(std::map<handle_t, EventHandler *> * handler
 /// 设置句柄handle关注evt事件
 /// @retval = 0 设置成功
 /// @retval < 0 设置出错
-int SelectDemultiplexer::RequestEvent(handle_t handle, event_t evt)
+int SelectDemultiplexer::RequestEvent(handle_t handle, event_t evt, const HandlerSlot & /*slot*/)
 {
+#if defined(__linux__)
+    if (handle < 0 || handle >= FD_SETSIZE)
+    {
+        return -EINVAL;
+    }
+#endif
+    /// 关注的事件可能减少, 先清除旧的设置
+    FD_CLR(handle, &m_read_set);
+    FD_CLR(handle, &m_write_set);
     if (evt & kReadEvent)
     {
         FD_SET(handle, &m_read_set);
@@ -79,6 +123,10 @@ int SelectDemultiplexer::RequestEvent(handle_t handle, event_t evt)
         FD_SET(handle, &m_write_set);
     }
     FD_SET(handle, &m_except_set);
+    if (static_cast<int>(handle) > m_max_fd)
+    {
+        m_max_fd = static_cast<int>(handle);
+    }
     return 0;
 }
 
@@ -87,9 +135,20 @@ int SelectDemultiplexer::RequestEvent(handle_t handle, event_t evt)
 /// @retval < 0 撤销出错
 int SelectDemultiplexer::UnrequestEvent(handle_t handle)
 {
+#if defined(__linux__)
+    if (handle < 0 || handle >= FD_SETSIZE)
+    {
+        return -EINVAL;
+    }
+#endif
     FD_CLR(handle, &m_read_set);
     FD_CLR(handle, &m_write_set);
     FD_CLR(handle, &m_except_set);
+    /// 登记的句柄都在意外集合中, 据此回退最大句柄
+    while (m_max_fd >= 0 && !FD_ISSET(static_cast<handle_t>(m_max_fd), &m_except_set))
+    {
+        --m_max_fd;
+    }
     return 0;
 }
 
@@ -100,105 +159,8 @@ void SelectDemultiplexer::Clear()
     FD_ZERO(&m_write_set);
     FD_ZERO(&m_except_set);
 }
-#elif defined(__linux__)
-/// 构造函数
-EpollDemultiplexer::EpollDemultiplexer()
-{
-    m_epoll_fd = ::epoll_create(FD_SETSIZE);
-    assert(m_epoll_fd != -1);
-    m_fd_num = 0;
-}
-
-/// 析构函数
-EpollDemultiplexer::~EpollDemultiplexer()
-{
-    ::close(m_epoll_fd);
-}
-
-/// 获取有事件发生的所有句柄以及所发生的事件
-/// @param  events  获取的事件
-/// @param  timeout 超时时间
-/// @retval = 0   没有发生事件的句柄(超时)
-/// @retval > 0   发生事件的句柄个数
-/// @retval < 0   发生错误
-int EpollDemultiplexer::WaitEvents(std::map<handle_t, EventHandler *> * handlers, int timeout)
-{
-    std::vector<epoll_event> ep_evts(m_fd_num);
-    int num = epoll_wait(m_epoll_fd, &ep_evts[0], ep_evts.size(), timeout);
-    if (num > 0)
-    {
-        for (int idx = 0; idx < num; ++idx)
-        {
-            handle_t handle = ep_evts[idx].data.fd;
-            assert(handlers->find(handle) != handlers->end());
-            if ((ep_evts[idx].events & EPOLLERR) ||
-                    (ep_evts[idx].events & EPOLLHUP))
-            {
-                (*handlers)[handle]->HandleError();
-            }
-            else
-            {
-                if (ep_evts[idx].events & EPOLLIN)
-                {
-                    (*handlers)[handle]->HandleRead();
-                }
-                if (ep_evts[idx].events & EPOLLOUT)
-                {
-                    (*handlers)[handle]->HandleWrite();
-                }
-            }
-        }
-    }
-    return num;
-}
-
-/// 设置句柄handle关注evt事件
-/// @retval = 0 设置成功
-/// @retval < 0 设置出错
-int EpollDemultiplexer::RequestEvent(handle_t handle, event_t evt)
-{
-    epoll_event ep_evt;
-    ep_evt.data.fd = handle;
-    ep_evt.events = 0;
 
-    if (evt & kReadEvent)
-    {
-        ep_evt.events |= EPOLLIN;
-    }
-    if (evt & kWriteEvent)
-    {
-        ep_evt.events |= EPOLLOUT;
-    }
-    ep_evt.events |= EPOLLONESHOT;
-
-    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, handle, &ep_evt) != 0)
-    {
-        if (errno == ENOENT)
-        {
-            if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, handle, &ep_evt) != 0)
-            {
-                return -errno;
-            }
-            ++m_fd_num;
-        }
-    }
-    return 0;
-}
-
-/// 撤销句柄handle对事件evt的关注
-/// @retval = 0 撤销成功
-/// @retval < 0 撤销出错
-int EpollDemultiplexer::UnrequestEvent(handle_t handle)
-{
-    epoll_event ep_evt;
-    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, handle, &ep_evt) != 0)
-    {
-        return -errno;
-    }
-    --m_fd_num;
-    return 0;
-}
-#else
+#if !defined(_WIN32) && !defined(__linux__)
 #error "failure"
-#endif // _WIN32
+#endif
 } // namespace reactor
\ No newline at end of file
@@ -1,46 +1,111 @@
 #ifndef _EVENT_DEMULTIPLEXER_H_
 #define _EVENT_DEMULTIPLEXER_H_
 
-#include <set>
-#include <map>
 #include "reactor.h"
+#include "handlertable.h"
+#include "metrics.h"
+#include "basicdemultiplexer.h"
 
 /// @file   event_demultiplexer.h
 /// @brief
 /// @author lovezhangkai@foxmail
 /// @date   2013-10-1
 
+#if defined(__linux__)
+    #include <sys/select.h>
+#endif
+
 namespace reactor
 {
 class EventDemultiplexer
 {
 public:
 
+    /// 构造函数
+    EventDemultiplexer() : m_metrics(NULL) {}
+
     /// 析构函数
     virtual ~EventDemultiplexer() {}
 
+    /// 设置记录等待、分发和系统调用的指标, 为NULL时不记录
+    virtual void SetMetrics(ReactorMetrics * metrics)
+    {
+        m_metrics = metrics;
+    }
+
     /// 获取有事件发生的所有句柄以及所发生的事件
     /// @param  events  获取的事件
     /// @param  timeout 超时时间
     /// @retval = 0   没有发生事件的句柄(超时)
     /// @retval > 0   发生事件的句柄个数
     /// @retval < 0   发生错误
-    virtual int WaitEvents(std::map<handle_t, EventHandler*>* handlers, int timeout = 0) = 0;
+    virtual int WaitEvents(HandlerTable * handlers, int timeout = 0) = 0;
 
     /// 设置句柄handle关注evt事件
+    /// 分离器可以先记下关注, 在下一次WaitEvents等待之前合并设置(epoll, io_uring)
+    /// @param  handle  要关注的句柄
+    /// @param  evt     要关注的事件
+    /// @param  slot    句柄在登记表中的登记项(事件处理器和登记代数)
     /// @retval = 0 设置成功
     /// @retval < 0 设置出错
-    virtual int RequestEvent(handle_t handle, event_t evt) = 0;
+    virtual int RequestEvent(handle_t handle, event_t evt, const HandlerSlot & slot) = 0;
 
     /// 撤销句柄handle对事件evt的关注
     /// @retval = 0 撤销成功
     /// @retval < 0 撤销出错
     virtual int UnrequestEvent(handle_t handle) = 0;
+
+    /// 提交异步接收, 完成时在WaitEvents中回调, 只有完成式的分离器支持
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错或不支持
+    virtual int AsyncRead(handle_t /*handle*/, void * /*buf*/, size_t /*len*/, const CompletionCallback & /*callback*/)
+    {
+        return -1;
+    }
+
+    /// 提交异步发送, 完成时在WaitEvents中回调, 只有完成式的分离器支持
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错或不支持
+    virtual int AsyncWrite(handle_t /*handle*/, const void * /*buf*/, size_t /*len*/, const CompletionCallback & /*callback*/)
+    {
+        return -1;
+    }
+
+    /// 提交异步accept, 完成时在WaitEvents中回调, 只有完成式的分离器支持
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错或不支持
+    virtual int AsyncAccept(handle_t /*handle*/, const CompletionCallback & /*callback*/)
+    {
+        return -1;
+    }
+
+    /// 设置等待事件时内核的忙轮询时间, 只有epoll支持(linux 6.9的EPIOCSPARAMS)
+    /// @param  usec    忙轮询的时间(微秒), 0关闭
+    /// @retval = 0 设置成功
+    /// @retval < 0 设置出错或不支持
+    virtual int SetBusyPoll(int /*usec*/)
+    {
+        return -1;
+    }
+
+protected:
+
+    /// 记录一次设置关注的系统调用
+    void CountCtlCall()
+    {
+        if (m_metrics != NULL)
+        {
+            m_metrics->AddCtlCalls(1);
+        }
+    }
+
+    ReactorMetrics *  m_metrics; ///< 运行指标, 可为NULL
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
 /// select IO多路复用 事件分离器
+/// 登记的集合与传给select的集合分开, 每次等待前复制; linux下句柄不能超过FD_SETSIZE
 class SelectDemultiplexer : public EventDemultiplexer
 {
 public:
@@ -54,12 +119,13 @@ public:
     /// @retval = 0   没有发生事件的句柄(超时)
     /// @retval < 0   发生事件的句柄个数
     /// @retval < 0   发生错误
-    virtual int WaitEvents(std::map<handle_t, EventHandler *> * handlers, int timeout = 0);
+    virtual int WaitEvents(HandlerTable * handlers, int timeout = 0);
 
     /// 设置句柄handle关注evt事件
+    /// @note   select总是水平触发, 边缘触发按持续关注处理; 一次性关注在触发后撤销
     /// @retval = 0 设置成功
     /// @retval < 0 设置出错
-    virtual int RequestEvent(handle_t handle, event_t evt);
+    virtual int RequestEvent(handle_t handle, event_t evt, const HandlerSlot & slot);
 
     /// 撤销句柄handle对事件evt的关注
     /// @retval = 0 撤销成功
@@ -73,48 +139,118 @@ private:
 
 private:
 
-    fd_set              m_read_set;   ///< 读socket集合
-    fd_set              m_write_set;  ///< 写事件socket集合
-    fd_set              m_except_set; ///< 意外socket集合
-    timeval             m_timeout;    ///< 超时时间
+    fd_set              m_read_set;   ///< 登记的读socket集合
+    fd_set              m_write_set;  ///< 登记的写事件socket集合
+    fd_set              m_except_set; ///< 登记的意外socket集合, 包含所有登记的句柄
+    int                 m_max_fd;     ///< 登记的最大句柄
 };
 
+#if defined(__linux__)
 ///////////////////////////////////////////////////////////////////////////////
 
-/// epoll IO多路复用 事件分离器
-class EpollDemultiplexer : public EventDemultiplexer
+/// 把basicdemultiplexer.h中以handler策略为模板参数的分离器包装成EventDemultiplexer
+/// 用VirtualHandlerPolicy实例化, 分离器的实现只有一份, 运行时选择和编译期确定的reactor共用
+template <template <typename> class Backend>
+class BackendDemultiplexer : public EventDemultiplexer
 {
 public:
 
-    /// 构造函数
-    EpollDemultiplexer();
+    /// 设置记录等待、分发和系统调用的指标, 为NULL时不记录
+    virtual void SetMetrics(ReactorMetrics * metrics)
+    {
+        EventDemultiplexer::SetMetrics(metrics);
+        m_backend.SetMetrics(metrics);
+    }
 
-    /// 析构函数
-    ~EpollDemultiplexer();
+    /// 分离器是否创建成功
+    bool IsValid() const
+    {
+        return m_backend.IsValid();
+    }
 
     /// 获取有事件发生的所有句柄以及所发生的事件
     /// @param  events  获取的事件
     /// @param  timeout 超时时间
     /// @retval = 0   没有发生事件的句柄(超时)
-    /// @retval < 0   发生事件的句柄个数
+    /// @retval > 0   发生事件的句柄个数
     /// @retval < 0   发生错误
-    virtual int WaitEvents(std::map<handle_t, EventHandler *> * handlers, int timeout = 0);
+    virtual int WaitEvents(HandlerTable * handlers, int timeout = 0)
+    {
+        return m_backend.WaitEvents(handlers, timeout);
+    }
 
     /// 设置句柄handle关注evt事件
     /// @retval = 0 设置成功
     /// @retval < 0 设置出错
-    virtual int RequestEvent(handle_t handle, event_t evt);
+    virtual int RequestEvent(handle_t handle, event_t evt, const HandlerSlot & slot)
+    {
+        return m_backend.RequestEvent(handle, evt, slot);
+    }
 
     /// 撤销句柄handle对事件evt的关注
     /// @retval = 0 撤销成功
     /// @retval < 0 撤销出错
-    virtual int UnrequestEvent(handle_t handle);
+    virtual int UnrequestEvent(handle_t handle)
+    {
+        return m_backend.UnrequestEvent(handle);
+    }
 
-private:
+    /// 设置等待事件时内核的忙轮询时间
+    /// @retval = 0 设置成功
+    /// @retval < 0 设置出错或不支持
+    virtual int SetBusyPoll(int usec)
+    {
+        return m_backend.SetBusyPoll(usec);
+    }
+
+protected:
+
+    Backend<VirtualHandlerPolicy>  m_backend; ///< 分离器的实现
+};
+
+/// epoll IO多路复用 事件分离器, 见BasicEpollDemultiplexer
+class EpollDemultiplexer : public BackendDemultiplexer<BasicEpollDemultiplexer>
+{
+};
+
+/// poll IO多路复用 事件分离器, 见BasicPollDemultiplexer
+class PollDemultiplexer : public BackendDemultiplexer<BasicPollDemultiplexer>
+{
+};
+
+#if !defined(REACTOR_NO_IO_URING)
+/// io_uring IO多路复用 事件分离器, 见BasicIoUringDemultiplexer
+/// 内核头文件不支持io_uring时, 定义REACTOR_NO_IO_URING去掉该分离器
+class IoUringDemultiplexer : public BackendDemultiplexer<BasicIoUringDemultiplexer>
+{
+public:
+
+    /// 提交异步接收, 完成时在WaitEvents中回调
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错
+    virtual int AsyncRead(handle_t handle, void * buf, size_t len, const CompletionCallback & callback)
+    {
+        return m_backend.AsyncRead(handle, buf, len, callback);
+    }
+
+    /// 提交异步发送, 完成时在WaitEvents中回调
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错
+    virtual int AsyncWrite(handle_t handle, const void * buf, size_t len, const CompletionCallback & callback)
+    {
+        return m_backend.AsyncWrite(handle, buf, len, callback);
+    }
 
-    int  m_epoll_fd; ///< epoll集合
-    int  m_fd_num;   ///< socket描述符集合
+    /// 提交异步accept, 新连接为非阻塞socket, 完成时在WaitEvents中回调
+    /// @retval = 0 提交成功
+    /// @retval < 0 提交出错
+    virtual int AsyncAccept(handle_t handle, const CompletionCallback & callback)
+    {
+        return m_backend.AsyncAccept(handle, callback);
+    }
 };
+#endif // REACTOR_NO_IO_URING
+#endif // __linux__
 } // namespace reactor
 
 #endif // _EVENT_DEMULTIPLEXER_H_
\ No newline at end of file
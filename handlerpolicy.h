@@ -0,0 +1,126 @@
+#ifndef _HANDLER_POLICY_H_
+#define _HANDLER_POLICY_H_
+
+#include "reactor.h"
+
+/// @file   handlerpolicy.h
+/// @brief  分离器回调事件处理器的方式: 虚函数或编译期确定的具体类型
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 通过EventHandler的虚函数分发, Reactor和运行时选择的分离器使用
+struct VirtualHandlerPolicy
+{
+    typedef EventHandler handler_type;
+
+    /// 获取handler的句柄
+    static handle_t GetHandle(const EventHandler * handler)
+    {
+        return handler->GetHandle();
+    }
+
+    /// 回调读事件
+    static void HandleRead(EventHandler * handler)
+    {
+        handler->HandleRead();
+    }
+
+    /// 回调写事件
+    static void HandleWrite(EventHandler * handler)
+    {
+        handler->HandleWrite();
+    }
+
+    /// 回调出错事件
+    static void HandleError(EventHandler * handler)
+    {
+        handler->HandleError();
+    }
+
+    /// 回调错误队列事件
+    static void HandleErrQueue(EventHandler * handler)
+    {
+        handler->HandleErrQueue();
+    }
+};
+
+/// 直接调用具体handler类型的成员函数, 用限定名调用不经过虚函数表, 编译器可以内联整个分发路径
+/// Handler须是最终的具体类型: 可以是BasicEventHandler的CRTP子类, 也可以是EventHandler的子类(如TcpConnection)
+template <typename Handler>
+struct StaticHandlerPolicy
+{
+    typedef Handler handler_type;
+
+    /// 获取handler的句柄
+    static handle_t GetHandle(const Handler * handler)
+    {
+        return handler->Handler::GetHandle();
+    }
+
+    /// 回调读事件
+    static void HandleRead(Handler * handler)
+    {
+        handler->Handler::HandleRead();
+    }
+
+    /// 回调写事件
+    static void HandleWrite(Handler * handler)
+    {
+        handler->Handler::HandleWrite();
+    }
+
+    /// 回调出错事件
+    static void HandleError(Handler * handler)
+    {
+        handler->Handler::HandleError();
+    }
+
+    /// 回调错误队列事件
+    static void HandleErrQueue(Handler * handler)
+    {
+        handler->Handler::HandleErrQueue();
+    }
+};
+
+/// CRTP事件处理器基类, 与StaticHandlerPolicy<Derived>配合使用
+/// 子类实现GetHandle和关心的事件回调, 没有实现的回调为空函数; 没有虚函数表, 也没有引用计数,
+/// handler的生命期由使用者管理, 从reactor移除后即可销毁(包括在自己的回调中).
+template <typename Derived>
+class BasicEventHandler
+{
+public:
+
+    /// 处理读事件的回调函数
+    void HandleRead() {}
+
+    /// 处理写事件的回调函数
+    void HandleWrite() {}
+
+    /// 处理出错事件的回调函数
+    void HandleError() {}
+
+    /// 处理错误队列事件的回调函数, 缺省按出错处理
+    void HandleErrQueue()
+    {
+        Self()->Derived::HandleError();
+    }
+
+protected:
+
+    /// 构造函数,只能子类调
+    BasicEventHandler() {}
+
+    /// 析构函数,只能子类调
+    ~BasicEventHandler() {}
+
+    /// 子类对象
+    Derived * Self()
+    {
+        return static_cast<Derived *>(this);
+    }
+};
+} // namespace reactor
+
+#endif // _HANDLER_POLICY_H_
@@ -0,0 +1,93 @@
+#ifndef _HANDLER_TABLE_H_
+#define _HANDLER_TABLE_H_
+
+#include <vector>
+#include "reactor.h"
+
+/// @file   handlertable.h
+/// @brief  按句柄下标索引的事件处理器登记表
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 句柄的登记项
+/// @param  Handler 事件处理器类型, Reactor为EventHandler, BasicReactor可为具体的handler类
+template <typename Handler>
+struct BasicHandlerSlot
+{
+    Handler *       handler;    ///< 事件处理器, NULL表示未登记
+    event_t         interest;   ///< 当前已设置的关注事件
+    uint32_t        generation; ///< 登记代数, 每次移除后加1, 分离器用它识别过期的就绪事件
+};
+
+/// 事件处理器登记表
+/// 句柄是小而密集的整数, 直接用句柄作下标的数组代替std::map, 查找O(1)且不需要为每个句柄分配节点.
+template <typename Handler>
+class BasicHandlerTable
+{
+public:
+
+    typedef BasicHandlerSlot<Handler> slot_type;
+
+    /// 查找句柄的登记项, 没有登记时返回NULL
+    slot_type * Find(handle_t handle)
+    {
+        if (static_cast<size_t>(handle) >= m_slots.size() || m_slots[handle].handler == NULL)
+        {
+            return NULL;
+        }
+        return &m_slots[handle];
+    }
+
+    /// 获取句柄的登记项, 表不够大时扩容
+    slot_type & Get(handle_t handle)
+    {
+        if (static_cast<size_t>(handle) >= m_slots.size())
+        {
+            slot_type empty = { NULL, 0, 0 };
+            size_t size = m_slots.empty() ? 64 : m_slots.size();
+            while (size <= static_cast<size_t>(handle))
+            {
+                size *= 2;
+            }
+            m_slots.resize(size, empty);
+        }
+        return m_slots[handle];
+    }
+
+    /// 清除句柄的登记项, 代数加1使已取到的就绪事件失效
+    void Clear(handle_t handle)
+    {
+        if (static_cast<size_t>(handle) < m_slots.size())
+        {
+            slot_type & slot = m_slots[handle];
+            slot.handler = NULL;
+            slot.interest = 0;
+            ++slot.generation;
+        }
+    }
+
+    /// 登记表的长度, 句柄都小于该值
+    size_t Size() const
+    {
+        return m_slots.size();
+    }
+
+    /// 按下标访问登记项, 用于遍历
+    slot_type & operator[](size_t idx)
+    {
+        return m_slots[idx];
+    }
+
+private:
+
+    std::vector<slot_type>  m_slots; ///< 以句柄为下标的登记项
+};
+
+/// Reactor使用的登记项和登记表, 通过EventHandler的虚函数分发
+typedef BasicHandlerSlot<EventHandler>  HandlerSlot;
+typedef BasicHandlerTable<EventHandler> HandlerTable;
+} // namespace reactor
+
+#endif // _HANDLER_TABLE_H_
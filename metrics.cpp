@@ -0,0 +1,90 @@
+#include "metrics.h"
+
+/// @file   metrics.cpp
+/// @brief  reactor的运行指标: 计数器与延迟直方图
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 分位数q(0~1)对应的值(所在格的上界), 没有样本时为0
+uint64_t HistogramSnapshot::Percentile(double q) const
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    if (q >= 1.0)
+    {
+        return max;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (int idx = 0; idx < kBuckets; ++idx)
+    {
+        seen += counts[idx];
+        if (seen > rank)
+        {
+            uint64_t upper = LatencyHistogram::BucketUpperBound(idx);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+/// 平均值, 没有样本时为0
+uint64_t HistogramSnapshot::Mean() const
+{
+    return count == 0 ? 0 : sum / count;
+}
+
+/// 构造函数
+LatencyHistogram::LatencyHistogram()
+{
+}
+
+/// 复制当前的统计(线程安全), 各格之间不保证是同一时刻的值
+void LatencyHistogram::Snapshot(HistogramSnapshot * snapshot) const
+{
+    uint64_t count = 0;
+    for (int idx = 0; idx < HistogramSnapshot::kBuckets; ++idx)
+    {
+        snapshot->counts[idx] = m_counts[idx].Get();
+        count += snapshot->counts[idx];
+    }
+    /// 以各格之和为总数, 求分位数时与各格一致
+    snapshot->count = count;
+    snapshot->sum = m_sum.Get();
+    snapshot->max = m_max.Get();
+}
+
+/// 格的上界(含)
+uint64_t LatencyHistogram::BucketUpperBound(int idx)
+{
+    if (idx < HistogramSnapshot::kSubBuckets)
+    {
+        return static_cast<uint64_t>(idx);
+    }
+    int shift = idx / HistogramSnapshot::kSubBuckets - 1;
+    uint64_t sub = static_cast<uint64_t>(idx % HistogramSnapshot::kSubBuckets);
+    uint64_t lower = (HistogramSnapshot::kSubBuckets + sub) << shift;
+    return lower + ((1ULL << shift) - 1);
+}
+
+/// 复制当前的指标(线程安全)
+void ReactorMetrics::Snapshot(MetricsSnapshot * snapshot) const
+{
+    snapshot->waits = m_waits.Get();
+    snapshot->events = m_events.Get();
+    snapshot->wakeups = m_wakeups.Get();
+    snapshot->ctl_calls = m_ctl_calls.Get();
+    snapshot->accepts = m_accepts.Get();
+    snapshot->bytes_in = m_bytes_in.Get();
+    snapshot->bytes_out = m_bytes_out.Get();
+    snapshot->spin_hits = m_spin_hits.Get();
+    snapshot->spin_misses = m_spin_misses.Get();
+    snapshot->budget_pauses = m_budget_pauses.Get();
+    m_wait_time.Snapshot(&snapshot->wait_time);
+    m_handler_time.Snapshot(&snapshot->handler_time);
+}
+} // namespace reactor
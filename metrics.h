@@ -0,0 +1,355 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#if defined(__linux__)
+    #include <time.h>
+#endif
+#include "reactor.h"
+
+/// @file   metrics.h
+/// @brief  reactor的运行指标: 计数器与延迟直方图
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 单调时钟(纳秒)
+inline uint64_t MonotonicNanos()
+{
+#if defined(__linux__)
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+#else
+    return static_cast<uint64_t>(::GetTickCount64()) * 1000000ULL;
+#endif
+}
+
+/// 单写者计数器: 只有事件循环线程增加, 其他线程可随时读取
+/// 单写者不需要带锁前缀的原子加, relaxed的读改写即可
+class Counter
+{
+public:
+
+    /// 构造函数
+    Counter() : m_value(0) {}
+
+    /// 增加n, 只能在事件循环线程调用
+    void Add(uint64_t n)
+    {
+        m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /// 设为n, 只能在事件循环线程调用
+    void Set(uint64_t n)
+    {
+        m_value.store(n, std::memory_order_relaxed);
+    }
+
+    /// 读取当前值(线程安全)
+    uint64_t Get() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+private:
+
+    std::atomic<uint64_t> m_value; ///< 计数值
+};
+
+/// 直方图快照
+struct HistogramSnapshot
+{
+    /// 对数分段, 每段线性分为2^kSubBucketBits格
+    static const int kSubBucketBits = 4;
+    static const int kSubBuckets    = 1 << kSubBucketBits;
+    static const int kBuckets       = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    uint64_t counts[kBuckets]; ///< 各格的样本数
+    uint64_t count;            ///< 样本总数
+    uint64_t sum;              ///< 样本之和
+    uint64_t max;              ///< 最大样本
+
+    /// 分位数q(0~1)对应的值(所在格的上界), 没有样本时为0
+    uint64_t Percentile(double q) const;
+
+    /// 平均值, 没有样本时为0
+    uint64_t Mean() const;
+};
+
+/// HDR风格的延迟直方图
+/// 值落在[2^k, 2^(k+1))的样本再线性分为16格, 相对误差不超过1/16, 覆盖整个uint64_t范围.
+/// 只有事件循环线程记录(单写者), Snapshot可在任意线程调用.
+class LatencyHistogram
+{
+public:
+
+    /// 构造函数
+    LatencyHistogram();
+
+    /// 记录一个样本, 只能在事件循环线程调用
+    void Record(uint64_t value)
+    {
+        m_counts[BucketIndex(value)].Add(1);
+        m_sum.Add(value);
+        if (value > m_max.Get())
+        {
+            m_max.Set(value);
+        }
+    }
+
+    /// 复制当前的统计(线程安全), 各格之间不保证是同一时刻的值
+    void Snapshot(HistogramSnapshot * snapshot) const;
+
+    /// 值所在的格
+    static int BucketIndex(uint64_t value)
+    {
+        if (value < static_cast<uint64_t>(HistogramSnapshot::kSubBuckets))
+        {
+            return static_cast<int>(value);
+        }
+#if defined(__GNUC__)
+        int top = 63 - __builtin_clzll(value);
+#else
+        int top = 0;
+        for (uint64_t bits = value; bits > 1; bits >>= 1)
+        {
+            ++top;
+        }
+#endif
+        int shift = top - HistogramSnapshot::kSubBucketBits;
+        return (shift + 1) * HistogramSnapshot::kSubBuckets +
+               static_cast<int>((value >> shift) & (HistogramSnapshot::kSubBuckets - 1));
+    }
+
+    /// 格的上界(含)
+    static uint64_t BucketUpperBound(int idx);
+
+private:
+
+    Counter m_counts[HistogramSnapshot::kBuckets]; ///< 各格的样本数
+    Counter m_sum;                                 ///< 样本之和
+    Counter m_max;                                 ///< 最大样本
+};
+
+/// 指标快照
+struct MetricsSnapshot
+{
+    uint64_t           waits;        ///< WaitEvents的次数, 忙轮询的自旋加阻塞计为一次
+    uint64_t           events;       ///< 分发的事件数, events / waits为每轮的平均批量
+    uint64_t           wakeups;      ///< 被其他线程通过eventfd唤醒的次数
+    uint64_t           ctl_calls;    ///< 设置关注的系统调用次数(epoll_ctl; io_uring为带提交的io_uring_enter, 只等待完成的不计)
+    uint64_t           accepts;      ///< accept的连接数
+    uint64_t           bytes_in;     ///< 连接读入的字节数
+    uint64_t           bytes_out;    ///< 连接发出的字节数
+    uint64_t           spin_hits;    ///< 忙轮询预算内等到事件的次数
+    uint64_t           spin_misses;  ///< 忙轮询预算用完转入阻塞等待的次数
+    uint64_t           budget_pauses;///< 缓冲区内存超出预算而暂停读的次数
+    HistogramSnapshot  wait_time;    ///< 阻塞等待的时间(纳秒)
+    HistogramSnapshot  handler_time; ///< 每个事件回调的耗时(纳秒)
+};
+
+/// reactor的运行指标
+/// 计数和直方图都只由事件循环线程更新, 不加锁也没有带锁前缀的原子操作;
+/// Snapshot可在其他线程周期性地调用.
+class ReactorMetrics
+{
+public:
+
+    /// 构造函数
+    ReactorMetrics() : m_timing(true), m_spinning(false), m_probing(false), m_spin_start(0) {}
+
+    /// 是否对等待和回调计时(每个事件多一次读时钟), 缺省开启
+    void EnableTiming(bool enable)
+    {
+        m_timing.store(enable, std::memory_order_relaxed);
+    }
+
+    /// 是否对等待和回调计时
+    bool TimingEnabled() const
+    {
+        return m_timing.load(std::memory_order_relaxed);
+    }
+
+    /// 记录一次等待: 阻塞时间和取回的事件数, 忙轮询周期随之结束
+    void RecordWait(uint64_t nanos, int events)
+    {
+        CountWait(events);
+        m_wait_time.Record(nanos);
+    }
+
+    /// 记录一次等待的事件数(不计时), 忙轮询周期随之结束
+    void CountWait(int events)
+    {
+        m_waits.Add(1);
+        if (events > 0)
+        {
+            m_events.Add(static_cast<uint64_t>(events));
+        }
+        m_spinning = false;
+        m_probing = false;
+    }
+
+    /// 开始一个忙轮询周期: 其中没有取到事件的0超时探测不计为等待,
+    /// 取到事件的探测或预算用完后的阻塞等待计为一次等待, 等待时间从周期开始算起
+    void BeginSpin()
+    {
+        m_spinning = true;
+        m_probing = true;
+        m_spin_start = TimingEnabled() ? MonotonicNanos() : 0;
+    }
+
+    /// 忙轮询预算用完, 接下来的阻塞等待即使没有事件也计为这一周期的等待
+    void StopProbing()
+    {
+        m_probing = false;
+    }
+
+    /// 结束忙轮询周期(分离器没有等待就返回时)
+    void EndSpin()
+    {
+        m_spinning = false;
+        m_probing = false;
+    }
+
+    /// 本次等待是否不计: 忙轮询中没有取到事件的探测
+    bool IgnoreWait(int events) const
+    {
+        return m_probing && events <= 0;
+    }
+
+    /// 等待开始的时刻: 忙轮询周期中为周期开始的时刻
+    uint64_t WaitStart() const
+    {
+        return m_spinning && m_spin_start != 0 ? m_spin_start : MonotonicNanos();
+    }
+
+    /// 记录一个事件回调的耗时
+    void RecordHandler(uint64_t nanos)
+    {
+        m_handler_time.Record(nanos);
+    }
+
+    /// 增加唤醒次数
+    void AddWakeups(uint64_t n)
+    {
+        m_wakeups.Add(n);
+    }
+
+    /// 增加设置关注的系统调用次数
+    void AddCtlCalls(uint64_t n)
+    {
+        m_ctl_calls.Add(n);
+    }
+
+    /// 增加accept的连接数
+    void AddAccepts(uint64_t n)
+    {
+        m_accepts.Add(n);
+    }
+
+    /// 增加读入的字节数
+    void AddBytesIn(uint64_t n)
+    {
+        m_bytes_in.Add(n);
+    }
+
+    /// 增加发出的字节数
+    void AddBytesOut(uint64_t n)
+    {
+        m_bytes_out.Add(n);
+    }
+
+    /// 增加忙轮询命中的次数
+    void AddSpinHits(uint64_t n)
+    {
+        m_spin_hits.Add(n);
+    }
+
+    /// 增加忙轮询未命中的次数
+    void AddSpinMisses(uint64_t n)
+    {
+        m_spin_misses.Add(n);
+    }
+
+    /// 增加因内存预算暂停读的次数
+    void AddBudgetPauses(uint64_t n)
+    {
+        m_budget_pauses.Add(n);
+    }
+
+    /// 复制当前的指标(线程安全)
+    void Snapshot(MetricsSnapshot * snapshot) const;
+
+private:
+
+    std::atomic<bool>  m_timing;       ///< 是否计时
+    Counter            m_waits;        ///< WaitEvents的次数
+    Counter            m_events;       ///< 分发的事件数
+    Counter            m_wakeups;      ///< 被唤醒的次数
+    Counter            m_ctl_calls;    ///< 设置关注的系统调用次数
+    Counter            m_accepts;      ///< accept的连接数
+    Counter            m_bytes_in;     ///< 读入的字节数
+    Counter            m_bytes_out;    ///< 发出的字节数
+    Counter            m_spin_hits;    ///< 忙轮询命中的次数
+    Counter            m_spin_misses;  ///< 忙轮询未命中的次数
+    Counter            m_budget_pauses;///< 因内存预算暂停读的次数
+    LatencyHistogram   m_wait_time;    ///< 阻塞等待的时间
+    LatencyHistogram   m_handler_time; ///< 事件回调的耗时
+    bool               m_spinning;     ///< 是否在忙轮询周期中
+    bool               m_probing;      ///< 是否在以0超时探测
+    uint64_t           m_spin_start;   ///< 忙轮询周期开始的时刻, 不计时为0
+};
+
+/// 分离器的分发计时: 构造时开始计时, Waited记录等待, 之后每次Dispatched记录一个回调的耗时
+class DispatchTimer
+{
+public:
+
+    /// 构造函数, metrics为NULL时什么也不做
+    explicit DispatchTimer(ReactorMetrics * metrics)
+        : m_metrics(metrics), m_timing(metrics != NULL && metrics->TimingEnabled()),
+          m_last(m_timing ? metrics->WaitStart() : 0)
+    {
+    }
+
+    /// 等待结束, 取回了events个事件; 忙轮询中没有取到事件的探测不计
+    void Waited(int events)
+    {
+        if (m_metrics != NULL && m_metrics->IgnoreWait(events))
+        {
+            return;
+        }
+        if (m_timing)
+        {
+            uint64_t now = MonotonicNanos();
+            m_metrics->RecordWait(now - m_last, events);
+            m_last = now;
+        }
+        else if (m_metrics != NULL)
+        {
+            m_metrics->CountWait(events);
+        }
+    }
+
+    /// 一个事件回调结束
+    void Dispatched()
+    {
+        if (m_timing)
+        {
+            uint64_t now = MonotonicNanos();
+            m_metrics->RecordHandler(now - m_last);
+            m_last = now;
+        }
+    }
+
+private:
+
+    ReactorMetrics *  m_metrics; ///< 指标, 可为NULL
+    bool              m_timing;  ///< 是否计时
+    uint64_t          m_last;    ///< 上一次计时的时刻
+};
+} // namespace reactor
+
+#endif // _METRICS_H_
@@ -1,29 +1,103 @@
 
 #include <assert.h>
+#include <errno.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+    #include <sched.h>
+    #include <pthread.h>
+    #include <sys/socket.h>
+    #include <sys/eventfd.h>
+#endif
 #include "reactor.h"
 #include "eventdemultiplexer.h"
+#include "timerqueue.h"
+#include "bufferpool.h"
+#include "metrics.h"
+#include "taskqueue.h"
 
 /// @file   reactor.cpp
 /// @brief
 /// @author lovezhangkai@foxmail
 /// @date   2013-10-1
 
+/// 缺省的事件分离器, 可在编译时指定(CMake选项REACTOR_BACKEND)
+#if !defined(REACTOR_DEFAULT_DEMULTIPLEXER)
+    #define REACTOR_DEFAULT_DEMULTIPLEXER kEpollDemultiplexer
+#endif
+
 namespace reactor
 {
+#if defined(__linux__)
+/// 唤醒事件处理器, 其他线程写eventfd以唤醒阻塞在WaitEvents中的事件循环
+class WakeupHandler : public EventHandler
+{
+public:
+
+    /// 构造函数
+    /// @param  metrics 记录唤醒次数的指标
+    explicit WakeupHandler(ReactorMetrics * metrics) : EventHandler(), m_metrics(metrics)
+    {
+        m_handle = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(m_handle >= 0);
+    }
+
+    /// 析构函数
+    ~WakeupHandler()
+    {
+        ::close(m_handle);
+    }
+
+    /// 获取该handler所对应的句柄
+    virtual handle_t GetHandle() const
+    {
+        return m_handle;
+    }
+
+    /// 读空计数器, 使eventfd恢复为不可读
+    virtual void HandleRead()
+    {
+        uint64_t count;
+        while (::read(m_handle, &count, sizeof(count)) == sizeof(count))
+        {
+        }
+        m_metrics->AddWakeups(1);
+    }
+
+    /// 唤醒事件循环(线程安全, 可在信号处理函数中调用)
+    void Wakeup()
+    {
+        uint64_t one = 1;
+        ssize_t n = ::write(m_handle, &one, sizeof(one));
+        (void)n;
+    }
+
+private:
+
+    handle_t          m_handle;  ///< eventfd句柄
+    ReactorMetrics *  m_metrics; ///< 运行指标
+};
+#endif // __linux__
+
+///////////////////////////////////////////////////////////////////////////////
+
 /// reactor的实现类
 class ReactorImplementation
 {
 public:
 
     /// 构造函数
-    ReactorImplementation();
+    /// @param  type    使用的事件分离器
+    explicit ReactorImplementation(demultiplexer_t type);
 
     /// 析构函数
     ~ReactorImplementation();
 
     /// 向reactor中注册关注事件evt的handler(可重入)
+    /// 持续关注的handler以相同的evt重复注册时不会再次设置分离器
     /// @param  handler 要注册的事件处理器
-    /// @param  evt     要关注的事件
+    /// @param  evt     要关注的事件, 可与kPersistEvent或kEdgeTriggered按位或
     /// @retval 0       注册成功
     /// @retval -1      注册出错
     int RegisterHandler(EventHandler * handler, event_t evt);
@@ -34,22 +108,153 @@ public:
     /// @retval -1      移除出错
     int RemoveHandler(EventHandler * handler);
 
+    /// 从reactor中移除handler并关闭其句柄
+    /// @param  handler 要关闭的事件处理器
+    /// @retval 0       移除成功
+    /// @retval -1      移除出错(句柄仍会被关闭)
+    int CloseHandler(EventHandler * handler);
+
     /// 处理事件,回调注册的handler中相应的事件处理函数
-    /// @param  timeout 超时时间(毫秒)
+    /// @param  timeout 超时时间(毫秒), 0不阻塞, -1一直阻塞到有事件发生
     void HandleEvents(int timeout);
 
+    /// 运行事件循环, 阻塞等待并处理事件, 直到Stop被调用
+    void Run();
+
+    /// 停止事件循环(线程安全), 会唤醒阻塞中的Run
+    void Stop();
+
+    /// 设置忙轮询, 用CPU换取更低的唤醒延迟
+    /// @param  spin_usec       每次阻塞等待前自旋的时间预算(微秒), 0关闭
+    /// @param  busy_poll_usec  内核忙轮询的时间(微秒), 0不设置
+    void SetBusyPoll(int spin_usec, int busy_poll_usec);
+
+    /// 把事件循环线程绑定到cpu上, 在Run开始时生效, 与忙轮询配合独占一个核
+    /// @param  cpu     cpu编号, -1不绑定
+    /// @retval 0       成功
+    /// @retval < 0     cpu不在进程可用的cpu中(-EINVAL), 或平台不支持
+    int SetCpuAffinity(int cpu);
+
+    /// 在事件循环线程中执行task(线程安全)
+    void RunInLoop(const Functor & task);
+
+    /// 将task放入任务队列, 由事件循环在本轮事件处理之后执行(线程安全, 无锁)
+    void QueueInLoop(const Functor & task);
+
+    /// 当前线程是否为事件循环线程
+    bool IsInLoopThread() const;
+
+    /// 添加定时器, 到期时在事件循环中回调, O(1)
+    /// @param  delay    首次触发的延迟(毫秒)
+    /// @param  period   触发周期(毫秒), 0表示只触发一次
+    /// @param  callback 到期时的回调函数
+    /// @retval 定时器id, 用于CancelTimer
+    timer_id_t ScheduleTimer(int delay, int period, const TimerCallback & callback);
+
+    /// 取消定时器, O(1)
+    /// @param  id      ScheduleTimer返回的定时器id
+    /// @retval 0       取消成功
+    /// @retval -1      定时器不存在或已到期
+    int CancelTimer(timer_id_t id);
+
+    /// 提交异步接收(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+    /// @retval 0       提交成功
+    /// @retval < 0     提交出错或分离器不支持
+    int AsyncRead(handle_t handle, void * buf, size_t len, const CompletionCallback & callback);
+
+    /// 提交异步发送(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+    /// @retval 0       提交成功
+    /// @retval < 0     提交出错或分离器不支持
+    int AsyncWrite(handle_t handle, const void * buf, size_t len, const CompletionCallback & callback);
+
+    /// 提交异步accept(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+    /// @retval 0       提交成功
+    /// @retval < 0     提交出错或分离器不支持
+    int AsyncAccept(handle_t handle, const CompletionCallback & callback);
+
+    /// 获取reactor的缓冲区内存池
+    BufferPool * GetBufferPool();
+
+    /// 设置该reactor上连接缓冲区的内存预算
+    /// @param  bytes   内存预算(字节), 0不限制
+    void SetMemoryBudget(size_t bytes);
+
+    /// 缓冲区内存是否超出预算
+    bool OverMemoryBudget() const;
+
+    /// 等待缓冲区内存回落到预算的3/4以下后执行task一次
+    void WaitMemoryBudget(const Functor & task);
+
+    /// 获取reactor的运行指标
+    ReactorMetrics * GetMetrics();
+
+    /// 获取实际使用的事件分离器
+    demultiplexer_t GetDemultiplexerType() const;
+
 private:
 
+    /// 释放移除的handler的引用并关闭待关闭的句柄
+    void ProcessPending();
+
+    /// 等待并分发事件, 开启忙轮询时先在预算内以0超时反复等待
+    void WaitEvents(int timeout);
+
+    /// 为socket设置SO_BUSY_POLL, 非socket的句柄(eventfd, timerfd)会失败, 忽略
+    void SetSocketBusyPoll(handle_t handle);
+
+    /// 把当前线程绑定到m_cpu
+    void BindCpu();
+
+    /// 缓冲区内存回落到预算的3/4以下时, 执行等待内存的任务
+    void CheckMemoryBudget();
+
+    /// 执行任务队列中的任务, 每轮最多kMaxTasksPerTurn个
+    void RunTasks();
+
+    /// 唤醒阻塞在WaitEvents中的事件循环
+    void Wakeup();
+
+    /// 每轮最多执行的任务数, 任务中再投递的任务不会让事件循环饿死
+    static const int kMaxTasksPerTurn = 1024;
+
+#if defined(__linux__)
+    /// 事件循环无事可做时一直阻塞, 由eventfd唤醒
+    static const int kRunTimeout = -1;
+#else
+    /// 没有唤醒机制的平台上定时醒来检查退出标志
+    static const int kRunTimeout = 100;
+#endif
+
+    ReactorMetrics                     m_metrics;        ///< 运行指标
     EventDemultiplexer*                m_demultiplexer;  ///< 事件分离器
-    std::map<handle_t, EventHandler*>  m_handlers;       ///< 句柄与事件处理器映射表 
+    demultiplexer_t                    m_type;           ///< 实际使用的事件分离器
+    HandlerTable                       m_handlers;       ///< 句柄与事件处理器登记表
+    std::vector<EventHandler *>        m_pending_release;///< 本轮移除, 待释放引用的handler
+    std::vector<handle_t>              m_pending_close;  ///< 本轮移除, 待关闭的句柄
+    bool                               m_dispatching;    ///< 是否正在分发事件
+    std::atomic<bool>                  m_quit;           ///< 事件循环退出标志
+    std::atomic<std::thread::id>       m_thread_id;      ///< 事件循环线程
+    TaskQueue                          m_tasks;          ///< 其他线程投递的任务
+    std::atomic<bool>                  m_task_wakeup;    ///< 已为任务唤醒过事件循环, 任务执行前不再重复唤醒
+    TimerQueue                         m_timer_queue;    ///< 定时器队列
+    BufferPool                         m_buffer_pool;    ///< 缓冲区内存池
+    uint64_t                           m_spin_nanos;     ///< 阻塞等待前自旋的时间预算(纳秒), 0不自旋
+    int                                m_busy_poll_usec; ///< socket的SO_BUSY_POLL(微秒), 0不设置
+    int                                m_cpu;            ///< 事件循环线程绑定的cpu, -1不绑定
+    size_t                             m_memory_budget;  ///< 缓冲区内存预算, 0不限制
+    std::vector<Functor>               m_budget_waiters; ///< 等待缓冲区内存回落的任务
+#if defined(__linux__)
+    WakeupHandler                      m_wakeup_handler; ///< 唤醒事件循环的eventfd
+#endif
 };
 
 ///////////////////////////////////////////////////////////////////////////////
 
 /// 构造函数
-Reactor::Reactor()
+/// @param  type    使用的事件分离器
+Reactor::Reactor(demultiplexer_t type)
 {
-    m_reactor_impl = new ReactorImplementation();
+    m_reactor_impl = new ReactorImplementation(type);
 }
 
 /// 析构函数
@@ -69,6 +274,7 @@ int Reactor::RegisterHandler(EventHandler * handler, event_t evt)
 }
 
 /// 从reactor中移除handler
+/// 注册时reactor对handler加了引用, 移除后在本轮事件处理结束时才释放
 /// @param  handler 要移除的事件处理器
 /// @retval 0       移除成功
 /// @retval -1      移除出错
@@ -77,6 +283,16 @@ int Reactor::RemoveHandler(EventHandler * handler)
     return m_reactor_impl->RemoveHandler(handler);
 }
 
+/// 从reactor中移除handler并关闭其句柄
+/// 句柄在本轮事件处理结束时统一关闭, 本轮中句柄号不会被新accept的连接复用
+/// @param  handler 要关闭的事件处理器
+/// @retval 0       移除成功
+/// @retval -1      移除出错(句柄仍会被关闭)
+int Reactor::CloseHandler(EventHandler * handler)
+{
+    return m_reactor_impl->CloseHandler(handler);
+}
+
 /// 处理事件,回调注册的handler中相应的事件处理函数
 /// @param  timeout 超时时间(毫秒)
 void Reactor::HandleEvents(int timeout)
@@ -84,15 +300,196 @@ void Reactor::HandleEvents(int timeout)
     m_reactor_impl->HandleEvents(timeout);
 }
 
+/// 运行事件循环, 阻塞等待并处理事件, 直到Stop被调用
+void Reactor::Run()
+{
+    m_reactor_impl->Run();
+}
+
+/// 停止事件循环(线程安全), 会唤醒阻塞中的Run
+void Reactor::Stop()
+{
+    m_reactor_impl->Stop();
+}
+
+/// 设置忙轮询, 用CPU换取更低的唤醒延迟
+/// Run和HandleEvents(timeout不为0)在阻塞等待前, 先以0超时反复等待至多spin_usec微秒, 期间取到事件即处理(命中),
+/// 预算用完才阻塞等待(未命中); 命中和未命中的次数记在ReactorMetrics中.
+/// busy_poll_usec大于0时, 还为已注册和之后注册的socket设置SO_BUSY_POLL, 并设置epoll的忙轮询参数(linux 6.9),
+/// 由内核在收包路径上忙轮询网卡队列; 超过net.core.busy_read的值需要CAP_NET_ADMIN, 设置失败的句柄被忽略.
+/// 只能在事件循环线程中或Run之前调用
+/// @param  spin_usec       每次阻塞等待前自旋的时间预算(微秒), 0关闭
+/// @param  busy_poll_usec  内核忙轮询的时间(微秒), 0不设置
+void Reactor::SetBusyPoll(int spin_usec, int busy_poll_usec)
+{
+    m_reactor_impl->SetBusyPoll(spin_usec, busy_poll_usec);
+}
+
+/// 把事件循环线程绑定到cpu上, 在Run开始时生效, 与忙轮询配合独占一个核
+/// @param  cpu     cpu编号, -1不绑定
+/// @retval 0       成功
+/// @retval < 0     cpu不在进程可用的cpu中(-EINVAL), 或平台不支持
+int Reactor::SetCpuAffinity(int cpu)
+{
+    return m_reactor_impl->SetCpuAffinity(cpu);
+}
+
+/// 在事件循环线程中执行task(线程安全)
+/// 在事件循环线程中调用时立即执行, 否则同QueueInLoop
+void Reactor::RunInLoop(const Functor & task)
+{
+    m_reactor_impl->RunInLoop(task);
+}
+
+/// 将task放入任务队列, 由事件循环在本轮事件处理之后执行(线程安全, 无锁)
+/// 其他线程向连接回发结果时, 应先对handler AddRef, 在task中使用后Release
+void Reactor::QueueInLoop(const Functor & task)
+{
+    m_reactor_impl->QueueInLoop(task);
+}
+
+/// 当前线程是否为事件循环线程(最近一次处理事件的线程, 运行前为创建reactor的线程)
+bool Reactor::IsInLoopThread() const
+{
+    return m_reactor_impl->IsInLoopThread();
+}
+
+/// 添加定时器, 到期时在事件循环中回调, O(1)
+/// @param  delay    首次触发的延迟(毫秒)
+/// @param  period   触发周期(毫秒), 0表示只触发一次
+/// @param  callback 到期时的回调函数
+/// @retval 定时器id, 用于CancelTimer
+timer_id_t Reactor::ScheduleTimer(int delay, int period, const TimerCallback & callback)
+{
+    return m_reactor_impl->ScheduleTimer(delay, period, callback);
+}
+
+/// 取消定时器, O(1)
+/// @param  id      ScheduleTimer返回的定时器id
+/// @retval 0       取消成功
+/// @retval -1      定时器不存在或已到期
+int Reactor::CancelTimer(timer_id_t id)
+{
+    return m_reactor_impl->CancelTimer(id);
+}
+
+/// 提交异步接收(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+/// @retval 0       提交成功
+/// @retval < 0     提交出错或分离器不支持
+int Reactor::AsyncRead(handle_t handle, void * buf, size_t len, const CompletionCallback & callback)
+{
+    return m_reactor_impl->AsyncRead(handle, buf, len, callback);
+}
+
+/// 提交异步发送(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+/// @retval 0       提交成功
+/// @retval < 0     提交出错或分离器不支持
+int Reactor::AsyncWrite(handle_t handle, const void * buf, size_t len, const CompletionCallback & callback)
+{
+    return m_reactor_impl->AsyncWrite(handle, buf, len, callback);
+}
+
+/// 提交异步accept(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+/// @retval 0       提交成功
+/// @retval < 0     提交出错或分离器不支持
+int Reactor::AsyncAccept(handle_t handle, const CompletionCallback & callback)
+{
+    return m_reactor_impl->AsyncAccept(handle, callback);
+}
+
+/// 获取reactor的缓冲区内存池, 供该reactor上的连接创建Buffer, 只能在事件循环线程中使用
+BufferPool * Reactor::GetBufferPool()
+{
+    return m_reactor_impl->GetBufferPool();
+}
+
+/// 设置该reactor上连接缓冲区的内存预算
+/// 缓冲区内存池分出的内存超过预算时, TcpConnection不再读socket(撤销读事件的关注), 由TCP流控反压对端,
+/// 内存回落到预算的3/4以下时恢复读; 慢速的对端再多, 缓冲区内存也不会无限增长.
+/// 只能在事件循环线程中或Run之前调用
+/// @param  bytes   内存预算(字节), 0不限制
+void Reactor::SetMemoryBudget(size_t bytes)
+{
+    m_reactor_impl->SetMemoryBudget(bytes);
+}
+
+/// 缓冲区内存是否超出预算, 只能在事件循环线程中调用
+bool Reactor::OverMemoryBudget() const
+{
+    return m_reactor_impl->OverMemoryBudget();
+}
+
+/// 等待缓冲区内存回落: 内存回落到预算的3/4以下后, 在那一轮事件处理结束时执行task一次
+/// 只能在事件循环线程中调用
+void Reactor::WaitMemoryBudget(const Functor & task)
+{
+    m_reactor_impl->WaitMemoryBudget(task);
+}
+
+/// 获取reactor的运行指标, 由事件循环线程更新, 其Snapshot可在任意线程调用
+ReactorMetrics * Reactor::GetMetrics()
+{
+    return m_reactor_impl->GetMetrics();
+}
+
+/// 获取实际使用的事件分离器, 请求的分离器不可用时为退回的epoll
+demultiplexer_t Reactor::GetDemultiplexerType() const
+{
+    return m_reactor_impl->GetDemultiplexerType();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 /// 构造函数
-ReactorImplementation::ReactorImplementation()
+/// @param  type    使用的事件分离器
+ReactorImplementation::ReactorImplementation(demultiplexer_t type)
+    : m_dispatching(false), m_quit(false), m_thread_id(std::this_thread::get_id()), m_task_wakeup(false),
+      m_spin_nanos(0), m_busy_poll_usec(0), m_cpu(-1), m_memory_budget(0)
+#if defined(__linux__)
+    , m_wakeup_handler(&m_metrics)
+#endif
 {
 #if defined(_WIN32)
     m_demultiplexer = new SelectDemultiplexer(); ///windows平台 select IO多路复用模型
+    m_type = kSelectDemultiplexer;
+    m_demultiplexer->SetMetrics(&m_metrics);
 #elif defined(__linux__)
-    m_demultiplexer = new EpollDemultiplexer(); ///linux平台 epoll IO多路复用模型
+    m_demultiplexer = NULL;
+    if (type == kDefaultDemultiplexer)
+    {
+        type = REACTOR_DEFAULT_DEMULTIPLEXER;
+    }
+    if (type == kSelectDemultiplexer)
+    {
+        m_demultiplexer = new SelectDemultiplexer(); ///select IO多路复用模型
+    }
+    else if (type == kPollDemultiplexer)
+    {
+        m_demultiplexer = new PollDemultiplexer(); ///poll IO多路复用模型
+    }
+#if !defined(REACTOR_NO_IO_URING)
+    else if (type == kIoUringDemultiplexer)
+    {
+        IoUringDemultiplexer * uring = new IoUringDemultiplexer(); ///linux平台 io_uring 完成式模型
+        if (uring->IsValid())
+        {
+            m_demultiplexer = uring;
+        }
+        else
+        {
+            delete uring;
+        }
+    }
+#endif // REACTOR_NO_IO_URING
+    if (m_demultiplexer == NULL)
+    {
+        m_demultiplexer = new EpollDemultiplexer(); ///linux平台 epoll IO多路复用模型
+        type = kEpollDemultiplexer;
+    }
+    m_type = type;
+    m_demultiplexer->SetMetrics(&m_metrics);
+    RegisterHandler(&m_wakeup_handler, kReadEvent | kPersistEvent);
+    RegisterHandler(&m_timer_queue, kReadEvent | kPersistEvent);
 #else
 #error "failure"
 #endif // _WIN32
@@ -101,6 +498,24 @@ ReactorImplementation::ReactorImplementation()
 /// 析构函数
 ReactorImplementation::~ReactorImplementation()
 {
+    /// 等待内存的任务持有连接的引用, 执行它们以释放引用
+    std::vector<Functor> waiters;
+    waiters.swap(m_budget_waiters);
+    for (size_t idx = 0; idx < waiters.size(); ++idx)
+    {
+        waiters[idx]();
+    }
+    ProcessPending();
+    /// 释放仍在登记表中的handler的引用
+    for (size_t idx = 0; idx < m_handlers.Size(); ++idx)
+    {
+        EventHandler * handler = m_handlers[idx].handler;
+        if (handler != NULL)
+        {
+            m_handlers.Clear(static_cast<handle_t>(idx));
+            handler->Release();
+        }
+    }
     delete m_demultiplexer;
 }
 
@@ -112,29 +527,399 @@ ReactorImplementation::~ReactorImplementation()
 int ReactorImplementation::RegisterHandler(EventHandler* handler, event_t evt)
 {
     handle_t handle = handler->GetHandle();
-    std::map<handle_t, EventHandler*>::iterator it = m_handlers.find(handle);
-    if (it == m_handlers.end())
+    HandlerSlot & slot = m_handlers.Get(handle);
+    bool added = slot.handler != handler;
+    if (!added && (evt & (kPersistEvent | kEdgeTriggered)) && slot.interest == evt)
+    {
+        /// 持续关注且关注事件未变, 无需再设置分离器
+        return 0;
+    }
+    EventHandler * replaced = added ? slot.handler : NULL;
+    if (replaced != NULL)
+    {
+        /// 句柄换了handler, 旧handler的就绪事件作废
+        ++slot.generation;
+    }
+    slot.handler = handler;
+    int ret = m_demultiplexer->RequestEvent(handle, evt, slot);
+    if (ret == 0)
+    {
+        slot.interest = evt;
+        if (added)
+        {
+            handler->AddRef();
+            if (m_busy_poll_usec > 0)
+            {
+                SetSocketBusyPoll(handle);
+            }
+        }
+    }
+    else if (added)
     {
-        m_handlers[handle] = handler;
+        m_handlers.Clear(handle);
     }
-    return m_demultiplexer->RequestEvent(handle, evt);
+    if (replaced != NULL)
+    {
+        m_pending_release.push_back(replaced);
+        if (!m_dispatching)
+        {
+            ProcessPending();
+        }
+    }
+    return ret;
 }
 
 /// 从reactor中移除handler
+/// 注册时reactor对handler加了引用, 移除后在本轮事件处理结束时才释放
 /// @param  handler 要移除的事件处理器
 /// @retval 0       移除成功
 /// @retval -1      移除出错
 int ReactorImplementation::RemoveHandler(EventHandler * handler)
 {
     handle_t handle = handler->GetHandle();
-    m_handlers.erase(handle);
-    return m_demultiplexer->UnrequestEvent(handle);
+    HandlerSlot * slot = m_handlers.Find(handle);
+    if (slot == NULL || slot->handler != handler)
+    {
+        return -1;
+    }
+    /// 登记项立即清除, 本轮中该句柄余下的就绪事件都会被丢弃
+    m_handlers.Clear(handle);
+    int ret = m_demultiplexer->UnrequestEvent(handle);
+    m_pending_release.push_back(handler);
+    if (!m_dispatching)
+    {
+        ProcessPending();
+    }
+    return ret;
+}
+
+/// 从reactor中移除handler并关闭其句柄
+/// @param  handler 要关闭的事件处理器
+/// @retval 0       移除成功
+/// @retval -1      移除出错(句柄仍会被关闭)
+int ReactorImplementation::CloseHandler(EventHandler * handler)
+{
+    handle_t handle = handler->GetHandle();
+    /// 先登记关闭再移除, 不在事件分发中时移除会立即处理待关闭的句柄
+    m_pending_close.push_back(handle);
+    int ret = RemoveHandler(handler);
+    if (ret != 0 && !m_dispatching)
+    {
+        ProcessPending();
+    }
+    return ret;
 }
 
 /// 处理事件,回调注册的handler中相应的事件处理函数
 /// @param  timeout 超时时间(毫秒)
 void ReactorImplementation::HandleEvents(int timeout)
 {
-    m_demultiplexer->WaitEvents(&m_handlers);
+    m_thread_id.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    m_dispatching = true;
+    WaitEvents(timeout);
+#if !defined(__linux__)
+    /// 没有timerfd的平台在每轮事件之后检查定时器
+    m_timer_queue.ProcessExpired();
+#endif
+    RunTasks();
+    m_dispatching = false;
+    ProcessPending();
+    if (!m_budget_waiters.empty())
+    {
+        CheckMemoryBudget();
+    }
+}
+
+/// 等待并分发事件, 开启忙轮询时先在预算内以0超时反复等待
+/// 预算内取到事件(包括唤醒和定时器)为命中; 预算用完仍没有事件为未命中, 转入阻塞等待.
+/// 自旋加阻塞的整个周期在指标中计为一次等待, 空的探测不计
+void ReactorImplementation::WaitEvents(int timeout)
+{
+    if (m_spin_nanos > 0 && timeout != 0)
+    {
+        uint64_t deadline = MonotonicNanos() + m_spin_nanos;
+        m_metrics.BeginSpin();
+        do
+        {
+            if (m_demultiplexer->WaitEvents(&m_handlers, 0) > 0)
+            {
+                m_metrics.AddSpinHits(1);
+                m_metrics.EndSpin();
+                return;
+            }
+        } while (MonotonicNanos() < deadline);
+        m_metrics.AddSpinMisses(1);
+        m_metrics.StopProbing();
+    }
+    m_demultiplexer->WaitEvents(&m_handlers, timeout);
+    m_metrics.EndSpin();
+}
+
+/// 为socket设置SO_BUSY_POLL, 非socket的句柄(eventfd, timerfd)会失败, 忽略
+void ReactorImplementation::SetSocketBusyPoll(handle_t handle)
+{
+#if defined(__linux__)
+    int usec = m_busy_poll_usec;
+    ::setsockopt(handle, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec));
+#endif
+}
+
+/// 设置忙轮询
+/// @param  spin_usec       每次阻塞等待前自旋的时间预算(微秒), 0关闭
+/// @param  busy_poll_usec  内核忙轮询的时间(微秒), 0不设置
+void ReactorImplementation::SetBusyPoll(int spin_usec, int busy_poll_usec)
+{
+    m_spin_nanos = spin_usec > 0 ? static_cast<uint64_t>(spin_usec) * 1000 : 0;
+    busy_poll_usec = busy_poll_usec > 0 ? busy_poll_usec : 0;
+    if (busy_poll_usec == m_busy_poll_usec)
+    {
+        return;
+    }
+    m_busy_poll_usec = busy_poll_usec;
+    m_demultiplexer->SetBusyPoll(m_busy_poll_usec);
+    for (size_t idx = 0; idx < m_handlers.Size(); ++idx)
+    {
+        if (m_handlers[idx].handler != NULL)
+        {
+            SetSocketBusyPoll(static_cast<handle_t>(idx));
+        }
+    }
+}
+
+/// 把事件循环线程绑定到cpu上, 在Run开始时生效
+/// @param  cpu     cpu编号, -1不绑定
+/// @retval 0       成功
+/// @retval < 0     cpu不在进程可用的cpu中(-EINVAL), 或平台不支持
+int ReactorImplementation::SetCpuAffinity(int cpu)
+{
+#if defined(__linux__)
+    if (cpu >= 0)
+    {
+        cpu_set_t allowed;
+        if (cpu >= CPU_SETSIZE || ::sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || !CPU_ISSET(cpu, &allowed))
+        {
+            return -EINVAL;
+        }
+    }
+    m_cpu = cpu;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/// 把当前线程绑定到m_cpu
+void ReactorImplementation::BindCpu()
+{
+#if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(m_cpu, &cpus);
+    ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus);
+#endif
+}
+
+/// 缓冲区内存回落到预算的3/4以下时, 执行等待内存的任务
+/// 在本轮的handler都已释放之后检查, 关闭的连接归还的内存计算在内
+void ReactorImplementation::CheckMemoryBudget()
+{
+    if (m_memory_budget > 0 && m_buffer_pool.BytesInUse() > m_memory_budget / 4 * 3)
+    {
+        return;
+    }
+    std::vector<Functor> waiters;
+    waiters.swap(m_budget_waiters);
+    for (size_t idx = 0; idx < waiters.size(); ++idx)
+    {
+        waiters[idx]();
+    }
+    ProcessPending();
+}
+
+/// 执行任务队列中的任务, 每轮最多kMaxTasksPerTurn个
+void ReactorImplementation::RunTasks()
+{
+    /// 先清标志再取任务: 之后投递的任务要么在本轮被取到, 要么再次唤醒
+    m_task_wakeup.store(false);
+    Functor task;
+    for (int count = 0; count < kMaxTasksPerTurn; ++count)
+    {
+        if (!m_tasks.Pop(&task))
+        {
+            return;
+        }
+        task();
+        task = Functor();
+    }
+    /// 还有任务没执行完, 让下一轮等待立即返回
+    if (!m_task_wakeup.exchange(true))
+    {
+        Wakeup();
+    }
+}
+
+/// 唤醒阻塞在WaitEvents中的事件循环
+void ReactorImplementation::Wakeup()
+{
+#if defined(__linux__)
+    m_wakeup_handler.Wakeup();
+#endif
+}
+
+/// 释放移除的handler的引用并关闭待关闭的句柄
+void ReactorImplementation::ProcessPending()
+{
+    for (size_t idx = 0; idx < m_pending_close.size(); ++idx)
+    {
+#if defined(_WIN32)
+        ::closesocket(m_pending_close[idx]);
+#else
+        ::close(m_pending_close[idx]);
+#endif
+    }
+    m_pending_close.clear();
+    /// 交换出来再释放, handler析构时可能再移除其他handler
+    std::vector<EventHandler *> releasing;
+    releasing.swap(m_pending_release);
+    for (size_t idx = 0; idx < releasing.size(); ++idx)
+    {
+        releasing[idx]->Release();
+    }
+    if (m_pending_release.empty())
+    {
+        /// 保留容量, 稳态下不再分配
+        releasing.clear();
+        releasing.swap(m_pending_release);
+    }
+}
+
+/// 运行事件循环, 阻塞等待并处理事件, 直到Stop被调用
+void ReactorImplementation::Run()
+{
+    if (m_cpu >= 0)
+    {
+        BindCpu();
+    }
+    while (!m_quit.load(std::memory_order_acquire))
+    {
+        HandleEvents(kRunTimeout);
+    }
+    m_quit.store(false, std::memory_order_relaxed);
+}
+
+/// 停止事件循环(线程安全), 会唤醒阻塞中的Run
+void ReactorImplementation::Stop()
+{
+    m_quit.store(true, std::memory_order_release);
+    Wakeup();
+}
+
+/// 在事件循环线程中执行task(线程安全)
+void ReactorImplementation::RunInLoop(const Functor & task)
+{
+    if (IsInLoopThread())
+    {
+        task();
+    }
+    else
+    {
+        QueueInLoop(task);
+    }
+}
+
+/// 将task放入任务队列, 由事件循环在本轮事件处理之后执行(线程安全, 无锁)
+void ReactorImplementation::QueueInLoop(const Functor & task)
+{
+    m_tasks.Push(task);
+    if (!m_task_wakeup.exchange(true))
+    {
+        Wakeup();
+    }
+}
+
+/// 当前线程是否为事件循环线程
+bool ReactorImplementation::IsInLoopThread() const
+{
+    return m_thread_id.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+/// 添加定时器, 到期时在事件循环中回调, O(1)
+/// @param  delay    首次触发的延迟(毫秒)
+/// @param  period   触发周期(毫秒), 0表示只触发一次
+/// @param  callback 到期时的回调函数
+/// @retval 定时器id, 用于CancelTimer
+timer_id_t ReactorImplementation::ScheduleTimer(int delay, int period, const TimerCallback & callback)
+{
+    return m_timer_queue.Schedule(delay, period, callback);
+}
+
+/// 取消定时器, O(1)
+/// @param  id      ScheduleTimer返回的定时器id
+/// @retval 0       取消成功
+/// @retval -1      定时器不存在或已到期
+int ReactorImplementation::CancelTimer(timer_id_t id)
+{
+    return m_timer_queue.Cancel(id);
+}
+
+/// 提交异步接收(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+/// @retval 0       提交成功
+/// @retval < 0     提交出错或分离器不支持
+int ReactorImplementation::AsyncRead(handle_t handle, void * buf, size_t len, const CompletionCallback & callback)
+{
+    return m_demultiplexer->AsyncRead(handle, buf, len, callback);
+}
+
+/// 提交异步发送(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+/// @retval 0       提交成功
+/// @retval < 0     提交出错或分离器不支持
+int ReactorImplementation::AsyncWrite(handle_t handle, const void * buf, size_t len, const CompletionCallback & callback)
+{
+    return m_demultiplexer->AsyncWrite(handle, buf, len, callback);
+}
+
+/// 提交异步accept(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+/// @retval 0       提交成功
+/// @retval < 0     提交出错或分离器不支持
+int ReactorImplementation::AsyncAccept(handle_t handle, const CompletionCallback & callback)
+{
+    return m_demultiplexer->AsyncAccept(handle, callback);
+}
+
+/// 获取reactor的缓冲区内存池
+BufferPool * ReactorImplementation::GetBufferPool()
+{
+    return &m_buffer_pool;
+}
+
+/// 设置该reactor上连接缓冲区的内存预算
+/// @param  bytes   内存预算(字节), 0不限制
+void ReactorImplementation::SetMemoryBudget(size_t bytes)
+{
+    m_memory_budget = bytes;
+}
+
+/// 缓冲区内存是否超出预算
+bool ReactorImplementation::OverMemoryBudget() const
+{
+    return m_memory_budget > 0 && m_buffer_pool.BytesInUse() > m_memory_budget;
+}
+
+/// 等待缓冲区内存回落到预算的3/4以下后执行task一次
+void ReactorImplementation::WaitMemoryBudget(const Functor & task)
+{
+    m_budget_waiters.push_back(task);
+}
+
+/// 获取reactor的运行指标
+ReactorMetrics * ReactorImplementation::GetMetrics()
+{
+    return &m_metrics;
+}
+
+/// 获取实际使用的事件分离器
+demultiplexer_t ReactorImplementation::GetDemultiplexerType() const
+{
+    return m_type;
 }
-} // namespace reactor
\ No newline at end of file
+} // namespace reactor
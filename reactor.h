@@ -4,11 +4,14 @@
 #ifdef _WIN32
 	#define FD_SETSIZE 8192
 	#include <Winsock2.h>
+	#include <stdint.h>
 #elif defined(__linux__)
 	#include <stdint.h>
 	#include <unistd.h>
 	#include <sys/epoll.h>
 #endif
+#include <atomic>
+#include <functional>
 
 /// @file   reactor.h
 /// @brief
@@ -21,10 +24,20 @@ namespace reactor
 typedef unsigned int event_t;
 enum
 {
-    kReadEvent    = 0x01, ///<读事件掩码
-    kWriteEvent   = 0x02, ///<写事件掩码
-    kErrorEvent   = 0x04, ///<错误事件掩码
-    kEventMask    = 0xff  ///<事件掩码
+    kReadEvent     = 0x01, ///<读事件掩码
+    kWriteEvent    = 0x02, ///<写事件掩码
+    kErrorEvent    = 0x04, ///<错误事件掩码
+    kErrQueueEvent = 0x08, ///<错误队列事件(linux的epoll/poll/io_uring): 句柄出错时回调HandleErrQueue而不是HandleError
+    kEventMask     = 0xff  ///<事件掩码
+};
+
+/// 注册方式, 与事件掩码按位或后传给RegisterHandler
+/// 不指定时为一次性关注(oneshot), 事件触发一次后须重新注册
+enum
+{
+    kPersistEvent  = 0x100, ///<持续关注(水平触发), 触发后无需重新注册
+    kEdgeTriggered = 0x200, ///<边缘触发(持续关注), handler须读写至EAGAIN
+    kModeMask      = 0xf00  ///<注册方式掩码
 };
 
 /// 定义跨平台的socket
@@ -36,6 +49,29 @@ enum
 #error "failure"
 #endif // _WIN32
 
+/// 定时器id, 0为无效id
+typedef uint64_t timer_id_t;
+
+/// 定时器回调函数
+typedef std::function<void()> TimerCallback;
+
+/// 交给事件循环执行的任务
+typedef std::function<void()> Functor;
+
+/// 异步操作完成回调, result为传输的字节数或新连接的句柄, 出错时为-errno
+typedef std::function<void(int result)> CompletionCallback;
+
+/// 事件分离器类型
+typedef int demultiplexer_t;
+enum
+{
+    kDefaultDemultiplexer = 0, ///<平台缺省: linux为编译时指定的分离器(默认epoll), windows为select
+    kEpollDemultiplexer   = 1, ///<epoll(linux)
+    kIoUringDemultiplexer = 2, ///<io_uring(linux), 内核不支持时退回epoll
+    kSelectDemultiplexer  = 3, ///<select, 句柄不能超过FD_SETSIZE, 主要用于对比测试
+    kPollDemultiplexer    = 4  ///<poll(linux), 没有句柄上限, 适合句柄不多的场景
+};
+
 /// 事件处理器
 class EventHandler
 {
@@ -53,46 +89,181 @@ public:
     /// 处理出错事件的回调函数
     virtual void HandleError() {}
 
+    /// 处理错误队列事件的回调函数, 关注了kErrQueueEvent时句柄出错先回调它
+    /// handler须用recvmsg(MSG_ERRQUEUE)读空错误队列; 队列为空说明是真正的socket错误, 缺省按出错处理
+    virtual void HandleErrQueue()
+    {
+        HandleError();
+    }
+
+    /// 增加引用计数(线程安全)
+    void AddRef()
+    {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// 减少引用计数(线程安全), 减到0时delete自身
+    /// 动态创建的handler用Release代替delete this, reactor持有的引用保证本轮事件处理中不被销毁
+    void Release()
+    {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            delete this;
+        }
+    }
+
 protected:
 
-    /// 构造函数,只能子类调
-    EventHandler() {}
+    /// 构造函数,只能子类调, 创建者持有一个引用
+    EventHandler() : m_refs(1) {}
 
     /// 析构函数,只能子类调
     virtual ~EventHandler() {}
+
+private:
+
+    std::atomic<int> m_refs; ///< 引用计数
 };
 
 /// reactor的实现类
 class ReactorImplementation;
 
+/// 缓冲区内存池
+class BufferPool;
+class ReactorMetrics;
+
 /// reactor反应器
 class Reactor
 {
 public:
 
     /// 构造函数
-    Reactor();
+    /// @param  type    使用的事件分离器
+    explicit Reactor(demultiplexer_t type = kDefaultDemultiplexer);
 
     /// 析构函数
     ~Reactor();
 
     /// 向reactor中注册关注事件evt的handler(可重入)
+    /// 持续关注的handler以相同的evt重复注册时不会再次设置分离器
     /// @param  handler 要注册的事件处理器
-    /// @param  evt     要关注的事件
+    /// @param  evt     要关注的事件, 可与kPersistEvent或kEdgeTriggered按位或
     /// @retval 0       注册成功
     /// @retval -1      注册出错
     int RegisterHandler(EventHandler * handler, event_t evt);
 
     /// 从reactor中移除handler
+    /// 注册时reactor对handler加了引用, 移除后在本轮事件处理结束时才释放
     /// @param  handler 要移除的事件处理器
     /// @retval 0       移除成功
     /// @retval -1      移除出错
     int RemoveHandler(EventHandler * handler);
 
+    /// 从reactor中移除handler并关闭其句柄
+    /// 句柄在本轮事件处理结束时统一关闭, 本轮中句柄号不会被新accept的连接复用
+    /// @param  handler 要关闭的事件处理器
+    /// @retval 0       移除成功
+    /// @retval -1      移除出错(句柄仍会被关闭)
+    int CloseHandler(EventHandler * handler);
+
     /// 处理事件,回调注册的handler中相应的事件处理函数
-    /// @param  timeout 超时时间(毫秒)
+    /// @param  timeout 超时时间(毫秒), 0不阻塞, -1一直阻塞到有事件发生
     void HandleEvents(int timeout = 0);
 
+    /// 运行事件循环, 阻塞等待并处理事件, 直到Stop被调用
+    void Run();
+
+    /// 停止事件循环(线程安全), 会唤醒阻塞中的Run
+    void Stop();
+
+    /// 设置忙轮询, 用CPU换取更低的唤醒延迟
+    /// Run和HandleEvents(timeout不为0)在阻塞等待前, 先以0超时反复等待至多spin_usec微秒, 期间取到事件即处理(命中),
+    /// 预算用完才阻塞等待(未命中); 命中和未命中的次数记在ReactorMetrics中.
+    /// busy_poll_usec大于0时, 还为已注册和之后注册的socket设置SO_BUSY_POLL, 并设置epoll的忙轮询参数(linux 6.9),
+    /// 由内核在收包路径上忙轮询网卡队列; 超过net.core.busy_read的值需要CAP_NET_ADMIN, 设置失败的句柄被忽略.
+    /// 只能在事件循环线程中或Run之前调用
+    /// @param  spin_usec       每次阻塞等待前自旋的时间预算(微秒), 0关闭
+    /// @param  busy_poll_usec  内核忙轮询的时间(微秒), 0不设置
+    void SetBusyPoll(int spin_usec, int busy_poll_usec = 0);
+
+    /// 把事件循环线程绑定到cpu上, 在Run开始时生效, 与忙轮询配合独占一个核
+    /// @param  cpu     cpu编号, -1不绑定
+    /// @retval 0       成功
+    /// @retval < 0     cpu不在进程可用的cpu中(-EINVAL), 或平台不支持
+    int SetCpuAffinity(int cpu);
+
+    /// 在事件循环线程中执行task(线程安全)
+    /// 在事件循环线程中调用时立即执行, 否则同QueueInLoop
+    void RunInLoop(const Functor & task);
+
+    /// 将task放入任务队列, 由事件循环在本轮事件处理之后执行(线程安全, 无锁)
+    /// 其他线程向连接回发结果时, 应先对handler AddRef, 在task中使用后Release
+    void QueueInLoop(const Functor & task);
+
+    /// 当前线程是否为事件循环线程(最近一次处理事件的线程, 运行前为创建reactor的线程)
+    bool IsInLoopThread() const;
+
+    /// 添加定时器, 到期时在事件循环中回调, O(1)
+    /// @param  delay    首次触发的延迟(毫秒)
+    /// @param  period   触发周期(毫秒), 0表示只触发一次
+    /// @param  callback 到期时的回调函数
+    /// @retval 定时器id, 用于CancelTimer
+    timer_id_t ScheduleTimer(int delay, int period, const TimerCallback & callback);
+
+    /// 取消定时器, O(1)
+    /// @param  id      ScheduleTimer返回的定时器id
+    /// @retval 0       取消成功
+    /// @retval -1      定时器不存在或已到期
+    int CancelTimer(timer_id_t id);
+
+    /// 提交异步接收(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+    /// @param  handle   socket句柄
+    /// @param  buf      接收缓冲区, 完成前须保持有效
+    /// @param  len      缓冲区长度
+    /// @param  callback 完成回调, result为接收的字节数或-errno
+    /// @retval 0       提交成功
+    /// @retval < 0     提交出错或分离器不支持
+    int AsyncRead(handle_t handle, void * buf, size_t len, const CompletionCallback & callback);
+
+    /// 提交异步发送(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+    /// @param  handle   socket句柄
+    /// @param  buf      发送缓冲区, 完成前须保持有效
+    /// @param  len      发送长度
+    /// @param  callback 完成回调, result为发送的字节数或-errno
+    /// @retval 0       提交成功
+    /// @retval < 0     提交出错或分离器不支持
+    int AsyncWrite(handle_t handle, const void * buf, size_t len, const CompletionCallback & callback);
+
+    /// 提交异步accept(proactor), 完成时在事件循环中回调, 仅io_uring分离器支持
+    /// @param  handle   监听socket句柄
+    /// @param  callback 完成回调, result为新连接的句柄(非阻塞)或-errno
+    /// @retval 0       提交成功
+    /// @retval < 0     提交出错或分离器不支持
+    int AsyncAccept(handle_t handle, const CompletionCallback & callback);
+
+    /// 获取reactor的缓冲区内存池, 供该reactor上的连接创建Buffer, 只能在事件循环线程中使用
+    BufferPool * GetBufferPool();
+
+    /// 设置该reactor上连接缓冲区的内存预算
+    /// 缓冲区内存池分出的内存超过预算时, TcpConnection不再读socket(撤销读事件的关注), 由TCP流控反压对端,
+    /// 内存回落到预算的3/4以下时恢复读; 慢速的对端再多, 缓冲区内存也不会无限增长.
+    /// 只能在事件循环线程中或Run之前调用
+    /// @param  bytes   内存预算(字节), 0不限制
+    void SetMemoryBudget(size_t bytes);
+
+    /// 缓冲区内存是否超出预算, 只能在事件循环线程中调用
+    bool OverMemoryBudget() const;
+
+    /// 等待缓冲区内存回落: 内存回落到预算的3/4以下后, 在那一轮事件处理结束时执行task一次
+    /// 只能在事件循环线程中调用
+    void WaitMemoryBudget(const Functor & task);
+
+    /// 获取reactor的运行指标, 由事件循环线程更新, 其Snapshot可在任意线程调用
+    ReactorMetrics * GetMetrics();
+
+    /// 获取实际使用的事件分离器, 请求的分离器不可用(如内核不支持io_uring)时为退回的epoll
+    demultiplexer_t GetDemultiplexerType() const;
+
 private:
 
     /// 禁止拷贝构造和赋值操作
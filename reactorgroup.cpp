@@ -0,0 +1,140 @@
+#include <errno.h>
+#if defined(__linux__)
+    #include <sched.h>
+#endif
+#include "reactorgroup.h"
+
+/// @file   reactorgroup.cpp
+/// @brief  多个reactor组成的事件循环组, 每个事件循环一个线程
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 构造函数
+/// @param  num     事件循环个数, <= 0时取CPU核数
+/// @param  type    各reactor使用的事件分离器
+ReactorGroup::ReactorGroup(int num, demultiplexer_t type)
+{
+    if (num <= 0)
+    {
+        num = static_cast<int>(std::thread::hardware_concurrency());
+        if (num <= 0)
+        {
+            num = 1;
+        }
+    }
+    for (int idx = 0; idx < num; ++idx)
+    {
+        m_reactors.push_back(new Reactor(type));
+    }
+}
+
+/// 析构函数, 停止并等待所有事件循环线程
+ReactorGroup::~ReactorGroup()
+{
+    Stop();
+    Join();
+    for (size_t idx = 0; idx < m_reactors.size(); ++idx)
+    {
+        delete m_reactors[idx];
+    }
+}
+
+/// 获取事件循环个数
+int ReactorGroup::Size() const
+{
+    return static_cast<int>(m_reactors.size());
+}
+
+/// 获取第idx个reactor
+Reactor * ReactorGroup::GetReactor(int idx)
+{
+    return m_reactors[idx];
+}
+
+/// 运行所有事件循环, 第0个在调用线程中运行, 其余各起一个线程
+/// 直到Stop被调用且所有线程退出后返回
+/// @param  pin_cpu 是否把第i个事件循环绑定到进程可用的第i个CPU, 调用线程返回前恢复原来的CPU亲和性
+/// @retval 0       事件循环已全部退出
+/// @retval < 0     设置CPU绑定失败, 事件循环没有运行
+int ReactorGroup::Run(bool pin_cpu)
+{
+#if defined(__linux__)
+    /// 调用线程(通常是main)不属于本组, 绑定只在运行期间有效
+    cpu_set_t saved;
+    bool restore = false;
+#endif
+    if (pin_cpu)
+    {
+#if defined(__linux__)
+        if (::sched_getaffinity(0, sizeof(saved), &saved) != 0)
+        {
+            return -errno;
+        }
+        restore = true;
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &saved))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        if (cpus.empty())
+        {
+            return -EINVAL;
+        }
+        for (size_t idx = 0; idx < m_reactors.size(); ++idx)
+        {
+            int ret = m_reactors[idx]->SetCpuAffinity(cpus[idx % cpus.size()]);
+            if (ret != 0)
+            {
+                return ret;
+            }
+        }
+#else
+        return -1;
+#endif
+    }
+    for (size_t idx = 1; idx < m_reactors.size(); ++idx)
+    {
+        Reactor * reactor = m_reactors[idx];
+        m_threads.push_back(std::thread([reactor]()
+        {
+            reactor->Run();
+        }));
+    }
+    m_reactors[0]->Run();
+    Join();
+#if defined(__linux__)
+    if (restore)
+    {
+        ::sched_setaffinity(0, sizeof(saved), &saved);
+    }
+#endif
+    return 0;
+}
+
+/// 停止所有事件循环(线程安全, 可在信号处理函数中调用)
+void ReactorGroup::Stop()
+{
+    for (size_t idx = 0; idx < m_reactors.size(); ++idx)
+    {
+        m_reactors[idx]->Stop();
+    }
+}
+
+/// 等待其余事件循环线程退出
+void ReactorGroup::Join()
+{
+    for (size_t idx = 0; idx < m_threads.size(); ++idx)
+    {
+        if (m_threads[idx].joinable())
+        {
+            m_threads[idx].join();
+        }
+    }
+    m_threads.clear();
+}
+} // namespace reactor
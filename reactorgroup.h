@@ -0,0 +1,63 @@
+#ifndef _REACTOR_GROUP_H_
+#define _REACTOR_GROUP_H_
+
+#include <vector>
+#include <thread>
+#include "reactor.h"
+
+/// @file   reactorgroup.h
+/// @brief  多个reactor组成的事件循环组, 每个事件循环一个线程
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// reactor组, 每个reactor运行在各自的线程上并可绑定到各自的CPU
+/// 每个reactor只能在其事件循环线程中注册handler, 或者在Run之前注册.
+/// 连接的分配通常由每个reactor各自持有一个SO_REUSEPORT的监听socket完成.
+class ReactorGroup
+{
+public:
+
+    /// 构造函数
+    /// @param  num     事件循环个数, <= 0时取CPU核数
+    /// @param  type    各reactor使用的事件分离器
+    explicit ReactorGroup(int num = 0, demultiplexer_t type = kDefaultDemultiplexer);
+
+    /// 析构函数, 停止并等待所有事件循环线程
+    ~ReactorGroup();
+
+    /// 获取事件循环个数
+    int Size() const;
+
+    /// 获取第idx个reactor
+    Reactor * GetReactor(int idx);
+
+    /// 运行所有事件循环, 第0个在调用线程中运行, 其余各起一个线程
+    /// 直到Stop被调用且所有线程退出后返回
+    /// @param  pin_cpu 是否把第i个事件循环绑定到进程可用的第i个CPU(可用的CPU不够时轮转), 缺省不绑定,
+    ///                 各reactor用SetCpuAffinity设置的绑定不变; 调用线程只在运行期间绑定, 返回前恢复原来的CPU亲和性
+    /// @retval 0       事件循环已全部退出
+    /// @retval < 0     设置CPU绑定失败(SetCpuAffinity的返回值), 事件循环没有运行
+    int Run(bool pin_cpu = false);
+
+    /// 停止所有事件循环(线程安全, 可在信号处理函数中调用)
+    void Stop();
+
+private:
+
+    /// 等待其余事件循环线程退出
+    void Join();
+
+    /// 禁止拷贝构造和赋值操作
+    ReactorGroup(const ReactorGroup &);
+    ReactorGroup & operator=(const ReactorGroup &);
+
+private:
+
+    std::vector<Reactor *>     m_reactors; ///< 各事件循环
+    std::vector<std::thread>   m_threads;  ///< 第1~n-1个事件循环的线程
+};
+} // namespace reactor
+
+#endif // _REACTOR_GROUP_H_
@@ -0,0 +1,111 @@
+#ifndef _TASK_QUEUE_H_
+#define _TASK_QUEUE_H_
+
+#include <atomic>
+#include "reactor.h"
+
+/// @file   taskqueue.h
+/// @brief  多生产者单消费者的无锁任务队列
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 多生产者单消费者的无锁任务队列(Vyukov侵入式MPSC队列)
+/// 任意线程Push, 只有事件循环线程Pop. Push只有一次原子交换, 不加锁;
+/// 生产者在交换后、链接前被挂起时Pop暂时看不到之后的任务, 生产者完成链接后即可见.
+class TaskQueue
+{
+public:
+
+    /// 构造函数
+    TaskQueue() : m_head(&m_stub), m_tail(&m_stub)
+    {
+        m_stub.next.store(NULL, std::memory_order_relaxed);
+    }
+
+    /// 析构函数, 丢弃未执行的任务
+    ~TaskQueue()
+    {
+        Functor task;
+        while (Pop(&task))
+        {
+        }
+    }
+
+    /// 添加任务(线程安全)
+    void Push(const Functor & task)
+    {
+        Push(new Node(task));
+    }
+
+    /// 取出一个任务, 只能在消费者线程调用
+    /// @retval true    取到任务
+    /// @retval false   队列为空(或生产者尚未完成链接)
+    bool Pop(Functor * task)
+    {
+        Node * tail = m_tail;
+        Node * next = tail->next.load(std::memory_order_acquire);
+        if (tail == &m_stub)
+        {
+            if (next == NULL)
+            {
+                return false;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next == NULL)
+        {
+            if (tail != m_head.load(std::memory_order_acquire))
+            {
+                /// 有生产者正在链接
+                return false;
+            }
+            /// tail是最后一个节点, 放回哨兵后才能取出它
+            Push(&m_stub);
+            next = tail->next.load(std::memory_order_acquire);
+            if (next == NULL)
+            {
+                return false;
+            }
+        }
+        m_tail = next;
+        task->swap(tail->task);
+        delete tail;
+        return true;
+    }
+
+private:
+
+    /// 队列节点
+    struct Node
+    {
+        Node() {}
+        explicit Node(const Functor & fn) : task(fn) {}
+
+        std::atomic<Node *> next; ///< 下一个节点
+        Functor             task; ///< 任务
+    };
+
+    /// 将节点链到队尾
+    void Push(Node * node)
+    {
+        node->next.store(NULL, std::memory_order_relaxed);
+        Node * prev = m_head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    TaskQueue(const TaskQueue &);
+    TaskQueue & operator=(const TaskQueue &);
+
+private:
+
+    std::atomic<Node *> m_head; ///< 队尾, 生产者在此追加
+    Node *              m_tail; ///< 队首, 只有消费者访问
+    Node                m_stub; ///< 哨兵节点
+};
+} // namespace reactor
+
+#endif // _TASK_QUEUE_H_
@@ -0,0 +1,824 @@
+#include <errno.h>
+#include <string.h>
+#if defined(__linux__)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/uio.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <sys/sendfile.h>
+    #include <netinet/in.h>
+    #include <linux/errqueue.h>
+#endif
+#include "tcpconnection.h"
+#include "metrics.h"
+
+/// @file   tcpconnection.cpp
+/// @brief  TCP连接, 管理输入输出缓冲区和写事件的关注
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+#if defined(__linux__)
+/// 较旧的glibc头文件中没有零拷贝发送的定义(linux 4.14)
+#if !defined(SO_ZEROCOPY)
+    #define SO_ZEROCOPY 60
+#endif
+#if !defined(MSG_ZEROCOPY)
+    #define MSG_ZEROCOPY 0x4000000
+#endif
+#endif
+
+namespace reactor
+{
+/// 构造函数
+/// @param  reactor 连接所属的reactor
+/// @param  handle  已连接的socket
+TcpConnection::TcpConnection(Reactor * reactor, handle_t handle)
+    : EventHandler(), m_reactor(reactor), m_handle(handle), m_state(kConnected),
+      m_in_callback(false), m_paused(0), m_writing(false), m_input(reactor->GetBufferPool()), m_output_bytes(0),
+      m_input_high(0), m_input_low(0), m_output_high(0), m_output_low(0), m_pipe_bytes(0), m_zerocopy(false), m_zc_threshold(0), m_zc_next(0), m_zc_acked(0),
+      m_zc_timer(0), m_zc_linger(0)
+{
+    m_pipe[0] = -1;
+    m_pipe[1] = -1;
+}
+
+/// 析构函数, 只能通过Close销毁
+TcpConnection::~TcpConnection()
+{
+#if defined(__linux__)
+    if (m_pipe[0] >= 0)
+    {
+        ::close(m_pipe[0]);
+        ::close(m_pipe[1]);
+    }
+#endif
+}
+
+/// 获取该handler所对应的句柄
+handle_t TcpConnection::GetHandle() const
+{
+    return m_handle;
+}
+
+/// 获取连接所属的reactor
+Reactor * TcpConnection::GetReactor() const
+{
+    return m_reactor;
+}
+
+/// 把socket设为非阻塞并开始关注读事件
+/// @retval 0       成功
+/// @retval < 0     注册出错
+int TcpConnection::Start()
+{
+#if defined(__linux__)
+    int flags = ::fcntl(m_handle, F_GETFL, 0);
+    ::fcntl(m_handle, F_SETFL, flags | O_NONBLOCK);
+#elif defined(_WIN32)
+    u_long on = 1;
+    ::ioctlsocket(m_handle, FIONBIO, &on);
+#endif
+    return m_reactor->RegisterHandler(this, kPersistEvent | (m_paused == 0 ? kReadEvent : 0) | (m_zerocopy ? kErrQueueEvent : 0));
+}
+
+/// 发送数据, 数据被复制到输出链
+void TcpConnection::Send(const void * data, size_t len)
+{
+    if (m_state != kConnected || len == 0)
+    {
+        return;
+    }
+    if (m_output.empty() || m_output.back().file >= 0 || m_output.back().zerocopy ||
+            m_output.back().data.ReadableBytes() >= kChunkSize)
+    {
+        AppendChunk();
+    }
+    m_output.back().data.Append(data, len);
+    AddOutput(len);
+    /// 回调中的发送留到回调结束时合并发出
+    if (!m_in_callback && !m_writing && m_state == kConnected)
+    {
+        Flush();
+    }
+}
+
+/// 发送缓冲区中的全部数据, 缓冲区的内存直接挂到输出链上, 不复制
+void TcpConnection::Send(Buffer * buffer)
+{
+    size_t len = buffer->ReadableBytes();
+    if (m_state != kConnected || len == 0)
+    {
+        return;
+    }
+    AppendChunk().data.Swap(*buffer);
+    AddOutput(len);
+    if (!m_in_callback && !m_writing && m_state == kConnected)
+    {
+        Flush();
+    }
+}
+
+#if defined(__linux__)
+/// 发送文件的一段, 与Send的数据按调用顺序发出
+/// @param  fd      文件句柄
+/// @param  offset  起始偏移, 只对普通文件有效, 不改变fd的文件偏移
+/// @param  len     发送的字节数, 普通文件为0时发送到文件末尾
+/// @retval 0       成功
+/// @retval < 0     出错(-errno), 连接已关闭时为-EPIPE
+int TcpConnection::SendFile(int fd, int64_t offset, size_t len)
+{
+    if (m_state != kConnected)
+    {
+        return -EPIPE;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        return -errno;
+    }
+    bool regular = S_ISREG(st.st_mode);
+    if (regular && len == 0 && offset < st.st_size)
+    {
+        len = static_cast<size_t>(st.st_size - offset);
+    }
+    if (len == 0)
+    {
+        return 0;
+    }
+    int file = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (file < 0)
+    {
+        return -errno;
+    }
+    OutputChunk & chunk = AppendChunk();
+    chunk.file = file;
+    chunk.regular = regular;
+    chunk.offset = offset;
+    chunk.length = len;
+    AddOutput(len);
+    if (!m_in_callback && !m_writing && m_state == kConnected)
+    {
+        Flush();
+    }
+    return 0;
+}
+
+/// 开启零拷贝发送: 设置SO_ZEROCOPY, 输出链中不小于threshold字节的缓冲区用MSG_ZEROCOPY发送
+/// @param  threshold   使用零拷贝的最小缓冲区字节数
+/// @retval 0       成功
+/// @retval < 0     出错(-errno), 如内核不支持SO_ZEROCOPY
+int TcpConnection::EnableZeroCopy(size_t threshold)
+{
+    if (m_state != kConnected)
+    {
+        return -EPIPE;
+    }
+    int on = 1;
+    if (::setsockopt(m_handle, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) != 0)
+    {
+        return -errno;
+    }
+    m_zc_threshold = threshold > 0 ? threshold : 1;
+    if (!m_zerocopy)
+    {
+        /// 完成通知放在错误队列中, 以kErrQueueEvent分发到HandleErrQueue
+        m_zerocopy = true;
+        UpdateInterest();
+    }
+    return 0;
+}
+#endif
+
+/// 关闭连接, 先尽量发出输出链中的数据; 在回调中调用时在回调结束后关闭
+void TcpConnection::Close()
+{
+    if (m_state != kConnected)
+    {
+        return;
+    }
+    m_state = kClosing;
+    if (!m_in_callback)
+    {
+        Destroy();
+    }
+}
+
+/// 暂停读: 撤销对读事件的关注, 数据留在内核接收缓冲区, 由TCP流控反压对端
+void TcpConnection::PauseReading()
+{
+    SetPaused(kPausedByUser, true);
+}
+
+/// 恢复读: 重新关注读事件, 水位或内存预算引起的暂停仍然有效
+void TcpConnection::ResumeReading()
+{
+    SetPaused(kPausedByUser, false);
+}
+
+/// 是否关注读事件
+bool TcpConnection::IsReading() const
+{
+    return m_paused == 0;
+}
+
+/// 设置输入缓冲区的高低水位
+/// @param  high    高水位(字节), 0不限制
+/// @param  low     低水位(字节), 不大于high
+void TcpConnection::SetInputWaterMarks(size_t high, size_t low)
+{
+    m_input_high = high;
+    m_input_low = low < high ? low : high;
+    CheckInputWaterMark();
+}
+
+/// 设置输出链的高低水位
+/// @param  high    高水位(字节), 0不限制
+/// @param  low     低水位(字节), 不大于high
+void TcpConnection::SetOutputWaterMarks(size_t high, size_t low)
+{
+    m_output_high = high;
+    m_output_low = low < high ? low : high;
+    if ((m_paused & kPausedByOutput) && (m_output_high == 0 || m_output_bytes <= m_output_low))
+    {
+        SetPaused(kPausedByOutput, false);
+    }
+}
+
+/// 把输入缓冲区中尚未取走的数据再交给OnMessage
+void TcpConnection::ProcessInput()
+{
+    if (m_state == kConnected && !m_in_callback && m_input.ReadableBytes() > 0)
+    {
+        DeliverInput();
+    }
+}
+
+/// 输出链中待发送的字节数
+size_t TcpConnection::OutputBytes() const
+{
+    return m_output_bytes;
+}
+
+/// 连接是否已关闭
+bool TcpConnection::IsClosed() const
+{
+    return m_state != kConnected;
+}
+
+/// 连接关闭后的回调, 缺省释放创建者的引用
+void TcpConnection::OnClose()
+{
+    Release();
+}
+
+/// 缓冲区达到高水位的回调, 缺省什么也不做
+void TcpConnection::OnHighWaterMark(WaterMark /*which*/, size_t /*bytes*/)
+{
+}
+
+/// 读事件: 读入输入缓冲区并交给OnMessage
+void TcpConnection::HandleRead()
+{
+    if (m_reactor->OverMemoryBudget())
+    {
+        WaitMemoryBudget();
+        return;
+    }
+    int saved_errno = 0;
+    int len = m_input.ReadFd(m_handle, &saved_errno);
+    if (len > 0)
+    {
+        m_reactor->GetMetrics()->AddBytesIn(static_cast<uint64_t>(len));
+        DeliverInput();
+    }
+    else if (len == 0 || (saved_errno != EAGAIN && saved_errno != EINTR))
+    {
+        m_state = kClosing;
+        Destroy();
+    }
+}
+
+/// 写事件: 继续发送输出链
+void TcpConnection::HandleWrite()
+{
+    Flush();
+}
+
+/// 出错事件: 关闭连接
+void TcpConnection::HandleError()
+{
+    DropOutput();
+    m_state = kClosing;
+    Destroy();
+}
+
+/// 错误队列事件: 读取零拷贝的完成通知, 释放已发完的缓冲区
+/// 错误队列为空说明是真正的socket错误, 按出错处理
+void TcpConnection::HandleErrQueue()
+{
+#if defined(__linux__)
+    if (DrainErrQueue())
+    {
+        return;
+    }
+#endif
+    HandleError();
+}
+
+#if defined(__linux__)
+/// 读取错误队列中的零拷贝完成通知
+/// @retval true    取到了通知
+/// @retval false   错误队列中没有通知
+bool TcpConnection::DrainErrQueue()
+{
+    bool notified = false;
+    for (;;)
+    {
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(m_handle, &msg, MSG_ERRQUEUE) < 0)
+        {
+            /// EAGAIN: 错误队列已读空
+            break;
+        }
+        for (cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) &&
+                    !(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+            const sock_extended_err * err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+            {
+                continue;
+            }
+            notified = true;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+            {
+                /// 内核退回了复制(如回环接口或网卡不支持), 零拷贝只剩页锁定和通知的开销
+                m_zc_threshold = 0;
+            }
+            CompleteZeroCopy(err->ee_info, err->ee_data);
+        }
+    }
+    return notified;
+}
+
+/// 关闭时还有未确认的零拷贝发送: 关闭写方向并撤销注册, 定时检查通知, 到齐后才关闭socket
+/// 对端关闭后HUP会一直就绪, 撤销注册后改为定时读取错误队列; 定时器持有一个引用
+void TcpConnection::LingerZeroCopy()
+{
+    /// 已排队的数据照常发出, 之后对端收到FIN
+    ::shutdown(m_handle, SHUT_WR);
+    m_reactor->RemoveHandler(this);
+    AddRef();
+    m_zc_linger = kZeroCopyLingerTimeout / kZeroCopyLingerInterval;
+    m_zc_timer = m_reactor->ScheduleTimer(kZeroCopyLingerInterval, kZeroCopyLingerInterval,
+                                          std::bind(&TcpConnection::CheckZeroCopyLinger, this));
+}
+
+/// 关闭后定时检查零拷贝的完成通知, 到齐或超时后关闭socket并释放连接
+void TcpConnection::CheckZeroCopyLinger()
+{
+    DrainErrQueue();
+    if (m_zc_acked != m_zc_next && --m_zc_linger > 0)
+    {
+        return;
+    }
+    if (m_zc_acked != m_zc_next)
+    {
+        /// 超时: 内核可能仍在引用这些内存, 不能归还内存池被其他连接复用
+        for (size_t idx = 0; idx < m_pinned.size(); ++idx)
+        {
+            m_pinned[idx].data.Abandon();
+        }
+    }
+    m_reactor->CancelTimer(m_zc_timer);
+    ::close(m_handle);
+    Release();
+}
+#endif
+
+/// 输出链的一段
+TcpConnection::OutputChunk::OutputChunk(BufferPool * pool)
+    : data(pool), file(-1), regular(false), offset(0), length(0), zerocopy(false), zc_id(0)
+{
+}
+
+/// 文件段持有的句柄在发完或连接关闭时关闭
+TcpConnection::OutputChunk::~OutputChunk()
+{
+#if defined(__linux__)
+    if (file >= 0)
+    {
+        ::close(file);
+    }
+#endif
+}
+
+/// 待发送的字节数
+size_t TcpConnection::OutputChunk::Bytes() const
+{
+    return file >= 0 ? length : data.ReadableBytes();
+}
+
+/// 发出了len字节, 返回本段剩余的字节数
+size_t TcpConnection::OutputChunk::Consume(size_t len)
+{
+    if (file >= 0)
+    {
+        length -= len;
+        return length;
+    }
+    data.Retrieve(len);
+    return data.ReadableBytes();
+}
+
+/// 输出链的尾部追加一个新段
+TcpConnection::OutputChunk & TcpConnection::AppendChunk()
+{
+    m_output.emplace_back(m_reactor->GetBufferPool());
+    return m_output.back();
+}
+
+/// 用writev发送输出链, 遇到文件段时改用sendfile/splice, 并按是否发完更新写事件的关注
+void TcpConnection::Flush()
+{
+    while (m_output_bytes > 0)
+    {
+        size_t tried = 0;
+#if defined(__linux__)
+        ssize_t n;
+        if (m_output.front().file >= 0)
+        {
+            n = SendFileChunk(m_output.front(), &tried);
+        }
+        else if (UseZeroCopy(m_output.front()))
+        {
+            tried = m_output.front().data.ReadableBytes();
+            n = SendZeroCopy(m_output.front());
+        }
+        else
+        {
+            /// 文件段和零拷贝段之前的内存数据一次writev发出
+            iovec vec[kMaxIovecs];
+            int count = 0;
+            for (std::deque<OutputChunk>::iterator it = m_output.begin();
+                    it != m_output.end() && it->file < 0 && !UseZeroCopy(*it) && count < kMaxIovecs; ++it, ++count)
+            {
+                vec[count].iov_base = const_cast<char *>(it->data.Peek());
+                vec[count].iov_len = it->data.ReadableBytes();
+                tried += vec[count].iov_len;
+            }
+            n = ::writev(m_handle, vec, count);
+        }
+#else
+        tried = m_output.front().data.ReadableBytes();
+        int n = ::send(m_handle, m_output.front().data.Peek(), static_cast<int>(tried), 0);
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                /// 对端已关闭或读文件出错, 丢弃输出并关闭连接
+                Abort();
+                return;
+            }
+            break;
+        }
+        m_output_bytes -= n;
+        m_reactor->GetMetrics()->AddBytesOut(static_cast<uint64_t>(n));
+        size_t left = static_cast<size_t>(n);
+        while (left > 0)
+        {
+            OutputChunk & front = m_output.front();
+            size_t bytes = front.Bytes();
+            if (left < bytes)
+            {
+                front.Consume(left);
+                break;
+            }
+            left -= bytes;
+            PopOutput();
+        }
+        if (static_cast<size_t>(n) < tried)
+        {
+            /// 没写完说明发送缓冲区已满, 等待写事件
+            break;
+        }
+    }
+
+    bool writing = m_output_bytes > 0;
+    if (writing != m_writing && m_state != kClosed)
+    {
+        m_writing = writing;
+        UpdateInterest();
+    }
+    if ((m_paused & kPausedByOutput) && m_output_bytes <= m_output_low)
+    {
+        SetPaused(kPausedByOutput, false);
+    }
+}
+
+#if defined(__linux__)
+/// 发送输出链头部的文件段
+/// 普通文件用sendfile从offset处直接发到socket; 其他句柄先splice进内部管道, 再从管道splice到socket,
+/// 管道中没发出去的数据记在m_pipe_bytes中, 写事件到来时先发它们.
+/// @param  chunk   文件段
+/// @param  tried   本次尝试发送的字节数
+/// @retval >= 0    发到socket的字节数
+/// @retval < 0     出错, errno为EAGAIN时是socket发送缓冲区满
+ssize_t TcpConnection::SendFileChunk(OutputChunk & chunk, size_t * tried)
+{
+    ssize_t n;
+    if (chunk.regular)
+    {
+        *tried = chunk.length;
+        off_t offset = static_cast<off_t>(chunk.offset);
+        n = ::sendfile(m_handle, chunk.file, &offset, chunk.length);
+        if (n > 0)
+        {
+            chunk.offset = offset;
+        }
+    }
+    else
+    {
+        if (m_pipe[0] < 0 && ::pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+        {
+            m_pipe[0] = -1;
+            return -1;
+        }
+        if (m_pipe_bytes == 0)
+        {
+            n = ::splice(chunk.file, NULL, m_pipe[1], NULL, chunk.length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n <= 0)
+            {
+                /// 源句柄没有数据可读时无法等待, 按出错处理
+                if (n == 0 || errno == EAGAIN)
+                {
+                    errno = EIO;
+                }
+                return -1;
+            }
+            m_pipe_bytes = static_cast<size_t>(n);
+        }
+        *tried = m_pipe_bytes;
+        n = ::splice(m_pipe[0], NULL, m_handle, NULL, m_pipe_bytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            m_pipe_bytes -= n;
+        }
+    }
+    if (n == 0)
+    {
+        /// 文件比登记的长度短
+        errno = EIO;
+        return -1;
+    }
+    return n;
+}
+
+/// 输出链头部的内存段是否用MSG_ZEROCOPY发送
+/// 已经零拷贝发送过一部分的段继续用零拷贝, 以便整段按最后一次发送的通知序号释放
+bool TcpConnection::UseZeroCopy(const OutputChunk & chunk) const
+{
+    return chunk.zerocopy || (m_zc_threshold > 0 && chunk.data.ReadableBytes() >= m_zc_threshold);
+}
+
+/// 用MSG_ZEROCOPY发送输出链头部的内存段
+/// 内核为每次成功的发送调用依次分配通知序号, 段记下最后一次的序号
+ssize_t TcpConnection::SendZeroCopy(OutputChunk & chunk)
+{
+    ssize_t n = ::send(m_handle, chunk.data.Peek(), chunk.data.ReadableBytes(), MSG_ZEROCOPY);
+    if (n >= 0)
+    {
+        chunk.zerocopy = true;
+        chunk.zc_id = m_zc_next++;
+    }
+    else if (errno == ENOBUFS)
+    {
+        /// 未确认的通知占满了socket的optmem, 本次改为复制发送
+        n = ::send(m_handle, chunk.data.Peek(), chunk.data.ReadableBytes(), 0);
+    }
+    return n;
+}
+
+/// 处理序号lo到hi的完成通知, 释放通知都已到达的缓冲区
+/// 通知一般按序到达, 先到的后面区间暂存在m_zc_pending中, 等前面的序号补齐后合并
+void TcpConnection::CompleteZeroCopy(uint32_t lo, uint32_t hi)
+{
+    if (lo != m_zc_acked)
+    {
+        m_zc_pending.push_back(std::make_pair(lo, hi));
+        return;
+    }
+    m_zc_acked = hi + 1;
+    for (size_t idx = 0; idx < m_zc_pending.size(); )
+    {
+        if (m_zc_pending[idx].first == m_zc_acked)
+        {
+            m_zc_acked = m_zc_pending[idx].second + 1;
+            m_zc_pending[idx] = m_zc_pending.back();
+            m_zc_pending.pop_back();
+            idx = 0;
+        }
+        else
+        {
+            ++idx;
+        }
+    }
+    while (!m_pinned.empty() && static_cast<int32_t>(m_pinned.front().zc_id - m_zc_acked) < 0)
+    {
+        m_pinned.pop_front();
+    }
+}
+#endif
+
+/// 弹出输出链头部发完的段, 零拷贝发送过的段移到m_pinned等待完成通知
+void TcpConnection::PopOutput()
+{
+    OutputChunk & front = m_output.front();
+    if (front.zerocopy)
+    {
+        m_pinned.emplace_back(m_reactor->GetBufferPool());
+        m_pinned.back().data.Swap(front.data);
+        m_pinned.back().zerocopy = true;
+        m_pinned.back().zc_id = front.zc_id;
+    }
+    m_output.pop_front();
+}
+
+/// 丢弃输出链, 零拷贝发送过的段移到m_pinned等待完成通知
+void TcpConnection::DropOutput()
+{
+    while (!m_output.empty())
+    {
+        PopOutput();
+    }
+    m_output_bytes = 0;
+    m_pipe_bytes = 0;
+}
+
+/// 发送出错, 丢弃输出并关闭连接
+void TcpConnection::Abort()
+{
+    DropOutput();
+    if (m_state == kConnected)
+    {
+        m_state = kClosing;
+        if (!m_in_callback)
+        {
+            Destroy();
+        }
+    }
+}
+
+/// 设置或清除暂停读的原因, 是否关注读事件变化时更新关注
+void TcpConnection::SetPaused(unsigned reason, bool paused)
+{
+    if (m_state != kConnected)
+    {
+        return;
+    }
+    unsigned old = m_paused;
+    m_paused = paused ? (m_paused | reason) : (m_paused & ~reason);
+    if ((old == 0) != (m_paused == 0))
+    {
+        UpdateInterest();
+    }
+}
+
+/// 输出链增加了len字节, 达到高水位时暂停读并回调OnHighWaterMark
+void TcpConnection::AddOutput(size_t len)
+{
+    m_output_bytes += len;
+    if (m_output_high > 0 && m_output_bytes >= m_output_high && !(m_paused & kPausedByOutput))
+    {
+        SetPaused(kPausedByOutput, true);
+        ReachHighWaterMark(kOutputWaterMark, m_output_bytes);
+    }
+}
+
+/// 按输入缓冲区的水位暂停或恢复读
+void TcpConnection::CheckInputWaterMark()
+{
+    size_t bytes = m_input.ReadableBytes();
+    if (!(m_paused & kPausedByInput))
+    {
+        if (m_input_high > 0 && bytes >= m_input_high && m_state == kConnected)
+        {
+            SetPaused(kPausedByInput, true);
+            ReachHighWaterMark(kInputWaterMark, bytes);
+        }
+    }
+    else if (m_input_high == 0 || bytes <= m_input_low)
+    {
+        SetPaused(kPausedByInput, false);
+    }
+}
+
+/// 回调OnHighWaterMark, 回调期间的关闭和发送延迟到回调结束
+void TcpConnection::ReachHighWaterMark(WaterMark which, size_t bytes)
+{
+    bool in_callback = m_in_callback;
+    m_in_callback = true;
+    OnHighWaterMark(which, bytes);
+    m_in_callback = in_callback;
+    if (!m_in_callback && m_state == kClosing)
+    {
+        Destroy();
+    }
+}
+
+/// 把输入缓冲区交给OnMessage, 回调结束后发送应答或关闭
+void TcpConnection::DeliverInput()
+{
+    m_in_callback = true;
+    OnMessage(&m_input);
+    if (m_state == kConnected)
+    {
+        CheckInputWaterMark();
+    }
+    m_in_callback = false;
+    if (m_state == kClosing)
+    {
+        Destroy();
+        return;
+    }
+    if (m_output_bytes > 0 && !m_writing)
+    {
+        Flush();
+    }
+}
+
+/// 缓冲区内存超出预算: 暂停读, 等reactor在内存回落后恢复
+/// 等待期间reactor持有一个引用, 连接关闭后也不会提前销毁
+void TcpConnection::WaitMemoryBudget()
+{
+    if (m_paused & kPausedByBudget)
+    {
+        return;
+    }
+    SetPaused(kPausedByBudget, true);
+    m_reactor->GetMetrics()->AddBudgetPauses(1);
+    AddRef();
+    m_reactor->WaitMemoryBudget(std::bind(&TcpConnection::OnMemoryAvailable, this));
+}
+
+/// 缓冲区内存已回落: 恢复读并释放等待时加的引用
+void TcpConnection::OnMemoryAvailable()
+{
+    SetPaused(kPausedByBudget, false);
+    Release();
+}
+
+/// 按是否读、是否有待发送数据更新关注的事件
+void TcpConnection::UpdateInterest()
+{
+    m_reactor->RegisterHandler(this, kPersistEvent | (m_paused == 0 ? kReadEvent : 0) | (m_writing ? kWriteEvent : 0) |
+                               (m_zerocopy ? kErrQueueEvent : 0));
+}
+
+/// 撤销注册, 关闭socket并回调OnClose
+void TcpConnection::Destroy()
+{
+    if (m_state == kClosed)
+    {
+        return;
+    }
+    if (m_output_bytes > 0)
+    {
+        /// 尽量发出剩余的数据, 发不完的丢弃
+        m_in_callback = true;
+        Flush();
+        m_in_callback = false;
+    }
+    m_state = kClosed;
+#if defined(__linux__)
+    if (m_zerocopy)
+    {
+        DropOutput();
+        DrainErrQueue();
+        if (m_zc_acked != m_zc_next)
+        {
+            /// 内核仍在引用零拷贝发送的缓冲区, 等通知到齐后再关闭socket
+            LingerZeroCopy();
+            OnClose();
+            return;
+        }
+    }
+#endif
+    /// socket在本轮事件处理结束时关闭, reactor持有的引用保证本轮中连接不被销毁
+    m_reactor->CloseHandler(this);
+    OnClose();
+}
+} // namespace reactor
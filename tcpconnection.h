@@ -0,0 +1,303 @@
+#ifndef _TCP_CONNECTION_H_
+#define _TCP_CONNECTION_H_
+
+#include <deque>
+#include <vector>
+#include "reactor.h"
+#include "buffer.h"
+
+/// @file   tcpconnection.h
+/// @brief  TCP连接, 管理输入输出缓冲区和写事件的关注
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// TCP连接
+/// 读事件持续关注, 收到的数据放在输入缓冲区中交给OnMessage处理.
+/// Send只把数据放进输出链, 在本次回调结束时用一次writev发出, 同一次读到的多个请求的应答合并发送;
+/// SendFile把文件的一段挂到输出链上, 轮到时由内核直接从文件发到socket(sendfile/splice), 不经过用户态.
+/// EnableZeroCopy后, 不小于阈值的缓冲区用MSG_ZEROCOPY发送, 缓冲区保留到错误队列中的完成通知到达后才释放.
+/// 发不完时才关注写事件, 发完后撤销. 子类实现OnMessage, 缺省在关闭后释放自身的引用.
+/// 输入缓冲区和输出链可设高低水位: 达到高水位时撤销读事件的关注并回调OnHighWaterMark, 回落到低水位时恢复;
+/// reactor设置了内存预算时, 缓冲区内存超出预算也暂停读, 回落后恢复.
+class TcpConnection : public EventHandler
+{
+public:
+
+    /// 水位所属的缓冲区
+    enum WaterMark
+    {
+        kInputWaterMark,  ///< 输入缓冲区
+        kOutputWaterMark  ///< 输出链
+    };
+
+    /// 零拷贝发送的缺省阈值
+    static const size_t kDefaultZeroCopyThreshold = 16 * 1024;
+
+    /// 关闭时等待零拷贝完成通知的最长时间(毫秒)
+    static const int kZeroCopyLingerTimeout = 30 * 1000;
+
+    /// 构造函数
+    /// @param  reactor 连接所属的reactor
+    /// @param  handle  已连接的socket
+    TcpConnection(Reactor * reactor, handle_t handle);
+
+    /// 获取该handler所对应的句柄
+    virtual handle_t GetHandle() const;
+
+    /// 获取连接所属的reactor
+    Reactor * GetReactor() const;
+
+    /// 把socket设为非阻塞并开始关注读事件
+    /// @retval 0       成功
+    /// @retval < 0     注册出错
+    int Start();
+
+    /// 发送数据, 数据被复制到输出链
+    void Send(const void * data, size_t len);
+
+    /// 发送缓冲区中的全部数据, 缓冲区的内存直接挂到输出链上, 不复制
+    void Send(Buffer * buffer);
+
+#if defined(__linux__)
+    /// 发送文件的一段, 与Send的数据按调用顺序发出
+    /// 普通文件用sendfile发送; 其他句柄(管道、字符设备等)经连接的内部管道splice到socket,
+    /// 读取不等待源句柄就绪, 源句柄须已有len字节可读或是阻塞的. 发送缓冲区满时等写事件后从断点继续.
+    /// 句柄被dup, 调用后即可关闭fd; 发送中读文件出错或文件比len短时关闭连接.
+    /// @param  fd      文件句柄
+    /// @param  offset  起始偏移, 只对普通文件有效, 不改变fd的文件偏移
+    /// @param  len     发送的字节数, 普通文件为0时发送到文件末尾
+    /// @retval 0       成功
+    /// @retval < 0     出错(-errno), 连接已关闭时为-EPIPE
+    int SendFile(int fd, int64_t offset, size_t len);
+
+    /// 开启零拷贝发送: 设置SO_ZEROCOPY, 输出链中不小于threshold字节的缓冲区用MSG_ZEROCOPY发送
+    /// 内核直接引用缓冲区的内存, 缓冲区在完成通知(kErrQueueEvent)到达前保持不变, 通知到达后归还内存池.
+    /// close不会丢弃socket发送队列中的数据, 关闭时仍有未确认的发送则只关闭写方向并撤销注册(OnClose照常回调),
+    /// 定时读取错误队列, 通知到齐后才关闭socket、归还缓冲区并销毁连接; 等待超过kZeroCopyLingerTimeout时
+    /// 关闭socket, 未确认的缓冲区被放弃(Buffer::Abandon)而不归还内存池. reactor析构时仍在等待的连接不再释放.
+    /// 小数据的页锁定和通知开销大于复制, 阈值一般取10K以上; 内核退回复制时(如回环接口)自动停止使用.
+    /// 完成通知由分离器以kErrQueueEvent分发, 需要epoll、poll或io_uring分离器.
+    /// @param  threshold   使用零拷贝的最小缓冲区字节数
+    /// @retval 0       成功
+    /// @retval < 0     出错(-errno), 如内核不支持SO_ZEROCOPY
+    int EnableZeroCopy(size_t threshold = kDefaultZeroCopyThreshold);
+#endif
+
+    /// 关闭连接, 先尽量发出输出链中的数据; 在回调中调用时在回调结束后关闭
+    void Close();
+
+    /// 暂停读: 撤销对读事件的关注, 数据留在内核接收缓冲区, 由TCP流控反压对端
+    /// 用于下游(如线程池)饱和时限制积压
+    void PauseReading();
+
+    /// 恢复读: 重新关注读事件, 水位或内存预算引起的暂停仍然有效
+    void ResumeReading();
+
+    /// 是否关注读事件
+    bool IsReading() const;
+
+    /// 设置输入缓冲区的高低水位
+    /// OnMessage之后输入缓冲区中未取走的数据达到high时暂停读并回调OnHighWaterMark, 取走到low以下时恢复读.
+    /// 输入只在OnMessage中被取走, 暂缓处理的数据可在之后调用ProcessInput再次交给OnMessage.
+    /// @param  high    高水位(字节), 0不限制
+    /// @param  low     低水位(字节), 不大于high
+    void SetInputWaterMarks(size_t high, size_t low);
+
+    /// 设置输出链的高低水位
+    /// 待发送的数据达到high时暂停读(不再接收对端的新请求)并回调OnHighWaterMark, 发送到low以下时恢复读.
+    /// @param  high    高水位(字节), 0不限制
+    /// @param  low     低水位(字节), 不大于high
+    void SetOutputWaterMarks(size_t high, size_t low);
+
+    /// 把输入缓冲区中尚未取走的数据再交给OnMessage
+    /// 用于OnMessage中暂缓处理的数据(如下游饱和时留在缓冲区中), 在下游恢复后继续处理; 不能在回调中调用
+    void ProcessInput();
+
+    /// 输出链中待发送的字节数
+    size_t OutputBytes() const;
+
+    /// 连接是否已关闭
+    bool IsClosed() const;
+
+protected:
+
+    /// 析构函数, 只能通过Close销毁
+    virtual ~TcpConnection();
+
+    /// 收到数据的回调, 处理完的数据须从input中取走
+    virtual void OnMessage(Buffer * input) = 0;
+
+    /// 连接关闭后的回调, 缺省释放创建者的引用(reactor的引用释放后销毁)
+    virtual void OnClose();
+
+    /// 缓冲区达到高水位的回调, 此时已暂停读, 回落到低水位时自动恢复; 缺省什么也不做
+    /// 可在其中关闭连接, 如对端发来的请求超过上限; 关闭在回调结束后进行
+    /// @param  which   达到高水位的缓冲区
+    /// @param  bytes   缓冲区中的字节数
+    virtual void OnHighWaterMark(WaterMark which, size_t bytes);
+
+    /// 读事件: 读入输入缓冲区并交给OnMessage
+    virtual void HandleRead();
+
+    /// 写事件: 继续发送输出链
+    virtual void HandleWrite();
+
+    /// 出错事件: 关闭连接
+    virtual void HandleError();
+
+    /// 错误队列事件: 读取零拷贝的完成通知, 释放已发完的缓冲区
+    virtual void HandleErrQueue();
+
+private:
+
+    /// 输出链每个缓冲区的大小上限, 超过后新开一个缓冲区
+    static const size_t kChunkSize = 64 * 1024;
+
+    /// 关闭后检查零拷贝完成通知的间隔(毫秒)
+    static const int kZeroCopyLingerInterval = 10;
+
+    /// writev一次最多携带的缓冲区个数
+    static const int kMaxIovecs = 64;
+
+    /// 输出链的一段: 内存数据, 或者文件中的一段(file >= 0)
+    struct OutputChunk
+    {
+        explicit OutputChunk(BufferPool * pool);
+        ~OutputChunk();
+
+        /// 待发送的字节数
+        size_t Bytes() const;
+
+        /// 发出了len字节, 返回本段剩余的字节数
+        size_t Consume(size_t len);
+
+        Buffer   data;     ///< 内存数据
+        int      file;     ///< dup得到的文件句柄, -1表示内存数据
+        bool     regular;  ///< 是否普通文件(用sendfile)
+        int64_t  offset;   ///< 普通文件下一个待发送字节的偏移
+        size_t   length;   ///< 文件中待发送的字节数(含已读入内部管道的)
+        bool     zerocopy; ///< 是否已有数据用MSG_ZEROCOPY发出, 内存须保留到完成通知到达
+        uint32_t zc_id;    ///< 最后一次零拷贝发送的通知序号
+    };
+
+    /// 暂停读的原因, 任一原因存在时不关注读事件
+    enum PauseReason
+    {
+        kPausedByUser   = 0x01, ///< PauseReading
+        kPausedByInput  = 0x02, ///< 输入缓冲区达到高水位
+        kPausedByOutput = 0x04, ///< 输出链达到高水位
+        kPausedByBudget = 0x08  ///< reactor的缓冲区内存超出预算
+    };
+
+    /// 设置或清除暂停读的原因, 是否关注读事件变化时更新关注
+    void SetPaused(unsigned reason, bool paused);
+
+    /// 输出链的尾部追加一个新段
+    OutputChunk & AppendChunk();
+
+    /// 输出链增加了len字节, 达到高水位时暂停读并回调OnHighWaterMark
+    void AddOutput(size_t len);
+
+    /// 按输入缓冲区的水位暂停或恢复读
+    void CheckInputWaterMark();
+
+    /// 回调OnHighWaterMark, 回调期间的关闭和发送延迟到回调结束
+    void ReachHighWaterMark(WaterMark which, size_t bytes);
+
+    /// 把输入缓冲区交给OnMessage, 回调结束后发送应答或关闭
+    void DeliverInput();
+
+    /// 缓冲区内存超出预算: 暂停读, 等reactor在内存回落后恢复
+    void WaitMemoryBudget();
+
+    /// 缓冲区内存已回落: 恢复读并释放等待时加的引用
+    void OnMemoryAvailable();
+
+    /// 用writev发送输出链, 遇到文件段时改用sendfile/splice, 并按是否发完更新写事件的关注
+    void Flush();
+
+#if defined(__linux__)
+    /// 发送输出链头部的文件段
+    /// @param  chunk   文件段
+    /// @param  tried   本次尝试发送的字节数
+    /// @retval >= 0    发到socket的字节数
+    /// @retval < 0     出错, errno为EAGAIN时是socket发送缓冲区满
+    ssize_t SendFileChunk(OutputChunk & chunk, size_t * tried);
+#endif
+
+#if defined(__linux__)
+    /// 输出链头部的内存段是否用MSG_ZEROCOPY发送
+    bool UseZeroCopy(const OutputChunk & chunk) const;
+
+    /// 用MSG_ZEROCOPY发送输出链头部的内存段
+    ssize_t SendZeroCopy(OutputChunk & chunk);
+
+    /// 处理序号lo到hi的完成通知, 释放通知都已到达的缓冲区
+    void CompleteZeroCopy(uint32_t lo, uint32_t hi);
+
+    /// 读取错误队列中的零拷贝完成通知
+    /// @retval true    取到了通知
+    /// @retval false   错误队列中没有通知
+    bool DrainErrQueue();
+
+    /// 关闭时还有未确认的零拷贝发送: 关闭写方向并撤销注册, 定时检查通知, 到齐后才关闭socket
+    void LingerZeroCopy();
+
+    /// 关闭后定时检查零拷贝的完成通知, 到齐或超时后关闭socket并释放连接
+    void CheckZeroCopyLinger();
+#endif
+
+    /// 弹出输出链头部发完的段, 零拷贝发送过的段移到m_pinned等待完成通知
+    void PopOutput();
+
+    /// 丢弃输出链, 零拷贝发送过的段移到m_pinned等待完成通知
+    void DropOutput();
+
+    /// 发送出错, 丢弃输出并关闭连接
+    void Abort();
+
+    /// 按是否读、是否有待发送数据更新关注的事件
+    void UpdateInterest();
+
+    /// 撤销注册, 交给reactor延迟关闭socket并回调OnClose
+    void Destroy();
+
+private:
+
+    /// 连接状态
+    enum State
+    {
+        kConnected,   ///< 已连接
+        kClosing,     ///< 回调中请求了关闭, 回调结束后关闭
+        kClosed       ///< 已关闭
+    };
+
+    Reactor *                m_reactor;      ///< 所属的reactor
+    handle_t                 m_handle;       ///< socket句柄
+    State                    m_state;        ///< 连接状态
+    bool                     m_in_callback;  ///< 是否正在事件回调中
+    unsigned                 m_paused;       ///< 暂停读的原因(PauseReason按位或), 0时关注读事件
+    bool                     m_writing;      ///< 是否关注了写事件
+    Buffer                   m_input;        ///< 输入缓冲区
+    std::deque<OutputChunk>  m_output;       ///< 输出链
+    size_t                   m_output_bytes; ///< 输出链中的字节数
+    size_t                   m_input_high;   ///< 输入缓冲区的高水位, 0不限制
+    size_t                   m_input_low;    ///< 输入缓冲区的低水位
+    size_t                   m_output_high;  ///< 输出链的高水位, 0不限制
+    size_t                   m_output_low;   ///< 输出链的低水位
+    int                      m_pipe[2];      ///< splice非普通文件用的内部管道, 首次需要时创建
+    size_t                   m_pipe_bytes;   ///< 内部管道中还没发到socket的字节数
+    bool                     m_zerocopy;     ///< 是否设置了SO_ZEROCOPY
+    size_t                   m_zc_threshold; ///< 零拷贝发送的阈值, 0表示不再使用零拷贝
+    uint32_t                 m_zc_next;      ///< 下一次零拷贝发送的通知序号, 内核按成功的发送调用依次编号
+    uint32_t                 m_zc_acked;     ///< 该序号之前的通知都已到达
+    std::vector<std::pair<uint32_t, uint32_t> > m_zc_pending; ///< 先于前面序号到达的通知区间
+    std::deque<OutputChunk>  m_pinned;       ///< 已发完、等待完成通知的零拷贝缓冲区
+    timer_id_t               m_zc_timer;     ///< 关闭后检查完成通知的定时器
+    int                      m_zc_linger;    ///< 关闭后还可检查完成通知的次数
+};
+} // namespace reactor
+
+#endif // _TCP_CONNECTION_H_
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <vector>
+#include "reactor.h"
+#include "buffer.h"
+#include "bufferpool.h"
+#include "tcpconnection.h"
+
+/// @file   zerocopy_close_test.cpp
+/// @brief  关闭时还有未确认的零拷贝发送: 缓冲区不能在完成通知到达前归还内存池
+/// @date   2026-10-17
+///
+/// 客户端不读数据, 零拷贝发出的段停在服务端的发送队列中, 内核仍引用这些内存; 此时关闭连接,
+/// 再从同一个内存池申请缓冲区写入其他内容. 客户端之后读到的必须全是原来发送的数据,
+/// 通知到齐后连接被销毁, 内存全部归还内存池.
+/// 退出码: 0通过, 1失败, 77内核不支持零拷贝(跳过)
+
+namespace
+{
+/// 每段的大小和段数, 总量小于发送缓冲区, 发送时全部进入内核
+const size_t kSegmentSize = 16 * 1024;
+const int    kSegments = 8;
+
+/// 已销毁的连接数
+int g_destroyed = 0;
+
+class SinkConnection : public reactor::TcpConnection
+{
+public:
+
+    /// 构造函数
+    SinkConnection(reactor::Reactor * reactor, reactor::handle_t handle)
+        : reactor::TcpConnection(reactor, handle) {}
+
+protected:
+
+    /// 析构函数
+    virtual ~SinkConnection()
+    {
+        ++g_destroyed;
+    }
+
+    /// 丢弃收到的数据
+    virtual void OnMessage(reactor::Buffer * input)
+    {
+        input->RetrieveAll();
+    }
+
+    /// 连接关闭, 释放创建时的引用
+    virtual void OnClose()
+    {
+        Release();
+    }
+};
+
+/// 创建一对回环连接
+/// @param  client  返回客户端socket
+/// @param  server  返回服务端socket
+/// @retval true    成功
+bool ConnectPair(int * client, int * server)
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listener < 0 || ::bind(listener, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(listener, 1) != 0 ||
+            ::getsockname(listener, (sockaddr *)&addr, &len) != 0)
+    {
+        perror("listen");
+        return false;
+    }
+    *client = ::socket(AF_INET, SOCK_STREAM, 0);
+    /// 接收窗口远小于发送量, 不读时服务端发出的数据大部分停在发送队列中
+    int rcvbuf = 16 * 1024;
+    ::setsockopt(*client, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (::connect(*client, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror("connect");
+        return false;
+    }
+    *server = ::accept(listener, NULL, NULL);
+    ::close(listener);
+    if (*server < 0)
+    {
+        perror("accept");
+        return false;
+    }
+    int sndbuf = 1024 * 1024;
+    ::setsockopt(*server, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    return true;
+}
+} // namespace
+
+int main()
+{
+    reactor::Reactor reactor;
+    reactor::BufferPool * pool = reactor.GetBufferPool();
+    size_t baseline = pool->BytesInUse();
+
+    int client = -1;
+    int server = -1;
+    if (!ConnectPair(&client, &server))
+    {
+        return 1;
+    }
+    SinkConnection * connection = new SinkConnection(&reactor, server);
+    if (connection->Start() != 0)
+    {
+        fprintf(stderr, "register connection failed\n");
+        return 1;
+    }
+    int ret = connection->EnableZeroCopy(1);
+    if (ret != 0)
+    {
+        fprintf(stderr, "zerocopy not supported: %s, skipped\n", strerror(-ret));
+        connection->Close();
+        ::close(client);
+        return 77;
+    }
+
+    std::vector<char> data(kSegmentSize, 'A');
+    for (int idx = 0; idx < kSegments; ++idx)
+    {
+        reactor::Buffer segment(pool);
+        segment.Append(&data[0], data.size());
+        connection->Send(&segment);
+    }
+    connection->Close();
+    reactor.HandleEvents(0);
+
+    /// 其他连接从同一个内存池申请缓冲区并写入内容
+    std::vector<reactor::Buffer *> others;
+    std::vector<char> other(kSegmentSize, 'B');
+    for (int idx = 0; idx < kSegments * 2; ++idx)
+    {
+        others.push_back(new reactor::Buffer(pool));
+        others.back()->Append(&other[0], other.size());
+    }
+
+    /// 客户端读出全部数据, 期间继续处理事件
+    int flags = ::fcntl(client, F_GETFL, 0);
+    ::fcntl(client, F_SETFL, flags | O_NONBLOCK);
+    size_t received = 0;
+    size_t corrupted = 0;
+    for (int round = 0; round < 10000; ++round)
+    {
+        char buf[4096];
+        ssize_t n = ::recv(client, buf, sizeof(buf), 0);
+        if (n == 0)
+        {
+            break;
+        }
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                perror("recv");
+                break;
+            }
+            reactor.HandleEvents(1);
+            continue;
+        }
+        for (ssize_t idx = 0; idx < n; ++idx)
+        {
+            corrupted += buf[idx] != 'A';
+        }
+        received += static_cast<size_t>(n);
+    }
+    ::close(client);
+
+    /// 等待完成通知到齐后连接被销毁
+    for (int round = 0; round < 1000 && g_destroyed == 0; ++round)
+    {
+        reactor.HandleEvents(10);
+    }
+    for (size_t idx = 0; idx < others.size(); ++idx)
+    {
+        delete others[idx];
+    }
+
+    int failed = 0;
+    if (received != kSegmentSize * kSegments)
+    {
+        fprintf(stderr, "received %zu bytes, expected %zu\n", received, kSegmentSize * kSegments);
+        failed = 1;
+    }
+    if (corrupted != 0)
+    {
+        fprintf(stderr, "%zu bytes were overwritten after close\n", corrupted);
+        failed = 1;
+    }
+    if (g_destroyed != 1)
+    {
+        fprintf(stderr, "connection was not destroyed after the notifications arrived\n");
+        failed = 1;
+    }
+    if (pool->BytesInUse() != baseline)
+    {
+        fprintf(stderr, "%zu bytes still in use\n", pool->BytesInUse() - baseline);
+        failed = 1;
+    }
+    return failed;
+}
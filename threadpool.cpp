@@ -0,0 +1,237 @@
+#include "threadpool.h"
+
+/// @file   threadpool.cpp
+/// @brief  处理耗时请求的工作线程池, 有界队列与反压
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 当前工作线程所属的线程池及其下标, 工作线程中提交的任务放进自己的队列
+static thread_local ThreadPool * t_pool = NULL;
+static thread_local int          t_worker = -1;
+
+/// 构造函数
+/// @param  num         工作线程个数, <= 0时取CPU核数
+/// @param  max_pending 排队任务数上限
+ThreadPool::ThreadPool(int num, size_t max_pending)
+    : m_max_pending(max_pending > 0 ? max_pending : 1), m_pending(0), m_next(0),
+      m_idle(0), m_running(false), m_has_waiters(false)
+{
+    if (num <= 0)
+    {
+        num = static_cast<int>(std::thread::hardware_concurrency());
+        if (num <= 0)
+        {
+            num = 1;
+        }
+    }
+    m_low_water = m_max_pending / 2;
+    for (int idx = 0; idx < num; ++idx)
+    {
+        m_workers.push_back(new Worker());
+    }
+}
+
+/// 析构函数, 执行完排队的任务后停止所有工作线程
+ThreadPool::~ThreadPool()
+{
+    Stop();
+    for (size_t idx = 0; idx < m_workers.size(); ++idx)
+    {
+        delete m_workers[idx];
+    }
+}
+
+/// 获取工作线程个数
+int ThreadPool::Size() const
+{
+    return static_cast<int>(m_workers.size());
+}
+
+/// 启动工作线程
+void ThreadPool::Start()
+{
+    if (m_running.exchange(true))
+    {
+        return;
+    }
+    for (size_t idx = 0; idx < m_workers.size(); ++idx)
+    {
+        m_workers[idx]->thread = std::thread(&ThreadPool::WorkerLoop, this, static_cast<int>(idx));
+    }
+}
+
+/// 执行完排队的任务后停止并等待所有工作线程
+void ThreadPool::Stop()
+{
+    if (!m_running.exchange(false))
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_idle_lock);
+        m_idle_cond.notify_all();
+    }
+    for (size_t idx = 0; idx < m_workers.size(); ++idx)
+    {
+        if (m_workers[idx]->thread.joinable())
+        {
+            m_workers[idx]->thread.join();
+        }
+    }
+}
+
+/// 提交任务(线程安全), 工作线程中提交的任务放进自己的队列
+/// @retval true    提交成功
+/// @retval false   线程池饱和或已停止
+bool ThreadPool::Submit(const Functor & task)
+{
+    if (!m_running.load() && t_pool != this)
+    {
+        /// 停止过程中工作线程仍可提交后续任务, 执行完才退出
+        return false;
+    }
+    if (m_pending.fetch_add(1) >= m_max_pending)
+    {
+        m_pending.fetch_sub(1);
+        return false;
+    }
+    size_t idx = t_pool == this ? static_cast<size_t>(t_worker) : m_next.fetch_add(1) % m_workers.size();
+    Worker * worker = m_workers[idx];
+    {
+        std::lock_guard<std::mutex> lock(worker->lock);
+        worker->tasks.push_back(task);
+    }
+    /// 先增加m_pending再检查m_idle, 与工作线程先增加m_idle再检查m_pending配对, 不会丢失唤醒
+    if (m_idle.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_idle_lock);
+        m_idle_cond.notify_one();
+    }
+    return true;
+}
+
+/// 提交任务(线程安全), work在工作线程执行完后, done被投递到reactor的事件循环线程执行
+/// @retval true    提交成功
+/// @retval false   线程池饱和或已停止
+bool ThreadPool::Submit(Reactor * reactor, const Functor & work, const Functor & done)
+{
+    return Submit([reactor, work, done]() {
+        work();
+        reactor->QueueInLoop(done);
+    });
+}
+
+/// 排队任务数是否已达上限
+bool ThreadPool::IsSaturated() const
+{
+    return m_pending.load() >= m_max_pending;
+}
+
+/// 排队的任务数
+size_t ThreadPool::Pending() const
+{
+    return m_pending.load();
+}
+
+/// 在线程池有空位时把resume投递到reactor执行(线程安全)
+void ThreadPool::NotifyWhenReady(Reactor * reactor, const Functor & resume)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_waiter_lock);
+        Waiter waiter = { reactor, resume };
+        m_waiters.push_back(waiter);
+        m_has_waiters.store(true);
+    }
+    /// 登记后再检查, 与工作线程先减少m_pending再检查m_has_waiters配对
+    if (m_pending.load() <= m_low_water)
+    {
+        WakeWaiters();
+    }
+}
+
+/// 工作线程主循环
+void ThreadPool::WorkerLoop(int idx)
+{
+    t_pool = this;
+    t_worker = idx;
+    Functor task;
+    for (;;)
+    {
+        if (TakeTask(idx, &task))
+        {
+            task();
+            task = Functor();
+            continue;
+        }
+        if (m_pending.load() > 0)
+        {
+            /// 有提交者已计数但还没放进队列
+            std::this_thread::yield();
+            continue;
+        }
+        if (!m_running.load())
+        {
+            break;
+        }
+        std::unique_lock<std::mutex> lock(m_idle_lock);
+        m_idle.fetch_add(1);
+        while (m_pending.load() == 0 && m_running.load())
+        {
+            m_idle_cond.wait(lock);
+        }
+        m_idle.fetch_sub(1);
+    }
+    t_pool = NULL;
+    t_worker = -1;
+}
+
+/// 从自己的队列取任务, 没有时从其他线程窃取
+bool ThreadPool::TakeTask(int idx, Functor * task)
+{
+    bool taken = false;
+    size_t num = m_workers.size();
+    for (size_t step = 0; step < num && !taken; ++step)
+    {
+        Worker * worker = m_workers[(idx + step) % num];
+        std::lock_guard<std::mutex> lock(worker->lock);
+        if (worker->tasks.empty())
+        {
+            continue;
+        }
+        if (step == 0)
+        {
+            task->swap(worker->tasks.front());
+            worker->tasks.pop_front();
+        }
+        else
+        {
+            /// 从尾部窃取, 与队列主人在头部取任务错开
+            task->swap(worker->tasks.back());
+            worker->tasks.pop_back();
+        }
+        taken = true;
+    }
+    if (taken && m_pending.fetch_sub(1) - 1 <= m_low_water && m_has_waiters.load())
+    {
+        WakeWaiters();
+    }
+    return taken;
+}
+
+/// 把等待空位的回调全部投递出去
+void ThreadPool::WakeWaiters()
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(m_waiter_lock);
+        waiters.swap(m_waiters);
+        m_has_waiters.store(false);
+    }
+    for (size_t idx = 0; idx < waiters.size(); ++idx)
+    {
+        waiters[idx].reactor->QueueInLoop(waiters[idx].resume);
+    }
+}
+} // namespace reactor
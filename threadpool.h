@@ -0,0 +1,112 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "reactor.h"
+
+/// @file   threadpool.h
+/// @brief  处理耗时请求的工作线程池, 有界队列与反压
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 工作线程池
+/// 每个工作线程有自己的任务队列, 空闲时从其他线程的队列尾部窃取任务.
+/// 排队的任务数有上限, 达到上限时Submit失败, 调用者应暂停读(如TcpConnection::PauseReading),
+/// 并用NotifyWhenReady在排队任务降到上限一半时恢复, 过载时积压不会无限增长.
+/// 一个线程池可以服务多个reactor, 处理结果通过Reactor::QueueInLoop回到各自的事件循环线程.
+class ThreadPool
+{
+public:
+
+    /// 构造函数
+    /// @param  num         工作线程个数, <= 0时取CPU核数
+    /// @param  max_pending 排队任务数上限
+    explicit ThreadPool(int num = 0, size_t max_pending = 4096);
+
+    /// 析构函数, 执行完排队的任务后停止所有工作线程
+    ~ThreadPool();
+
+    /// 获取工作线程个数
+    int Size() const;
+
+    /// 启动工作线程
+    void Start();
+
+    /// 执行完排队的任务后停止并等待所有工作线程
+    void Stop();
+
+    /// 提交任务(线程安全), 工作线程中提交的任务放进自己的队列
+    /// @retval true    提交成功
+    /// @retval false   线程池饱和或已停止
+    bool Submit(const Functor & task);
+
+    /// 提交任务(线程安全), work在工作线程执行完后, done被投递到reactor的事件循环线程执行
+    /// @retval true    提交成功
+    /// @retval false   线程池饱和或已停止
+    bool Submit(Reactor * reactor, const Functor & work, const Functor & done);
+
+    /// 排队任务数是否已达上限
+    bool IsSaturated() const;
+
+    /// 排队的任务数
+    size_t Pending() const;
+
+    /// 在线程池有空位时把resume投递到reactor执行(线程安全)
+    /// 排队任务已降到上限一半以下时立即投递, 否则等工作线程取走足够的任务后投递
+    void NotifyWhenReady(Reactor * reactor, const Functor & resume);
+
+private:
+
+    /// 工作线程
+    struct Worker
+    {
+        std::mutex          lock;   ///< 保护任务队列
+        std::deque<Functor> tasks;  ///< 任务队列, 自己从头部取, 其他线程从尾部窃取
+        std::thread         thread; ///< 线程
+    };
+
+    /// 等待空位的恢复回调
+    struct Waiter
+    {
+        Reactor * reactor; ///< 回调所在的reactor
+        Functor   resume;  ///< 恢复回调
+    };
+
+    /// 工作线程主循环
+    void WorkerLoop(int idx);
+
+    /// 从自己的队列取任务, 没有时从其他线程窃取
+    bool TakeTask(int idx, Functor * task);
+
+    /// 把等待空位的回调全部投递出去
+    void WakeWaiters();
+
+    /// 禁止拷贝构造和赋值操作
+    ThreadPool(const ThreadPool &);
+    ThreadPool & operator=(const ThreadPool &);
+
+private:
+
+    std::vector<Worker *>     m_workers;     ///< 工作线程
+    size_t                    m_max_pending; ///< 排队任务数上限
+    size_t                    m_low_water;   ///< 低水位, 排队任务降到此值时恢复等待者
+    std::atomic<size_t>       m_pending;     ///< 排队的任务数
+    std::atomic<unsigned>     m_next;        ///< 外部线程提交时轮转选择的队列
+    std::atomic<int>          m_idle;        ///< 睡眠中的工作线程数
+    std::atomic<bool>         m_running;     ///< 是否在运行
+    std::mutex                m_idle_lock;   ///< 工作线程睡眠用
+    std::condition_variable   m_idle_cond;   ///< 工作线程睡眠用
+    std::atomic<bool>         m_has_waiters; ///< 是否有等待空位的回调
+    std::mutex                m_waiter_lock; ///< 保护m_waiters
+    std::vector<Waiter>       m_waiters;     ///< 等待空位的回调
+};
+} // namespace reactor
+
+#endif // _THREAD_POOL_H_
@@ -14,6 +14,7 @@
 #endif //__linux__
 
 #include "common.h"
+#include "buffer.h"
 
 #endif // _TIME_CLIENT_H_
 
@@ -25,17 +26,12 @@
 /// 全局反应器对象
 reactor::Reactor g_reactor;
 
-/// 定义读写缓冲区
-const size_t kBufferSize = 1024;
-char g_read_buffer[kBufferSize];
-char g_write_buffer[kBufferSize];
-
 class TimeClient : public reactor::EventHandler
 {
 public:
 
     /// 构造函数
-    TimeClient() : EventHandler()
+    TimeClient() : EventHandler(), m_input(g_reactor.GetBufferPool())
     {
         m_handle = socket(AF_INET, SOCK_STREAM, 0);
         assert(IsValidHandle(m_handle));
@@ -71,29 +67,32 @@ public:
     /// 读数据
     virtual void HandleRead()
     {
-        memset(g_read_buffer, 0, kBufferSize);
-        int len = recv(m_handle, g_read_buffer, kBufferSize, 0);
+        int saved_errno = 0;
+        int len = m_input.ReadFd(m_handle, &saved_errno);
         if (len > 0)
         {
-            fprintf(stderr, "%s", g_read_buffer);
-            g_reactor.RegisterHandler(this, reactor::kWriteEvent);
+            fprintf(stderr, "%.*s", (int)m_input.ReadableBytes(), m_input.Peek());
+            m_input.RetrieveAll();
         }
         else
         {
-            ReportSocketError("recv");
+            if (len < 0)
+            {
+                errno = saved_errno;
+                ReportSocketError("recv");
+            }
+            HandleError();
         }
     }
 
     /// 写数据
     virtual void HandleWrite()
     {
-        memset(g_write_buffer, 0, kBufferSize);
-        int len = sprintf(g_write_buffer, "time\r\n");
-        len = send(m_handle, g_write_buffer, len, 0);
+        static const char kRequest[] = "time\r\n";
+        int len = send(m_handle, kRequest, sizeof(kRequest) - 1, 0);
         if (len > 0)
         {
-            fprintf(stderr, "%s", g_write_buffer);
-            g_reactor.RegisterHandler(this, reactor::kReadEvent);
+            fprintf(stderr, "%s", kRequest);
         }
         else
         {
@@ -112,6 +111,7 @@ public:
 private:
 
     reactor::handle_t  m_handle;  ///< 文件描述符句柄
+    reactor::Buffer    m_input;   ///< 输入缓冲区
 };
 
 int main(int argc, char *argv[])
@@ -138,16 +138,10 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    g_reactor.RegisterHandler(&client, reactor::kWriteEvent);
-    while (1)
-    {
-        g_reactor.HandleEvents(100);
-#if defined(_WIN32)
-        Sleep(1000);
-#elif defined(__linux__)
-        sleep(1);
-#endif
-    }
+    /// 读事件持续关注, 由每秒一次的定时器发送请求, 无需反复注册
+    g_reactor.RegisterHandler(&client, reactor::kReadEvent | reactor::kPersistEvent);
+    g_reactor.ScheduleTimer(0, 1000, [&client]() { client.HandleWrite(); });
+    g_reactor.Run();
     g_reactor.RemoveHandler(&client);
 #ifdef _WIN32
     WSACleanup();
@@ -8,13 +8,18 @@
 #include <assert.h>
 #include <errno.h>
 #ifdef __linux__
+	#include <signal.h>
 	#include <sys/types.h>
 	#include <sys/socket.h>
 	#include <arpa/inet.h>
 #endif //__linux__
 
 #include <string>
+#include <vector>
 #include "common.h"
+#include "acceptor.h"
+#include "reactorgroup.h"
+#include "codec.h"
 
 #endif // _TIME_SERVER_H_
 
@@ -23,166 +28,114 @@
 /// @author lovezhangkai@foxmail
 /// @date   2013-10-1
 
-/// 全局反应器对象
-reactor::Reactor g_reactor;
+/// 全局事件循环组, 每个事件循环持有一个监听socket
+reactor::ReactorGroup * g_reactor_group = NULL;
 
-/// 定义读写缓冲区
-const size_t kBufferSize = 1024;
-char g_read_buffer[kBufferSize];
-char g_write_buffer[kBufferSize];
-
-class RequestHandler : public reactor::EventHandler
+class RequestHandler : public reactor::CodecConnection
 {
 public:
 
     /// 构造函数
-    RequestHandler(reactor::handle_t handle) : EventHandler(), m_handle(handle) {}
+    RequestHandler(reactor::Reactor * reactor, reactor::handle_t handle)
+        : CodecConnection(reactor, handle, new reactor::LineCodec(256)) {}
 
-    /// 获取文件描述符句柄
-    virtual reactor::handle_t GetHandle() const
-    {
-        return m_handle;
-    }
+protected:
 
-    /// 写数据
-    virtual void HandleWrite()
+    /// 按行处理请求, 分帧由LineCodec完成, 分片和流水线的请求都按行处理
+    /// 同一次读到的多个请求的应答由TcpConnection合并成一次writev
+    virtual void OnFrame(const char * line, size_t len)
     {
-        memset(g_write_buffer, 0, sizeof(g_write_buffer));
-        int len = sprintf(g_write_buffer, "current time: %d\r\n", (int)time(NULL));
-        len = send(m_handle, g_write_buffer, len, 0);
-        if (len > 0)
+        if (len == 4 && strncasecmp("time", line, 4) == 0)
         {
-            fprintf(stderr, "send response to client, fd=%d\n", (int)m_handle);
-            g_reactor.RegisterHandler(this, reactor::kReadEvent);
+            char response[64];
+            int n = sprintf(response, "current time: %d", (int)time(NULL));
+            SendFrame(response, n);
+            fprintf(stderr, "send response to client, fd=%d\n", (int)GetHandle());
         }
-        else
+        else if (len == 4 && strncasecmp("exit", line, 4) == 0)
         {
-            ReportSocketError("send");
-        }
-    }
-
-    /// 读数据
-    virtual void HandleRead()
-    {
-        memset(g_read_buffer, 0, sizeof(g_read_buffer));
-        int len = recv(m_handle, g_read_buffer, kBufferSize, 0);
-        if (len > 0)
-        {
-            if (strncasecmp("time", g_read_buffer, 4) == 0)
-            {
-                g_reactor.RegisterHandler(this, reactor::kWriteEvent);
-            }
-            else if (strncasecmp("exit", g_read_buffer, 4) == 0)
-            {
-                close(m_handle);
-                g_reactor.RemoveHandler(this);
-                delete this;
-            }
-            else
-            {
-                fprintf(stderr, "Invalid request: %s", g_read_buffer);
-                close(m_handle);
-                g_reactor.RemoveHandler(this);
-                delete this;
-            }
+            Close();
         }
         else
         {
-            ReportSocketError("recv");
+            fprintf(stderr, "Invalid request: %.*s\n", (int)len, line);
+            Close();
         }
     }
 
-    virtual void HandleError()
+    /// 连接关闭
+    virtual void OnClose()
     {
-        fprintf(stderr, "client %d closed\n", m_handle);
-        close(m_handle);
-        g_reactor.RemoveHandler(this);
-        delete this;
+        fprintf(stderr, "client %d closed\n", (int)GetHandle());
+        Release();
     }
-
-private:
-
-    reactor::handle_t m_handle; ///< 文件描述符句柄
 };
 
-class TimeServer : public reactor::EventHandler
+class TimeServer
 {
 public:
 
     /// 构造函数
-    TimeServer(const char * ip, unsigned short port) : EventHandler(), m_ip(ip), m_port(port) {}
+    TimeServer(reactor::Reactor * reactor, const char * ip, unsigned short port)
+        : m_reactor(reactor),
+          m_acceptor(new reactor::Acceptor(reactor, std::bind(&TimeServer::OnConnection, this, std::placeholders::_1))),
+          m_ip(ip), m_port(port) {}
 
-    /// 创建socket
-    bool Start()
+    /// 析构函数, 关闭监听socket
+    ~TimeServer()
     {
-        m_handle = socket(AF_INET, SOCK_STREAM, 0);
-        if (!IsValidHandle(m_handle))
-        {
-            ReportSocketError("socket");
-            return false;
-        }
-
-        struct sockaddr_in addr;
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(m_port);
-        addr.sin_addr.s_addr = inet_addr(m_ip.c_str());
-        if (bind(m_handle, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-        {
-            ReportSocketError("bind");
-            return false;
-        }
+        m_acceptor->Close();
+    }
 
-        if (listen(m_handle, 10) < 0)
+    /// 创建监听socket, 每个事件循环各自监听同一端口, 由内核在监听socket间分配连接
+    bool Start()
+    {
+        int ret = m_acceptor->Listen(m_ip.c_str(), m_port, SOMAXCONN, true);
+        if (ret != 0)
         {
+            errno = -ret;
             ReportSocketError("listen");
             return false;
         }
         return true;
     }
 
-    /// 获取文件描述符句柄
-    virtual reactor::handle_t GetHandle() const
-    {
-        return m_handle;
-    }
+private:
 
-    /// 读数据
-    virtual void HandleRead()
+    /// 新连接
+    void OnConnection(reactor::handle_t handle)
     {
-        struct sockaddr addr;
-#if defined(_WIN32)
-        int addrlen = sizeof(addr);
-#elif defined(__linux__)
-        socklen_t addrlen = sizeof(addr);
-#endif
-        reactor::handle_t handle = accept(m_handle, &addr, &addrlen);
-        if (!IsValidHandle(handle))
+        RequestHandler * handler = new RequestHandler(m_reactor, handle);
+        /// 不读应答的客户端积压超过1M时不再接收它的请求, 发到256K以下再恢复
+        handler->SetOutputWaterMarks(1024 * 1024, 256 * 1024);
+        if (handler->Start() != 0)
         {
-            ReportSocketError("accept");
-        }
-        else
-        {
-            RequestHandler * handler = new RequestHandler(handle);
-            if (g_reactor.RegisterHandler(handler, reactor::kReadEvent) != 0)
-            {
-                fprintf(stderr, "error: register handler failed\n");
-                delete handler;
-            }
+            fprintf(stderr, "error: register handler failed\n");
+            handler->Close();
         }
     }
 
 private:
 
-    reactor::handle_t     m_handle; ///< 文件描述符句柄
-    std::string           m_ip;     ///< IP地址
-    unsigned short        m_port;   ///< 端口号
+    reactor::Reactor *    m_reactor;  ///< 所属的reactor
+    reactor::Acceptor *   m_acceptor; ///< 监听socket
+    std::string           m_ip;       ///< IP地址
+    unsigned short        m_port;     ///< 端口号
 };
 
+#ifdef __linux__
+/// 收到退出信号时停止事件循环
+void HandleSignal(int /*sig*/)
+{
+    g_reactor_group->Stop();
+}
+#endif //__linux__
+
 int main(int argc, char ** argv)
 {
     if (argc < 3)
     {
-        fprintf(stderr, "usage: %s ip port\n", argv[0]);
+        fprintf(stderr, "usage: %s ip port [threads]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -195,21 +148,36 @@ int main(int argc, char ** argv)
     }
 #endif
 
-    TimeServer server(argv[1], atoi(argv[2]));
-    if (!server.Start())
+    /// 线程数缺省为CPU核数
+    reactor::ReactorGroup group(argc > 3 ? atoi(argv[3]) : 0);
+    g_reactor_group = &group;
+
+    std::vector<TimeServer *> servers;
+    for (int idx = 0; idx < group.Size(); ++idx)
     {
-        fprintf(stderr, "start server failed\n");
-        return EXIT_FAILURE;
+        TimeServer * server = new TimeServer(group.GetReactor(idx), argv[1], atoi(argv[2]));
+        servers.push_back(server);
+        if (!server->Start())
+        {
+            fprintf(stderr, "start server failed\n");
+            return EXIT_FAILURE;
+        }
     }
-    fprintf(stderr, "server started!\n");
+    fprintf(stderr, "server started with %d threads!\n", group.Size());
+
+#ifdef __linux__
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+#endif
 
-    while (1)
+    group.Run();
+    fprintf(stderr, "server stopped!\n");
+    for (size_t idx = 0; idx < servers.size(); ++idx)
     {
-        g_reactor.RegisterHandler(&server, reactor::kReadEvent);
-        g_reactor.HandleEvents(100);
+        delete servers[idx];
     }
 #ifdef _WIN32
     WSACleanup();
 #endif
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,401 @@
+#include <assert.h>
+#include <string.h>
+#if defined(__linux__)
+    #include <time.h>
+    #include <sys/timerfd.h>
+#endif
+#include "timerqueue.h"
+
+/// @file   timerqueue.cpp
+/// @brief  分层时间轮定时器队列, linux下由一个timerfd驱动
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// timerfd未设置时m_armed的取值
+static const uint64_t kNotArmed = ~0ULL;
+
+/// 最低的置位位置, bits不能为0
+static inline int LowestBit(uint64_t bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int pos = 0;
+    while (!(bits & 1))
+    {
+        bits >>= 1;
+        ++pos;
+    }
+    return pos;
+#endif
+}
+
+/// 构造函数
+TimerQueue::TimerQueue() : EventHandler()
+{
+    for (int idx = 0; idx < kRootSize; ++idx)
+    {
+        InitList(&m_root[idx]);
+    }
+    for (int level = 0; level < kLevels; ++level)
+    {
+        for (int idx = 0; idx < kLevelSize; ++idx)
+        {
+            InitList(&m_levels[level][idx]);
+        }
+    }
+    memset(m_root_bitmap, 0, sizeof(m_root_bitmap));
+    m_current = 0;
+    m_armed = kNotArmed;
+    m_start = 0;
+    m_start = Now();
+    m_count = 0;
+    m_free_list = NULL;
+    m_running = NULL;
+    m_running_cancelled = false;
+    m_processing = false;
+#if defined(__linux__)
+    m_handle = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(m_handle >= 0);
+#else
+    m_handle = INVALID_SOCKET;
+#endif
+}
+
+/// 析构函数
+TimerQueue::~TimerQueue()
+{
+#if defined(__linux__)
+    ::close(m_handle);
+#endif
+}
+
+/// 获取该handler所对应的句柄(linux下为timerfd)
+handle_t TimerQueue::GetHandle() const
+{
+    return m_handle;
+}
+
+/// timerfd可读, 处理到期的定时器
+void TimerQueue::HandleRead()
+{
+#if defined(__linux__)
+    uint64_t count;
+    ssize_t n = ::read(m_handle, &count, sizeof(count));
+    (void)n;
+#endif
+    m_armed = kNotArmed;
+    ProcessExpired();
+}
+
+/// 添加定时器
+/// @param  delay    首次触发的延迟(毫秒)
+/// @param  period   触发周期(毫秒), 0表示只触发一次
+/// @param  callback 到期时的回调函数
+/// @retval 定时器id, 用于取消定时器
+timer_id_t TimerQueue::Schedule(int delay, int period, const TimerCallback & callback)
+{
+    uint64_t now = Now();
+    if (m_count == 0 && !m_processing && m_current < now)
+    {
+        /// 时间轮为空, 直接追上当前时间, 免得之后逐轮空转
+        m_current = now;
+    }
+    TimerNode * node = AllocNode();
+    node->expires = now + (delay > 0 ? delay : 0);
+    node->period = period > 0 ? period : 0;
+    node->active = true;
+    node->callback = callback;
+    AddNode(node);
+    ++m_count;
+    Rearm();
+    return (static_cast<timer_id_t>(node->generation) << 32) | node->index;
+}
+
+/// 取消定时器, 可在定时器回调(包括自身的回调)中调用
+/// @retval 0   取消成功
+/// @retval -1  定时器不存在或已到期
+int TimerQueue::Cancel(timer_id_t id)
+{
+    uint32_t index = static_cast<uint32_t>(id);
+    uint32_t generation = static_cast<uint32_t>(id >> 32);
+    if (index >= m_pool.size())
+    {
+        return -1;
+    }
+    TimerNode * node = &m_pool[index];
+    if (!node->active || node->generation != generation)
+    {
+        return -1;
+    }
+    if (node == m_running)
+    {
+        /// 回调返回后由Tick释放
+        m_running_cancelled = true;
+        return 0;
+    }
+    UnlinkNode(node);
+    FreeNode(node);
+    --m_count;
+    return 0;
+}
+
+/// 执行所有已到期的定时器, 并重新设置下一次唤醒时间
+void TimerQueue::ProcessExpired()
+{
+    uint64_t now = Now();
+    m_processing = true;
+    while (m_current <= now)
+    {
+        /// 跳过第0层中没有定时器的刻度
+        uint64_t next = NextTick();
+        if (next > now)
+        {
+            m_current = now + 1;
+            break;
+        }
+        m_current = next;
+        Tick();
+    }
+    m_processing = false;
+    Rearm();
+}
+
+/// 当前的时间刻度(毫秒)
+uint64_t TimerQueue::Now() const
+{
+#if defined(__linux__)
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ms = static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+#else
+    uint64_t ms = ::GetTickCount64();
+#endif
+    return ms - m_start;
+}
+
+/// 从节点池中取一个空闲节点
+TimerQueue::TimerNode * TimerQueue::AllocNode()
+{
+    TimerNode * node = m_free_list;
+    if (node != NULL)
+    {
+        m_free_list = node->next;
+    }
+    else
+    {
+        m_pool.push_back(TimerNode());
+        node = &m_pool.back();
+        node->index = static_cast<uint32_t>(m_pool.size() - 1);
+        node->generation = 1;
+        node->active = false;
+    }
+    node->prev = node->next = NULL;
+    return node;
+}
+
+/// 将节点放回节点池
+void TimerQueue::FreeNode(TimerNode * node)
+{
+    node->active = false;
+    node->callback = TimerCallback();
+    /// 代数变化使旧的定时器id失效, 跳过0保证id非0
+    if (++node->generation == 0)
+    {
+        node->generation = 1;
+    }
+    node->next = m_free_list;
+    m_free_list = node;
+}
+
+/// 按到期刻度将节点挂到时间轮的槽上
+void TimerQueue::AddNode(TimerNode * node)
+{
+    uint64_t expires = node->expires;
+    TimerNode * head;
+    if (expires < m_current)
+    {
+        /// 已经到期, 放到下一个待处理的刻度
+        int idx = static_cast<int>(m_current & kRootMask);
+        head = &m_root[idx];
+        m_root_bitmap[idx >> 6] |= 1ULL << (idx & 63);
+    }
+    else
+    {
+        uint64_t interval = expires - m_current;
+        if (interval < static_cast<uint64_t>(kRootSize))
+        {
+            int idx = static_cast<int>(expires & kRootMask);
+            head = &m_root[idx];
+            m_root_bitmap[idx >> 6] |= 1ULL << (idx & 63);
+        }
+        else
+        {
+            if (interval > kMaxInterval)
+            {
+                /// 超出时间轮范围, 先放在最高层, 下落时再重新计算
+                expires = m_current + kMaxInterval;
+                interval = kMaxInterval;
+            }
+            int level = 0;
+            while (interval >= (1ULL << (kRootBits + (level + 1) * kLevelBits)))
+            {
+                ++level;
+            }
+            int idx = static_cast<int>((expires >> (kRootBits + level * kLevelBits)) & kLevelMask);
+            head = &m_levels[level][idx];
+        }
+    }
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+/// 将节点从所在的链表中摘下
+void TimerQueue::UnlinkNode(TimerNode * node)
+{
+    TimerNode * prev = node->prev;
+    prev->next = node->next;
+    node->next->prev = prev;
+    node->prev = node->next = NULL;
+    /// 链表只剩哨兵且哨兵属于第0层时清除对应的位
+    if (prev == prev->next && prev >= m_root && prev < m_root + kRootSize)
+    {
+        int idx = static_cast<int>(prev - m_root);
+        m_root_bitmap[idx >> 6] &= ~(1ULL << (idx & 63));
+    }
+}
+
+/// 将第level层(1~3)的槽idx中的节点重新放到低层, 返回idx
+int TimerQueue::Cascade(int level, int idx)
+{
+    TimerNode * head = &m_levels[level - 1][idx];
+    TimerNode * node = head->next;
+    InitList(head);
+    while (node != head)
+    {
+        TimerNode * next = node->next;
+        AddNode(node);
+        node = next;
+    }
+    return idx;
+}
+
+/// 时间轮推进一个刻度, 执行到期的定时器
+void TimerQueue::Tick()
+{
+    int idx = static_cast<int>(m_current & kRootMask);
+    if (idx == 0)
+    {
+        for (int level = 1; level <= kLevels; ++level)
+        {
+            int shift = kRootBits + (level - 1) * kLevelBits;
+            if (Cascade(level, static_cast<int>((m_current >> shift) & kLevelMask)) != 0)
+            {
+                break;
+            }
+        }
+    }
+    ++m_current;
+
+    /// 先把整槽移到局部链表, 回调中添加或取消定时器不影响遍历
+    TimerNode expired;
+    TimerNode * slot = &m_root[idx];
+    if (slot->next == slot)
+    {
+        return;
+    }
+    expired.next = slot->next;
+    expired.prev = slot->prev;
+    expired.next->prev = &expired;
+    expired.prev->next = &expired;
+    InitList(slot);
+    m_root_bitmap[idx >> 6] &= ~(1ULL << (idx & 63));
+
+    while (expired.next != &expired)
+    {
+        TimerNode * node = expired.next;
+        UnlinkNode(node);
+        m_running = node;
+        m_running_cancelled = false;
+        node->callback();
+        m_running = NULL;
+        if (node->period != 0 && !m_running_cancelled)
+        {
+            node->expires += node->period;
+            AddNode(node);
+        }
+        else
+        {
+            FreeNode(node);
+            --m_count;
+        }
+    }
+}
+
+/// 第0层从当前刻度到本轮结束第一个有定时器的刻度, 没有则为本轮结束的刻度
+uint64_t TimerQueue::NextTick() const
+{
+    int idx = static_cast<int>(m_current & kRootMask);
+    if (idx == 0)
+    {
+        /// 新一轮开始, 需要从高层下落
+        return m_current;
+    }
+    for (int word = idx >> 6; word < kRootSize / 64; ++word)
+    {
+        uint64_t bits = m_root_bitmap[word];
+        if (word == (idx >> 6))
+        {
+            bits &= ~0ULL << (idx & 63);
+        }
+        if (bits != 0)
+        {
+            int next = word * 64 + LowestBit(bits);
+            return m_current - idx + next;
+        }
+    }
+    return (m_current | kRootMask) + 1;
+}
+
+/// 按下一次需要唤醒的刻度设置timerfd
+void TimerQueue::Rearm()
+{
+#if defined(__linux__)
+    if (m_processing)
+    {
+        return;
+    }
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (m_count == 0)
+    {
+        if (m_armed != kNotArmed)
+        {
+            ::timerfd_settime(m_handle, 0, &its, NULL);
+            m_armed = kNotArmed;
+        }
+        return;
+    }
+    uint64_t next = NextTick();
+    if (next == m_armed)
+    {
+        return;
+    }
+    uint64_t ms = m_start + next;
+    its.it_value.tv_sec = static_cast<time_t>(ms / 1000);
+    its.it_value.tv_nsec = static_cast<long>(ms % 1000) * 1000000;
+    ::timerfd_settime(m_handle, TFD_TIMER_ABSTIME, &its, NULL);
+    m_armed = next;
+#endif
+}
+
+/// 链表头(哨兵节点)初始化
+void TimerQueue::InitList(TimerNode * head)
+{
+    head->prev = head->next = head;
+}
+} // namespace reactor
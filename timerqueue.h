@@ -0,0 +1,122 @@
+#ifndef _TIMER_QUEUE_H_
+#define _TIMER_QUEUE_H_
+
+#include <deque>
+#include "reactor.h"
+
+/// @file   timerqueue.h
+/// @brief  分层时间轮定时器队列, linux下由一个timerfd驱动
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+namespace reactor
+{
+/// 分层时间轮定时器队列
+/// 第0层256个槽, 第1~3层各64个槽, 时间刻度1毫秒, 可覆盖约18.6小时,
+/// 更远的定时器先放在最高层, 随时间推移逐层下落.
+/// 添加和取消定时器都是O(1), 定时器节点放在池中复用.
+class TimerQueue : public EventHandler
+{
+public:
+
+    /// 构造函数
+    TimerQueue();
+
+    /// 析构函数
+    ~TimerQueue();
+
+    /// 获取该handler所对应的句柄(linux下为timerfd)
+    virtual handle_t GetHandle() const;
+
+    /// timerfd可读, 处理到期的定时器
+    virtual void HandleRead();
+
+    /// 添加定时器
+    /// @param  delay    首次触发的延迟(毫秒)
+    /// @param  period   触发周期(毫秒), 0表示只触发一次
+    /// @param  callback 到期时的回调函数
+    /// @retval 定时器id, 用于取消定时器
+    timer_id_t Schedule(int delay, int period, const TimerCallback & callback);
+
+    /// 取消定时器, 可在定时器回调(包括自身的回调)中调用
+    /// @retval 0   取消成功
+    /// @retval -1  定时器不存在或已到期
+    int Cancel(timer_id_t id);
+
+    /// 执行所有已到期的定时器, 并重新设置下一次唤醒时间
+    void ProcessExpired();
+
+private:
+
+    /// 定时器节点, 通过前后指针挂在时间轮的槽上
+    struct TimerNode
+    {
+        TimerNode *    prev;       ///< 前一个节点
+        TimerNode *    next;       ///< 后一个节点
+        uint64_t       expires;    ///< 到期刻度
+        uint32_t       period;     ///< 触发周期(刻度), 0表示一次性
+        uint32_t       generation; ///< 节点复用代数, 与下标一起组成定时器id
+        uint32_t       index;      ///< 节点在池中的下标
+        bool           active;     ///< 是否已添加且未到期或取消
+        TimerCallback  callback;   ///< 回调函数
+    };
+
+    /// 各层槽数
+    static const int kRootBits   = 8;
+    static const int kLevelBits  = 6;
+    static const int kRootSize   = 1 << kRootBits;
+    static const int kLevelSize  = 1 << kLevelBits;
+    static const int kRootMask   = kRootSize - 1;
+    static const int kLevelMask  = kLevelSize - 1;
+    static const int kLevels     = 3;
+    static const uint64_t kMaxInterval = (1ULL << (kRootBits + kLevels * kLevelBits)) - 1;
+
+    /// 当前的时间刻度(毫秒)
+    uint64_t Now() const;
+
+    /// 从节点池中取一个空闲节点
+    TimerNode * AllocNode();
+
+    /// 将节点放回节点池
+    void FreeNode(TimerNode * node);
+
+    /// 按到期刻度将节点挂到时间轮的槽上
+    void AddNode(TimerNode * node);
+
+    /// 将节点从所在的链表中摘下
+    void UnlinkNode(TimerNode * node);
+
+    /// 将第level层(1~3)的槽idx中的节点重新放到低层, 返回idx
+    int Cascade(int level, int idx);
+
+    /// 时间轮推进一个刻度, 执行到期的定时器
+    void Tick();
+
+    /// 第0层从当前刻度到本轮结束第一个有定时器的刻度, 没有则为本轮结束的刻度
+    uint64_t NextTick() const;
+
+    /// 按下一次需要唤醒的刻度设置timerfd
+    void Rearm();
+
+    /// 链表头(哨兵节点)初始化
+    static void InitList(TimerNode * head);
+
+private:
+
+    TimerNode               m_root[kRootSize];             ///< 第0层时间轮
+    TimerNode               m_levels[kLevels][kLevelSize]; ///< 第1~3层时间轮
+    uint64_t                m_root_bitmap[kRootSize / 64]; ///< 第0层非空槽位图
+    uint64_t                m_current;                     ///< 下一个待处理的刻度
+    uint64_t                m_armed;                       ///< timerfd已设置的唤醒刻度, kNotArmed表示未设置
+    uint64_t                m_start;                       ///< 刻度0对应的单调时钟(毫秒)
+    size_t                  m_count;                       ///< 活动的定时器个数
+    std::deque<TimerNode>   m_pool;                        ///< 节点池, deque保证节点地址不变
+    TimerNode *             m_free_list;                   ///< 空闲节点链表(用next串起)
+    TimerNode *             m_running;                     ///< 正在执行回调的节点
+    bool                    m_running_cancelled;           ///< 正在执行的定时器在回调中被取消
+    bool                    m_processing;                  ///< 正在处理到期定时器, 暂不设置timerfd
+    handle_t                m_handle;                      ///< timerfd句柄
+};
+} // namespace reactor
+
+#endif // _TIMER_QUEUE_H_
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <vector>
+#include "common.h"
+#include "reactorgroup.h"
+#include "datagramhandler.h"
+
+/// @file   udp_time_server.cpp
+/// @brief  UDP版的time_server, 每个数据报是一个请求, 应答也是一个数据报
+/// @author lovezhangkai@foxmail
+/// @date   2013-10-1
+
+/// 全局事件循环组, 每个事件循环持有一个UDP socket
+reactor::ReactorGroup * g_reactor_group = NULL;
+
+class TimeService : public reactor::DatagramHandler
+{
+public:
+
+    /// 构造函数
+    TimeService(reactor::Reactor * reactor, reactor::handle_t handle)
+        : DatagramHandler(reactor, handle) {}
+
+protected:
+
+    /// 处理一个请求, 同一批收到的请求的应答在回调结束后用sendmmsg一次发出
+    virtual void OnDatagram(const char * data, size_t len, const sockaddr * addr, socklen_t addrlen)
+    {
+        /// 请求可以带行尾
+        while (len > 0 && (data[len - 1] == '\n' || data[len - 1] == '\r'))
+        {
+            --len;
+        }
+        if (len == 4 && strncasecmp("time", data, 4) == 0)
+        {
+            char response[64];
+            int n = sprintf(response, "current time: %d\r\n", (int)time(NULL));
+            SendTo(response, n, addr, addrlen);
+        }
+        else
+        {
+            fprintf(stderr, "Invalid request: %.*s\n", (int)len, data);
+        }
+    }
+};
+
+/// 收到退出信号时停止事件循环
+void HandleSignal(int /*sig*/)
+{
+    g_reactor_group->Stop();
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s ip port [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /// 线程数缺省为CPU核数
+    reactor::ReactorGroup group(argc > 3 ? atoi(argv[3]) : 0);
+    g_reactor_group = &group;
+
+    /// 每个事件循环各自绑定同一端口, 由内核按对端地址在socket间分配数据报
+    std::vector<TimeService *> services;
+    for (int idx = 0; idx < group.Size(); ++idx)
+    {
+        reactor::handle_t handle;
+        int ret = reactor::CreateDatagramSocket(argv[1], atoi(argv[2]), true, &handle);
+        if (ret != 0)
+        {
+            errno = -ret;
+            ReportSocketError("bind");
+            return EXIT_FAILURE;
+        }
+        TimeService * service = new TimeService(group.GetReactor(idx), handle);
+        services.push_back(service);
+        /// 内核不支持时照常逐个收发
+        service->EnableGro();
+        service->EnableGso();
+        if (service->Start() != 0)
+        {
+            fprintf(stderr, "error: register handler failed\n");
+            return EXIT_FAILURE;
+        }
+    }
+    fprintf(stderr, "server started with %d threads!\n", group.Size());
+
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+
+    group.Run();
+    fprintf(stderr, "server stopped!\n");
+    /// 事件循环都已退出, 关闭socket并释放创建者的引用
+    for (size_t idx = 0; idx < services.size(); ++idx)
+    {
+        services[idx]->Close();
+    }
+    return EXIT_SUCCESS;
+}